@@ -37,6 +37,7 @@ LOCAL_SRC_FILES := \
 	src/mindroid/io/FileOutputStream.cpp \
 	src/mindroid/io/InputStream.cpp \
 	src/mindroid/io/OutputStream.cpp \
+	src/mindroid/lang/Allocator.cpp \
 	src/mindroid/lang/Boolean.cpp \
 	src/mindroid/lang/ByteArray.cpp \
 	src/mindroid/lang/Byte.cpp \
@@ -48,6 +49,7 @@ LOCAL_SRC_FILES := \
 	src/mindroid/lang/Long.cpp \
 	src/mindroid/lang/Math.cpp \
 	src/mindroid/lang/Object.cpp \
+	src/mindroid/lang/PoolAllocator.cpp \
 	src/mindroid/lang/Short.cpp \
 	src/mindroid/lang/StringArray.cpp \
 	src/mindroid/lang/StringBuilder.cpp \
@@ -78,6 +80,7 @@ LOCAL_SRC_FILES := \
 	src/mindroid/os/IRemoteCallback.cpp \
 	src/mindroid/os/IServiceManager.cpp \
 	src/mindroid/os/Looper.cpp \
+	src/mindroid/os/LooperStats.cpp \
 	src/mindroid/os/Message.cpp \
 	src/mindroid/os/MessageQueue.cpp \
 	src/mindroid/os/Parcel.cpp \
@@ -94,6 +97,7 @@ LOCAL_SRC_FILES := \
 	src/mindroid/runtime/system/ServiceDiscoveryConfigurationReader.cpp \
 	src/mindroid/runtime/system/io/AbstractClient.cpp \
 	src/mindroid/runtime/system/io/AbstractServer.cpp \
+	src/mindroid/runtime/system/io/Reactor.cpp \
 	src/mindroid/util/Assert.cpp \
 	src/mindroid/util/Base64.cpp \
 	src/mindroid/util/EventLog.cpp \
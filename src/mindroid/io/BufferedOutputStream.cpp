@@ -54,8 +54,9 @@ void BufferedOutputStream::write(const sp<ByteArray>& buffer, size_t offset, siz
     }
 
     if (count >= localBuffer->size()) {
-        flushBuffer();
-        mOutputStream->write(buffer, offset, count);
+        // Write the buffered bytes and the large buffer together.
+        mOutputStream->write(localBuffer, 0, mCount, buffer, offset, count);
+        mCount = 0;
         return;
     }
 
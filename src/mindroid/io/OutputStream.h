@@ -105,6 +105,24 @@ public:
      */
     virtual void write(const sp<ByteArray>& buffer, size_t offset, size_t count);
 
+    /**
+     * Writes {@code count} bytes from {@code buffer} starting at {@code offset}
+     * followed by {@code nextCount} bytes from {@code nextBuffer} starting at
+     * {@code nextOffset}, e.g. a message header and its payload. Streams that
+     * can gather both buffers into one operation, like socket streams, override
+     * this method. This implementation writes the buffers one after the other.
+     *
+     * @throws IOException
+     *             if an error occurs while writing to this stream.
+     * @throws IndexOutOfBoundsException
+     *             if a range exceeds the length of its buffer.
+     */
+    virtual void write(const sp<ByteArray>& buffer, size_t offset, size_t count,
+            const sp<ByteArray>& nextBuffer, size_t nextOffset, size_t nextCount) {
+        write(buffer, offset, count);
+        write(nextBuffer, nextOffset, nextCount);
+    }
+
     virtual void write(int32_t b) = 0;
 
     /**
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mindroid/lang/Allocator.h>
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/lang/String.h>
+#include <atomic>
+#include <new>
+
+namespace mindroid {
+
+// Precedes every object and records where it has to be freed.
+struct alignas(std::max_align_t) ObjectHeader {
+    Allocator* allocator;
+    size_t size;
+};
+
+static std::atomic<Allocator*> sDefaultAllocator(nullptr);
+static thread_local Allocator* tlsAllocator = nullptr;
+
+sp<String> Allocator::dump() {
+    return String::EMPTY_STRING;
+}
+
+Allocator* Allocator::getDefault() {
+    Allocator* allocator = sDefaultAllocator.load(std::memory_order_acquire);
+    if (allocator == nullptr) {
+        // Objects are created and freed during static initialization and destruction, so the
+        // default allocator is created on first use and never destroyed.
+        static PoolAllocator* const sPoolAllocator = new PoolAllocator(true);
+        sDefaultAllocator.compare_exchange_strong(allocator, sPoolAllocator, std::memory_order_acq_rel);
+        allocator = sDefaultAllocator.load(std::memory_order_acquire);
+    }
+    return allocator;
+}
+
+void Allocator::setDefault(Allocator* allocator) {
+    if (allocator != nullptr) {
+        sDefaultAllocator.store(allocator, std::memory_order_release);
+    }
+}
+
+Allocator* Allocator::getThreadAllocator() {
+    return tlsAllocator;
+}
+
+void Allocator::setThreadAllocator(Allocator* allocator) {
+    tlsAllocator = allocator;
+}
+
+void* Allocator::allocateObject(size_t size) {
+    Allocator* allocator = tlsAllocator;
+    if (allocator == nullptr) {
+        allocator = getDefault();
+    }
+    ObjectHeader* header = static_cast<ObjectHeader*>(allocator->allocate(sizeof(ObjectHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->allocator = allocator;
+    header->size = size;
+    return header + 1;
+}
+
+void Allocator::freeObject(void* pointer) noexcept {
+    if (pointer != nullptr) {
+        ObjectHeader* header = static_cast<ObjectHeader*>(pointer) - 1;
+        header->allocator->free(header, sizeof(ObjectHeader) + header->size);
+    }
+}
+
+} /* namespace mindroid */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_LANG_ALLOCATOR_H_
+#define MINDROID_LANG_ALLOCATOR_H_
+
+#include <cstddef>
+
+namespace mindroid {
+
+template<typename T> class sp;
+class String;
+
+/**
+ * Memory allocator for {@link Object}s and {@link LightweightObject}s. Both classes allocate their
+ * instances through the allocator of the creating thread (see setThreadAllocator()), which
+ * defaults to the process-wide allocator (see getDefault()). Every allocation remembers its
+ * allocator, so an object may be released on any thread and the thread allocator may be changed at
+ * any time. An allocator must stay alive until all its allocations have been freed.
+ */
+class Allocator {
+public:
+    Allocator() = default;
+    virtual ~Allocator() = default;
+    Allocator(const Allocator&) = delete;
+    Allocator& operator=(const Allocator&) = delete;
+
+    /**
+     * Returns a block of at least <em>size</em> bytes that is aligned like std::max_align_t, or
+     * nullptr if the allocator is out of memory.
+     */
+    virtual void* allocate(size_t size) = 0;
+
+    /**
+     * Returns a block to the allocator. <em>size</em> is the size that it was allocated with.
+     */
+    virtual void free(void* pointer, size_t size) = 0;
+
+    /**
+     * Returns a human-readable summary of the allocator statistics.
+     */
+    virtual sp<String> dump();
+
+    /**
+     * Returns the process-wide allocator, a {@link PoolAllocator} with per-thread caches unless
+     * it was replaced by setDefault().
+     */
+    static Allocator* getDefault();
+
+    /**
+     * Replaces the process-wide allocator. The previous allocator must stay alive until all its
+     * allocations have been freed.
+     */
+    static void setDefault(Allocator* allocator);
+
+    /**
+     * Returns the allocator of the calling thread, or nullptr if the thread uses the default
+     * allocator.
+     */
+    static Allocator* getThreadAllocator();
+
+    /**
+     * Sets the allocator for all objects that the calling thread creates from now on. Pass
+     * nullptr to switch back to the default allocator.
+     */
+    static void setThreadAllocator(Allocator* allocator);
+
+    /// @private
+    static void* allocateObject(size_t size);
+    /// @private
+    static void freeObject(void* pointer) noexcept;
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_LANG_ALLOCATOR_H_ */
@@ -21,6 +21,7 @@
 #include <cstring>
 #include <typeinfo>
 #include <mutex>
+#include <thread>
 
 // Log all reference counting operations
 #define PRINT_REFERENCES 0
@@ -28,10 +29,44 @@
 #define DEBUG_REFERENCES 0
 #define DEBUG_REFERENCES_TRACK_REFERENCES 0
 #define DEBUG_REFERENCES_MEMORIZE_REF_OPERATIONS_DURING_REF_TRACKING 0
+// Check that thread-confined objects are only referenced by their owner thread
+#ifndef NDEBUG
+#define DEBUG_THREAD_CONFINEMENT 1
+#else
+#define DEBUG_THREAD_CONFINEMENT 0
+#endif
 
 namespace mindroid {
 
 #define INITIAL_STRONG_REFERENCE_VALUE (1<<28)
+#define OBJECT_THREAD_CONFINED (1<<1)
+
+// Objects keep their strong reference count inline until they need a WeakReferenceImpl for weak
+// references, an object destroyer or an extended object lifetime. mReference then points to the
+// WeakReferenceImpl, otherwise its lowest bit is set and the upper bits hold the strong reference count.
+#define INLINE_REFERENCE_COUNT ((uintptr_t) 1)
+#define INLINE_THREAD_CONFINED ((uintptr_t) 2)
+#define INLINE_FLAGS_MASK ((uintptr_t) 3)
+#define INLINE_REFERENCE_COUNT_SHIFT 2
+#define INLINE_ONE_REFERENCE ((uintptr_t) 1 << INLINE_REFERENCE_COUNT_SHIFT)
+
+static inline bool isInlineReferenceCount(uintptr_t referenceValue) {
+    return (referenceValue & INLINE_REFERENCE_COUNT) != 0;
+}
+
+static inline int32_t getInlineReferenceCount(uintptr_t referenceValue) {
+    return (int32_t) (referenceValue >> INLINE_REFERENCE_COUNT_SHIFT);
+}
+
+// Thread-confined objects update their reference counters without atomic read-modify-write operations.
+static inline int32_t fetchAdd(std::atomic<int32_t>& counter, int32_t value, bool threadConfined, std::memory_order order) {
+    if (threadConfined) {
+        const int32_t oldValue = counter.load(std::memory_order_relaxed);
+        counter.store(oldValue + value, std::memory_order_relaxed);
+        return oldValue;
+    }
+    return counter.fetch_add(value, order);
+}
 
 class Object::WeakReferenceImpl : public Object::WeakReference {
 public:
@@ -40,6 +75,19 @@ public:
     Object* const mObject;
     std::atomic<int32_t> mFlags;
     Destroyer* mDestroyer;
+#if DEBUG_THREAD_CONFINEMENT
+    std::thread::id mOwnerThread;
+#endif
+
+    bool isThreadConfined() const {
+        if ((mFlags.load(std::memory_order_relaxed) & OBJECT_THREAD_CONFINED) == 0) {
+            return false;
+        }
+#if DEBUG_THREAD_CONFINEMENT
+        ASSERT(mOwnerThread == std::this_thread::get_id(), "Thread-confined object %p referenced by a foreign thread", mObject);
+#endif
+        return true;
+    }
 
 #if !DEBUG_REFERENCES
     explicit WeakReferenceImpl(Object* object) :
@@ -208,19 +256,56 @@ private:
 #endif
 };
 
-Object::Object() : mReference(new WeakReferenceImpl(this)) { }
+Object::Object() :
+        mReference(INLINE_REFERENCE_COUNT | ((uintptr_t) INITIAL_STRONG_REFERENCE_VALUE << INLINE_REFERENCE_COUNT_SHIFT)) {
+#if DEBUG_REFERENCES
+    getWeakReferenceImpl();
+#endif
+}
 
 Object::~Object() {
-    int32_t flags = mReference->mFlags.load(std::memory_order_relaxed);
+    const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    if (isInlineReferenceCount(referenceValue)) {
+        return;
+    }
+    WeakReferenceImpl* const reference = reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+    int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
     if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_WEAK_REFERENCE) {
-        if (mReference->mWeakReferenceCounter.load(std::memory_order_relaxed) == 0) {
-            delete mReference;
+        if (reference->mWeakReferenceCounter.load(std::memory_order_relaxed) == 0) {
+            delete reference;
         }
-    } else if (mReference->mStrongReferenceCounter.load(std::memory_order_relaxed) == INITIAL_STRONG_REFERENCE_VALUE) {
-        delete mReference;
+    } else if (reference->mStrongReferenceCounter.load(std::memory_order_relaxed) == INITIAL_STRONG_REFERENCE_VALUE) {
+        delete reference;
     }
     // For debugging purposes, clear mReference.
-    const_cast<WeakReferenceImpl*&>(mReference) = nullptr;
+    mReference.store(0, std::memory_order_relaxed);
+}
+
+Object::WeakReferenceImpl* Object::getWeakReferenceImpl() const {
+    uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    if (!isInlineReferenceCount(referenceValue)) {
+        return reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+    }
+
+    // Move the inline strong reference count into a new WeakReferenceImpl.
+    WeakReferenceImpl* const reference = new WeakReferenceImpl(const_cast<Object*>(this));
+    for (;;) {
+        const int32_t strongReferenceCount = getInlineReferenceCount(referenceValue);
+        reference->mStrongReferenceCounter.store(strongReferenceCount, std::memory_order_relaxed);
+        // Each strong reference also holds a weak reference. A strong reference count of zero means
+        // that onLastReference() is running and decStrongReference() still has to release its weak reference.
+        reference->mWeakReferenceCounter.store((strongReferenceCount == INITIAL_STRONG_REFERENCE_VALUE) ? 0 :
+                ((strongReferenceCount == 0) ? 1 : strongReferenceCount), std::memory_order_relaxed);
+        reference->mFlags.store((referenceValue & INLINE_THREAD_CONFINED) ? OBJECT_THREAD_CONFINED : 0, std::memory_order_relaxed);
+        if (mReference.compare_exchange_weak(referenceValue, reinterpret_cast<uintptr_t>(reference),
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return reference;
+        }
+        if (!isInlineReferenceCount(referenceValue)) {
+            delete reference;
+            return reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+        }
+    }
 }
 
 bool Object::equals(const sp<Object>& other) const {
@@ -231,14 +316,36 @@ bool Object::equals(const sp<Object>& other) const {
 }
 
 size_t Object::hashCode() const {
-    return (size_t) mReference->mObject;
+    return (size_t) this;
 }
 
 void Object::incStrongReference(const void* id) const {
-    WeakReferenceImpl* const reference = mReference;
+    uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    while (isInlineReferenceCount(referenceValue)) {
+        const int32_t oldStrongReferenceCount = getInlineReferenceCount(referenceValue);
+        ASSERT(oldStrongReferenceCount > 0, "Object::incStrongReference() called on %p after underflow", this);
+        const uintptr_t newReferenceValue = (oldStrongReferenceCount == INITIAL_STRONG_REFERENCE_VALUE) ?
+                (referenceValue & INLINE_FLAGS_MASK) | INLINE_ONE_REFERENCE : referenceValue + INLINE_ONE_REFERENCE;
+        if (referenceValue & INLINE_THREAD_CONFINED) {
+            mReference.store(newReferenceValue, std::memory_order_relaxed);
+        } else if (!mReference.compare_exchange_weak(referenceValue, newReferenceValue,
+                std::memory_order_acquire, std::memory_order_acquire)) {
+            continue;
+        }
+#if PRINT_REFERENCES
+        DEBUG_INFO("Object::incStrongReference() of %p from %p: reference count is %d\n", this, id, getInlineReferenceCount(newReferenceValue));
+#endif
+        if (oldStrongReferenceCount == INITIAL_STRONG_REFERENCE_VALUE) {
+            const_cast<Object*>(this)->onFirstReference();
+        }
+        return;
+    }
+
+    WeakReferenceImpl* const reference = reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+    const bool threadConfined = reference->isThreadConfined();
     reference->incWeakReference(id);
     reference->addStrongReference(id);
-    const int32_t oldStrongReferenceCount = reference->mStrongReferenceCounter.fetch_add(1, std::memory_order_relaxed);
+    const int32_t oldStrongReferenceCount = fetchAdd(reference->mStrongReferenceCounter, 1, threadConfined, std::memory_order_relaxed);
     ASSERT(oldStrongReferenceCount > 0, "Object::incStrongReference() called on %p after underflow", reference);
 #if PRINT_REFERENCES
     if (oldStrongReferenceCount == INITIAL_STRONG_REFERENCE_VALUE) {
@@ -250,39 +357,79 @@ void Object::incStrongReference(const void* id) const {
     if (oldStrongReferenceCount != INITIAL_STRONG_REFERENCE_VALUE) {
         return;
     }
-    reference->mStrongReferenceCounter.fetch_sub(INITIAL_STRONG_REFERENCE_VALUE, std::memory_order_relaxed);
+    fetchAdd(reference->mStrongReferenceCounter, -INITIAL_STRONG_REFERENCE_VALUE, threadConfined, std::memory_order_relaxed);
     const_cast<Object*>(this)->onFirstReference();
 }
 
 void Object::decStrongReference(const void* id) const {
-    WeakReferenceImpl* const reference = mReference;
-    reference->removeStrongReference(id);
-    const int32_t oldStrongReferenceCount = reference->mStrongReferenceCounter.fetch_sub(1, std::memory_order_release);
+    bool lastReference = false;
+    uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    while (isInlineReferenceCount(referenceValue)) {
+        const int32_t oldStrongReferenceCount = getInlineReferenceCount(referenceValue);
+        ASSERT(oldStrongReferenceCount >= 1, "Object::decStrongReference() called on %p too many times", this);
+        const bool threadConfined = (referenceValue & INLINE_THREAD_CONFINED) != 0;
+        if (threadConfined) {
+            mReference.store(referenceValue - INLINE_ONE_REFERENCE, std::memory_order_relaxed);
+        } else if (!mReference.compare_exchange_weak(referenceValue, referenceValue - INLINE_ONE_REFERENCE,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            continue;
+        }
 #if PRINT_REFERENCES
-    DEBUG_INFO("Object::decStrongReference() of %p from %p: reference count is %d\n", this, id, oldStrongReferenceCount - 1);
+        DEBUG_INFO("Object::decStrongReference() of %p from %p: reference count is %d\n", this, id, oldStrongReferenceCount - 1);
 #endif
-    ASSERT(oldStrongReferenceCount >= 1, "Object::decStrongReference() called on %p too many times", reference);
-    if (oldStrongReferenceCount == 1) {
-        std::atomic_thread_fence(std::memory_order_acquire);
+        if (oldStrongReferenceCount != 1) {
+            return;
+        }
         const_cast<Object*>(this)->onLastReference(id);
-        int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
-        if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG_REFERENCE) {
-            if (reference->mDestroyer == nullptr) {
-                delete this;
-            } else {
-                reference->mDestroyer->destroy(const_cast<Object*>(this));
-            }
+        referenceValue = mReference.load(std::memory_order_acquire);
+        if (isInlineReferenceCount(referenceValue)) {
+            delete this;
+            return;
+        }
+        // onLastReference() created a WeakReferenceImpl, e.g. for a weak reference or an object destroyer.
+        lastReference = true;
+        break;
+    }
+
+    WeakReferenceImpl* const reference = reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+    if (!lastReference) {
+        const bool threadConfined = reference->isThreadConfined();
+        reference->removeStrongReference(id);
+        const int32_t oldStrongReferenceCount = fetchAdd(reference->mStrongReferenceCounter, -1, threadConfined, std::memory_order_release);
+#if PRINT_REFERENCES
+        DEBUG_INFO("Object::decStrongReference() of %p from %p: reference count is %d\n", this, id, oldStrongReferenceCount - 1);
+#endif
+        ASSERT(oldStrongReferenceCount >= 1, "Object::decStrongReference() called on %p too many times", reference);
+        if (oldStrongReferenceCount != 1) {
+            reference->decWeakReference(id);
+            return;
+        }
+        if (!threadConfined) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        const_cast<Object*>(this)->onLastReference(id);
+    }
+    int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
+    if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG_REFERENCE) {
+        if (reference->mDestroyer == nullptr) {
+            delete this;
+        } else {
+            reference->mDestroyer->destroy(const_cast<Object*>(this));
         }
     }
     reference->decWeakReference(id);
 }
 
 int32_t Object::getStrongReferenceCount() const {
-    return mReference->mStrongReferenceCounter.load(std::memory_order_relaxed);
+    const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    if (isInlineReferenceCount(referenceValue)) {
+        return getInlineReferenceCount(referenceValue);
+    }
+    return reinterpret_cast<WeakReferenceImpl*>(referenceValue)->mStrongReferenceCounter.load(std::memory_order_relaxed);
 }
 
-void Object::moveStrongReference(const void* oldId, const void* newId) const {
-    WeakReferenceImpl* const reference = mReference;
+void Object::moveTrackedStrongReference(const void* oldId, const void* newId) const {
+    WeakReferenceImpl* const reference = getWeakReferenceImpl();
     reference->removeWeakReference(oldId);
     reference->addWeakReference(newId);
     reference->removeStrongReference(oldId);
@@ -292,26 +439,75 @@ void Object::moveStrongReference(const void* oldId, const void* newId) const {
 void Object::setObjectLifetime(int32_t mode) const {
     switch (mode) {
     case OBJECT_LIFETIME_WEAK_REFERENCE: {
-        mReference->mFlags.fetch_or(mode, std::memory_order_relaxed);
+        getWeakReferenceImpl()->mFlags.fetch_or(mode, std::memory_order_relaxed);
         break;
     }
     case OBJECT_LIFETIME_STRONG_REFERENCE: {
-        int32_t flags = mReference->mFlags.load(std::memory_order_relaxed);
+        const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+        if (isInlineReferenceCount(referenceValue)) {
+            break;
+        }
+        WeakReferenceImpl* const reference = reinterpret_cast<WeakReferenceImpl*>(referenceValue);
+        int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
         if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_WEAK_REFERENCE) {
-            int32_t strongReferenceCount = mReference->mStrongReferenceCounter.load(std::memory_order_relaxed);
-            ASSERT(strongReferenceCount >= 0, "Object::setObjectLifetime() called on %p in illegal state", mReference);
+            int32_t strongReferenceCount = reference->mStrongReferenceCounter.load(std::memory_order_relaxed);
+            ASSERT(strongReferenceCount >= 0, "Object::setObjectLifetime() called on %p in illegal state", reference);
             while (strongReferenceCount == 0) {
-                if (mReference->mStrongReferenceCounter.compare_exchange_weak(strongReferenceCount, INITIAL_STRONG_REFERENCE_VALUE, std::memory_order_relaxed)) {
+                if (reference->mStrongReferenceCounter.compare_exchange_weak(strongReferenceCount, INITIAL_STRONG_REFERENCE_VALUE, std::memory_order_relaxed)) {
                     break;
                 }
             }
-            mReference->mFlags.fetch_and(mode, std::memory_order_relaxed);
+            reference->mFlags.fetch_and(~OBJECT_LIFETIME_MASK, std::memory_order_relaxed);
         }
         break;
     }
     }
 }
 
+void Object::setThreadConfined(bool threadConfined) const {
+    const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+#if !DEBUG_THREAD_CONFINEMENT
+    // Debug builds keep the owner thread of thread-confined objects in their WeakReferenceImpl.
+    if (isInlineReferenceCount(referenceValue)) {
+        mReference.store(threadConfined ? (referenceValue | INLINE_THREAD_CONFINED) : (referenceValue & ~INLINE_THREAD_CONFINED),
+                std::memory_order_relaxed);
+        return;
+    }
+#endif
+    if (!threadConfined && isInlineReferenceCount(referenceValue)) {
+        return;
+    }
+    WeakReferenceImpl* const reference = getWeakReferenceImpl();
+    const int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
+    if (threadConfined) {
+        if ((flags & OBJECT_THREAD_CONFINED) == 0) {
+#if DEBUG_THREAD_CONFINEMENT
+            reference->mOwnerThread = std::this_thread::get_id();
+#endif
+            reference->mFlags.store(flags | OBJECT_THREAD_CONFINED, std::memory_order_relaxed);
+        }
+    } else if (reference->isThreadConfined()) {
+        reference->mFlags.store(flags & ~OBJECT_THREAD_CONFINED, std::memory_order_relaxed);
+    }
+}
+
+bool Object::isThreadConfined() const {
+    const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    if (isInlineReferenceCount(referenceValue)) {
+        return (referenceValue & INLINE_THREAD_CONFINED) != 0;
+    }
+    return reinterpret_cast<WeakReferenceImpl*>(referenceValue)->isThreadConfined();
+}
+
+bool Object::isUniquelyReferenced() const {
+    // Synchronizes with the release of the last foreign reference.
+    const uintptr_t referenceValue = mReference.load(std::memory_order_acquire);
+    if (isInlineReferenceCount(referenceValue)) {
+        return getInlineReferenceCount(referenceValue) == 1;
+    }
+    return reinterpret_cast<WeakReferenceImpl*>(referenceValue)->mWeakReferenceCounter.load(std::memory_order_acquire) == 1;
+}
+
 void Object::onFirstReference() {
 }
 
@@ -319,7 +515,7 @@ void Object::onLastReference(const void* id) {
 }
 
 void Object::setDestroyer(Object::Destroyer* destroyer) {
-    mReference->mDestroyer = destroyer;
+    getWeakReferenceImpl()->mDestroyer = destroyer;
 }
 
 Object::Destroyer::~Destroyer() {
@@ -332,20 +528,23 @@ Object* Object::WeakReference::toObject() const {
 void Object::WeakReference::incWeakReference(const void* id) {
     WeakReferenceImpl* const reference = static_cast<WeakReferenceImpl*>(this);
     reference->addWeakReference(id);
-    const int32_t oldWeakReferenceCount = reference->mWeakReferenceCounter.fetch_add(1, std::memory_order_relaxed);
+    const int32_t oldWeakReferenceCount = fetchAdd(reference->mWeakReferenceCounter, 1, reference->isThreadConfined(), std::memory_order_relaxed);
     ASSERT(oldWeakReferenceCount >= 0, "Object::WeakReference::incWeakReference() called on %p after underflow", this);
 }
 
 void Object::WeakReference::decWeakReference(const void* id) {
     WeakReferenceImpl* const reference = static_cast<WeakReferenceImpl*>(this);
+    const bool threadConfined = reference->isThreadConfined();
     reference->removeWeakReference(id);
-    const int32_t oldWeakReferenceCount = reference->mWeakReferenceCounter.fetch_sub(1, std::memory_order_release);
+    const int32_t oldWeakReferenceCount = fetchAdd(reference->mWeakReferenceCounter, -1, threadConfined, std::memory_order_release);
     ASSERT(oldWeakReferenceCount >= 1, "Object::WeakReference::decWeakReference() called on %p too many times", this);
     if (oldWeakReferenceCount != 1) {
         return;
     }
 
-    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!threadConfined) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
     int32_t flags = reference->mFlags.load(std::memory_order_relaxed);
     if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG_REFERENCE) {
         if (reference->mStrongReferenceCounter.load(std::memory_order_relaxed) == INITIAL_STRONG_REFERENCE_VALUE) {
@@ -432,12 +631,13 @@ void Object::WeakReference::trackReference(bool trackReference, bool memorizeRef
 }
 
 Object::WeakReference* Object::createWeakReference(const void* id) const {
-    mReference->incWeakReference(id);
-    return mReference;
+    WeakReferenceImpl* const reference = getWeakReferenceImpl();
+    reference->incWeakReference(id);
+    return reference;
 }
 
 Object::WeakReference* Object::getWeakReference() const {
-    return mReference;
+    return getWeakReferenceImpl();
 }
 
 void spDataRaceException() {
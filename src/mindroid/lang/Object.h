@@ -18,6 +18,7 @@
 #ifndef MINDROID_LANG_OBJECT_H_
 #define MINDROID_LANG_OBJECT_H_
 
+#include <mindroid/lang/Allocator.h>
 #include <atomic>
 #include <cstdint>
 #include <cinttypes>
@@ -57,9 +58,20 @@ public:
     WeakReference* createWeakReference(const void* id) const;
     WeakReference* getWeakReference() const;
 
+    /**
+     * Returns true if the caller holds the only (strong or weak) reference to this object, e.g.
+     * to check that no other thread still references an object before confining it.
+     */
+    bool isUniquelyReferenced() const;
+
     // Debugging APIs.
     int32_t getStrongReferenceCount() const;
-    void moveStrongReference(const void* oldId, const void* newId) const;
+    inline void moveStrongReference(const void* oldId, const void* newId) const {
+        // Only objects with a WeakReferenceImpl track their references, so moving an sp<> is free otherwise.
+        if ((mReference.load(std::memory_order_relaxed) & 1) == 0) {
+            moveTrackedStrongReference(oldId, newId);
+        }
+    }
     // Print all references for this object
     inline void printReferences() const { getWeakReference()->printReferences(); }
     inline void trackReference(bool trackReferences, bool memorizeRefOperationsDuringRefTracking) {
@@ -86,6 +98,12 @@ public:
     virtual bool equals(const sp<Object>& object) const;
     virtual size_t hashCode() const;
 
+    // Objects are allocated through the Allocator of the creating thread.
+    static void* operator new(size_t size) { return Allocator::allocateObject(size); }
+    static void* operator new(size_t, void* pointer) noexcept { return pointer; }
+    static void operator delete(void* pointer) noexcept { Allocator::freeObject(pointer); }
+    static void operator delete(void*, void*) noexcept { }
+
 protected:
     virtual ~Object();
     Object(const Object&) = delete;
@@ -101,12 +119,29 @@ protected:
 
     void setObjectLifetime(int32_t mode) const;
 
+    /**
+     * Switches the reference counting of this object between atomic operations (the default) and
+     * plain operations for objects that never leave their thread. While an object is thread-confined
+     * all its strong and weak references must be acquired and released by the thread that confined
+     * it. To hand the object over to another thread, switch back to atomic reference counting first.
+     * Debug builds assert that thread-confined objects are only referenced by their owner thread.
+     * They keep the owner thread in a WeakReferenceImpl, so confined objects lose their inline
+     * reference count there.
+     */
+    void setThreadConfined(bool threadConfined) const;
+    bool isThreadConfined() const;
+
     virtual void onFirstReference();
     virtual void onLastReference(const void* id);
 
 private:
     class WeakReferenceImpl;
-    WeakReferenceImpl* const mReference;
+
+    WeakReferenceImpl* getWeakReferenceImpl() const;
+    void moveTrackedStrongReference(const void* oldId, const void* newId) const;
+
+    // Either the inline strong reference count or a pointer to the lazily created WeakReferenceImpl.
+    mutable std::atomic<uintptr_t> mReference;
 
     friend class WeakReference;
 
@@ -139,6 +174,11 @@ public:
             __attribute__((unused)) const void* newId) const {
     }
 
+    static void* operator new(size_t size) { return Allocator::allocateObject(size); }
+    static void* operator new(size_t, void* pointer) noexcept { return pointer; }
+    static void operator delete(void* pointer) noexcept { Allocator::freeObject(pointer); }
+    static void operator delete(void*, void*) noexcept { }
+
 protected:
     inline ~LightweightObject() { }
 
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/lang/String.h>
+#include <mindroid/lang/StringBuilder.h>
+#include <cinttypes>
+#include <cstdlib>
+
+namespace mindroid {
+
+const size_t PoolAllocator::MAX_BLOCK_SIZE;
+const size_t PoolAllocator::CHUNK_SIZE;
+const size_t PoolAllocator::SIZE_CLASS_COUNT;
+
+struct PoolAllocator::ThreadCache {
+    // The thread-caching allocator, or nullptr until the first allocation of the thread.
+    PoolAllocator* allocator;
+    bool destroyed;
+    Block* freeLists[SIZE_CLASS_COUNT];
+    size_t sizes[SIZE_CLASS_COUNT];
+    // Operations that are not yet reported back to the shared pools.
+    uint64_t allocationCounts[SIZE_CLASS_COUNT];
+    uint64_t freeCounts[SIZE_CLASS_COUNT];
+};
+
+// Returns the cached blocks to the shared pools when the thread exits. The ThreadCache itself has no
+// destructor, so objects that other thread_local destructors free afterwards still find it.
+class PoolAllocator::ThreadCacheGuard {
+public:
+    ThreadCacheGuard() {
+    }
+
+    ~ThreadCacheGuard() {
+        ThreadCache* cache = &sThreadCache;
+        if (cache->allocator != nullptr) {
+            cache->allocator->flush(cache);
+            cache->allocator = nullptr;
+        }
+        cache->destroyed = true;
+    }
+};
+
+thread_local PoolAllocator::ThreadCache PoolAllocator::sThreadCache;
+thread_local PoolAllocator::ThreadCacheGuard PoolAllocator::sThreadCacheGuard;
+
+PoolAllocator::PoolAllocator() :
+        PoolAllocator(false) {
+}
+
+PoolAllocator::PoolAllocator(bool threadCaches) :
+        mThreadCaches(threadCaches),
+        mLargeAllocationCount(0),
+        mLargeBytesInUse(0),
+        mReferenceCount(1) {
+}
+
+PoolAllocator::~PoolAllocator() {
+    for (void* chunk : mChunks) {
+        std::free(chunk);
+    }
+}
+
+void* PoolAllocator::allocate(size_t size) {
+    if (size > MAX_BLOCK_SIZE) {
+        return allocateLarge(size);
+    }
+
+    const size_t sizeClass = getSizeClass(size);
+    if (mThreadCaches) {
+        ThreadCache* cache = getThreadCache();
+        if (cache != nullptr) {
+            if (cache->freeLists[sizeClass] == nullptr) {
+                refill(cache, sizeClass);
+                if (cache->freeLists[sizeClass] == nullptr) {
+                    return nullptr;
+                }
+            }
+            Block* block = cache->freeLists[sizeClass];
+            cache->freeLists[sizeClass] = block->next;
+            cache->sizes[sizeClass]--;
+            cache->allocationCounts[sizeClass]++;
+            return block;
+        }
+    } else {
+        mReferenceCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Pool& pool = mPools[sizeClass];
+    Block* block;
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        block = allocateBlock(sizeClass);
+        if (block != nullptr) {
+            pool.allocationCount++;
+        }
+    }
+    if (block == nullptr && !mThreadCaches) {
+        release();
+    }
+    return block;
+}
+
+void PoolAllocator::free(void* pointer, size_t size) {
+    if (size > MAX_BLOCK_SIZE) {
+        freeLarge(pointer, size);
+        return;
+    }
+
+    const size_t sizeClass = getSizeClass(size);
+    Block* block = static_cast<Block*>(pointer);
+    if (mThreadCaches) {
+        ThreadCache* cache = getThreadCache();
+        if (cache != nullptr) {
+            block->next = cache->freeLists[sizeClass];
+            cache->freeLists[sizeClass] = block;
+            cache->sizes[sizeClass]++;
+            cache->freeCounts[sizeClass]++;
+            const size_t capacity = getCacheCapacity(sizeClass);
+            if (cache->sizes[sizeClass] > capacity) {
+                spill(cache, sizeClass, capacity / 2);
+            }
+            return;
+        }
+    }
+
+    Pool& pool = mPools[sizeClass];
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        block->next = pool.freeList;
+        pool.freeList = block;
+        pool.freeCount++;
+        pool.freeCallCount++;
+    }
+    if (!mThreadCaches) {
+        release();
+    }
+}
+
+sp<String> PoolAllocator::dump() {
+    struct Line {
+        size_t chunkCount;
+        size_t freeCount;
+        uint64_t allocationCount;
+        int64_t inUse;
+    } lines[SIZE_CLASS_COUNT];
+
+    // Collect first since formatting allocates objects itself.
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        Pool& pool = mPools[i];
+        std::lock_guard<std::mutex> lock(pool.lock);
+        lines[i].chunkCount = pool.chunkCount;
+        lines[i].freeCount = pool.freeCount;
+        lines[i].allocationCount = pool.allocationCount;
+        lines[i].inUse = (int64_t) (pool.allocationCount - pool.freeCallCount);
+    }
+
+    sp<StringBuilder> sb = new StringBuilder();
+    sb->append(String::format("%s pool allocator\n", mThreadCaches ? "Thread-caching" : "Arena"));
+    sb->append("  Block  Chunks    In use      Free   Allocations\n");
+    size_t chunkCount = 0;
+    size_t bytesInUse = 0;
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        if (lines[i].chunkCount == 0) {
+            continue;
+        }
+        // Blocks in thread caches may have been counted as freed by one thread but not yet as allocated by another.
+        const size_t inUse = (lines[i].inUse > 0) ? (size_t) lines[i].inUse : 0;
+        sb->append(String::format("  %5zu  %6zu  %8zu  %8zu  %12" PRIu64 "\n", getBlockSize(i),
+                lines[i].chunkCount, inUse, lines[i].freeCount, lines[i].allocationCount));
+        chunkCount += lines[i].chunkCount;
+        bytesInUse += inUse * getBlockSize(i);
+    }
+    const size_t largeBytesInUse = mLargeBytesInUse.load(std::memory_order_relaxed);
+    sb->append(String::format("  Large blocks: %" PRIu64 " allocations, %zu bytes in use\n",
+            mLargeAllocationCount.load(std::memory_order_relaxed), largeBytesInUse));
+    sb->append(String::format("  Total: %zu KiB reserved, %zu KiB in use",
+            (chunkCount * CHUNK_SIZE + largeBytesInUse) / 1024, (bytesInUse + largeBytesInUse) / 1024));
+    return sb->toString();
+}
+
+void PoolAllocator::close() {
+    release();
+}
+
+uint64_t PoolAllocator::getAllocationCount() {
+    uint64_t allocationCount = mLargeAllocationCount.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        std::lock_guard<std::mutex> lock(mPools[i].lock);
+        allocationCount += mPools[i].allocationCount;
+    }
+    return allocationCount;
+}
+
+size_t PoolAllocator::getBytesInUse() {
+    size_t bytesInUse = mLargeBytesInUse.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        std::lock_guard<std::mutex> lock(mPools[i].lock);
+        const int64_t inUse = (int64_t) (mPools[i].allocationCount - mPools[i].freeCallCount);
+        if (inUse > 0) {
+            bytesInUse += (size_t) inUse * getBlockSize(i);
+        }
+    }
+    return bytesInUse;
+}
+
+size_t PoolAllocator::getBytesReserved() {
+    std::lock_guard<std::mutex> lock(mChunkLock);
+    return mChunks.size() * CHUNK_SIZE + mLargeBytesInUse.load(std::memory_order_relaxed);
+}
+
+size_t PoolAllocator::getSizeClass(size_t size) {
+    // 16 byte steps up to 128 bytes, then four size classes per power of two up to 1024 bytes.
+    if (size <= 128) {
+        return (size == 0) ? 0 : (size - 1) >> 4;
+    }
+    const size_t log2 = (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size - 1);
+    return 8 + (log2 - 7) * 4 + ((size - 1) >> (log2 - 2)) - 4;
+}
+
+size_t PoolAllocator::getBlockSize(size_t sizeClass) {
+    if (sizeClass < 8) {
+        return (sizeClass + 1) * 16;
+    }
+    const size_t log2 = 7 + (sizeClass - 8) / 4;
+    return (((sizeClass - 8) % 4) + 5) << (log2 - 2);
+}
+
+size_t PoolAllocator::getCacheCapacity(size_t sizeClass) {
+    const size_t capacity = 16 * 1024 / getBlockSize(sizeClass);
+    return (capacity < 8) ? 8 : ((capacity > 256) ? 256 : capacity);
+}
+
+PoolAllocator::Block* PoolAllocator::allocateBlock(size_t sizeClass) {
+    Pool& pool = mPools[sizeClass];
+    if (pool.freeList == nullptr) {
+        addChunk(sizeClass);
+        if (pool.freeList == nullptr) {
+            return nullptr;
+        }
+    }
+    Block* block = pool.freeList;
+    pool.freeList = block->next;
+    pool.freeCount--;
+    return block;
+}
+
+void PoolAllocator::addChunk(size_t sizeClass) {
+    char* chunk = static_cast<char*>(std::malloc(CHUNK_SIZE));
+    if (chunk == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mChunkLock);
+        mChunks.push_back(chunk);
+    }
+
+    Pool& pool = mPools[sizeClass];
+    const size_t blockSize = getBlockSize(sizeClass);
+    const size_t blockCount = CHUNK_SIZE / blockSize;
+    // Link the blocks in ascending order so that consecutive allocations are adjacent in memory.
+    for (size_t i = blockCount; i-- > 0;) {
+        Block* block = reinterpret_cast<Block*>(chunk + i * blockSize);
+        block->next = pool.freeList;
+        pool.freeList = block;
+    }
+    pool.freeCount += blockCount;
+    pool.chunkCount++;
+}
+
+void* PoolAllocator::allocateLarge(size_t size) {
+    void* pointer = std::malloc(size);
+    if (pointer != nullptr) {
+        mLargeAllocationCount.fetch_add(1, std::memory_order_relaxed);
+        mLargeBytesInUse.fetch_add(size, std::memory_order_relaxed);
+        if (!mThreadCaches) {
+            mReferenceCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return pointer;
+}
+
+void PoolAllocator::freeLarge(void* pointer, size_t size) {
+    std::free(pointer);
+    mLargeBytesInUse.fetch_sub(size, std::memory_order_relaxed);
+    if (!mThreadCaches) {
+        release();
+    }
+}
+
+void PoolAllocator::release() {
+    if (mReferenceCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+PoolAllocator::ThreadCache* PoolAllocator::getThreadCache() {
+    ThreadCache* cache = &sThreadCache;
+    if (cache->allocator == nullptr) {
+        if (cache->destroyed) {
+            return nullptr;
+        }
+        // Instantiates the guard that flushes the cache at thread exit.
+        (void) &sThreadCacheGuard;
+        cache->allocator = this;
+    }
+    return cache;
+}
+
+void PoolAllocator::refill(ThreadCache* cache, size_t sizeClass) {
+    const size_t count = getCacheCapacity(sizeClass) / 2;
+    Pool& pool = mPools[sizeClass];
+    std::lock_guard<std::mutex> lock(pool.lock);
+    pool.allocationCount += cache->allocationCounts[sizeClass];
+    pool.freeCallCount += cache->freeCounts[sizeClass];
+    cache->allocationCounts[sizeClass] = 0;
+    cache->freeCounts[sizeClass] = 0;
+    for (size_t i = 0; i < count; i++) {
+        Block* block = allocateBlock(sizeClass);
+        if (block == nullptr) {
+            break;
+        }
+        block->next = cache->freeLists[sizeClass];
+        cache->freeLists[sizeClass] = block;
+        cache->sizes[sizeClass]++;
+    }
+}
+
+void PoolAllocator::spill(ThreadCache* cache, size_t sizeClass, size_t count) {
+    Pool& pool = mPools[sizeClass];
+    std::lock_guard<std::mutex> lock(pool.lock);
+    pool.allocationCount += cache->allocationCounts[sizeClass];
+    pool.freeCallCount += cache->freeCounts[sizeClass];
+    cache->allocationCounts[sizeClass] = 0;
+    cache->freeCounts[sizeClass] = 0;
+    for (size_t i = 0; i < count; i++) {
+        Block* block = cache->freeLists[sizeClass];
+        cache->freeLists[sizeClass] = block->next;
+        cache->sizes[sizeClass]--;
+        block->next = pool.freeList;
+        pool.freeList = block;
+        pool.freeCount++;
+    }
+}
+
+void PoolAllocator::flush(ThreadCache* cache) {
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        spill(cache, i, cache->sizes[i]);
+    }
+}
+
+} /* namespace mindroid */
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_LANG_POOLALLOCATOR_H_
+#define MINDROID_LANG_POOLALLOCATOR_H_
+
+#include <mindroid/lang/Allocator.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace mindroid {
+
+/**
+ * Allocator with size-class pools. Blocks of up to MAX_BLOCK_SIZE bytes are carved out of
+ * CHUNK_SIZE chunks and recycled through per-size-class free lists; larger blocks come from
+ * malloc. Chunks are kept until the allocator is destroyed, so the memory of a pool does not shrink
+ * after a peak.
+ *
+ * <p>
+ * The default allocator (see {@link Allocator#getDefault}) additionally keeps small per-thread
+ * caches of free blocks, so most allocations and frees do not take a lock. Its statistics only
+ * include the operations that the threads have already reported back to the shared pools.
+ *
+ * <p>
+ * Instances created with the public constructor are arenas without thread caches, e.g. for a
+ * single {@link Looper} thread (see {@link MessageQueue#FLAG_ALLOCATOR_ARENA}). An arena is
+ * released with close() and deletes itself once all its blocks have been freed.
+ */
+class PoolAllocator final :
+        public Allocator {
+public:
+    /**
+     * Maximum block size served from the size-class pools.
+     */
+    static const size_t MAX_BLOCK_SIZE = 1024;
+
+    /**
+     * Size of the chunks that the size-class pools are carved from.
+     */
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    PoolAllocator();
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    void* allocate(size_t size) override;
+    void free(void* pointer, size_t size) override;
+    sp<String> dump() override;
+
+    /**
+     * Releases an arena. The arena deletes itself as soon as all its blocks have been freed. It
+     * must not be used for new allocations after close().
+     */
+    void close();
+
+    uint64_t getAllocationCount();
+    size_t getBytesInUse();
+    size_t getBytesReserved();
+
+private:
+    static const size_t SIZE_CLASS_COUNT = 20;
+
+    struct Block {
+        Block* next;
+    };
+
+    struct Pool {
+        std::mutex lock;
+        Block* freeList = nullptr;
+        size_t freeCount = 0;
+        size_t chunkCount = 0;
+        uint64_t allocationCount = 0;
+        uint64_t freeCallCount = 0;
+    };
+
+    struct ThreadCache;
+    class ThreadCacheGuard;
+
+    explicit PoolAllocator(bool threadCaches);
+    virtual ~PoolAllocator();
+
+    static size_t getSizeClass(size_t size);
+    static size_t getBlockSize(size_t sizeClass);
+    static size_t getCacheCapacity(size_t sizeClass);
+
+    // Both must be called with the lock of the pool held.
+    Block* allocateBlock(size_t sizeClass);
+    void addChunk(size_t sizeClass);
+
+    void* allocateLarge(size_t size);
+    void freeLarge(void* pointer, size_t size);
+    void release();
+
+    ThreadCache* getThreadCache();
+    void refill(ThreadCache* cache, size_t sizeClass);
+    void spill(ThreadCache* cache, size_t sizeClass, size_t count);
+    void flush(ThreadCache* cache);
+
+    const bool mThreadCaches;
+    Pool mPools[SIZE_CLASS_COUNT];
+    std::mutex mChunkLock;
+    std::vector<void*> mChunks;
+    std::atomic<uint64_t> mLargeAllocationCount;
+    std::atomic<size_t> mLargeBytesInUse;
+    // Arenas only: one reference for the owner plus one per allocated block.
+    std::atomic<size_t> mReferenceCount;
+
+    static thread_local ThreadCache sThreadCache;
+    static thread_local ThreadCacheGuard sThreadCacheGuard;
+
+    friend class Allocator;
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_LANG_POOLALLOCATOR_H_ */
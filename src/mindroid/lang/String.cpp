@@ -20,7 +20,9 @@
 #include <mindroid/lang/NullPointerException.h>
 #include <mindroid/util/ArrayList.h>
 #include <cstdio>
+#include <mutex>
 #include <regex>
+#include <unordered_map>
 
 namespace mindroid {
 
@@ -30,59 +32,96 @@ namespace mindroid {
  * and dynamically initialized shall be initialized in the order in which their definition appears
  * in the translation unit.
  */
-const sp<String::StringBuffer> String::NULL_STRING_BUFFER = new String::StringBuffer(nullptr, 0);
-const sp<String::StringBuffer> String::EMPTY_STRING_BUFFER = new String::StringBuffer("", 0);
 const sp<String> String::EMPTY_STRING = new String();
+const size_t String::INLINE_CAPACITY;
+
+// Pool of interned strings by hash code. Never destroyed, since interned strings may be referenced
+// by other objects with static storage duration.
+struct InternTable {
+    std::mutex lock;
+    std::unordered_multimap<size_t, sp<String>> strings;
+};
+
+static InternTable& getInternTable() {
+    static InternTable* const sInternTable = new InternTable();
+    return *sInternTable;
+}
 
 String::String() {
-    mStringBuffer = EMPTY_STRING_BUFFER;
+    init("", 0);
 }
 
 String::String(const char* string) {
-    if (string != nullptr) {
-        size_t size = strlen(string);
-        if (size > 0) {
-            mStringBuffer = new StringBuffer(string, size);
-        } else {
-            mStringBuffer = EMPTY_STRING_BUFFER;
-        }
-    } else {
-        mStringBuffer = NULL_STRING_BUFFER;
-    }
+    init(string, (string != nullptr) ? strlen(string) : 0);
 }
 
 String::String(const char* string, size_t size) {
-    if (string != nullptr) {
-        if (size > 0) {
-            mStringBuffer = new StringBuffer(string, size);
-        } else {
-            mStringBuffer = EMPTY_STRING_BUFFER;
-        }
-    } else {
-        mStringBuffer = NULL_STRING_BUFFER;
-    }
+    init(string, size);
 }
 
 String::String(const char c) {
-    mStringBuffer = new StringBuffer(&c, 1);
+    init(&c, 1);
 }
 
 String::String(const sp<String>& string) {
     if (string != nullptr) {
-        mStringBuffer = new StringBuffer(string->c_str(), string->length());
+        init(string->c_str(), string->length());
     } else {
-        mStringBuffer = NULL_STRING_BUFFER;
+        init(nullptr, 0);
     }
 }
 
 String::String(const sp<ByteArray>& byteArray) {
     if (byteArray != nullptr) {
-        mStringBuffer = new StringBuffer((const char*) byteArray->c_arr(), byteArray->size());
+        init((const char*) byteArray->c_arr(), byteArray->size());
+    } else {
+        init(nullptr, 0);
+    }
+}
+
+String::String(size_t size, Uninitialized) :
+        mHashCode(0),
+        mFlags(0) {
+    allocate(size);
+}
+
+String::~String() {
+    if (mData != mInlineData) {
+        Allocator::freeObject(mData);
+    }
+}
+
+void String::init(const char* string, size_t size) {
+    mHashCode.store(0, std::memory_order_relaxed);
+    mFlags = 0;
+    if (string != nullptr) {
+        memcpy(allocate(size), string, size);
+    } else {
+        mData = nullptr;
+        mSize = 0;
+    }
+}
+
+String::String(const char* string1, size_t size1, const char* string2, size_t size2) :
+        mHashCode(0),
+        mFlags(0) {
+    if (string1 != nullptr && string2 != nullptr) {
+        char* data = allocate(size1 + size2);
+        memcpy(data, string1, size1);
+        memcpy(data + size1, string2, size2);
     } else {
-        mStringBuffer = NULL_STRING_BUFFER;
+        mData = nullptr;
+        mSize = 0;
     }
 }
 
+char* String::allocate(size_t size) {
+    mData = (size <= INLINE_CAPACITY) ? mInlineData : static_cast<char*>(Allocator::allocateObject(size + 1));
+    mSize = size;
+    mData[size] = '\0';
+    return mData;
+}
+
 bool String::equals(const sp<Object>& other) const {
     if (other == this) {
         return true;
@@ -97,18 +136,27 @@ bool String::equals(const sp<Object>& other) const {
 }
 
 size_t String::hashCode() const {
+    size_t hashCode = mHashCode.load(std::memory_order_relaxed);
+    if (hashCode == 0 && mSize > 0) {
+        hashCode = String::hashCode(mData, mSize);
+        mHashCode.store(hashCode, std::memory_order_relaxed);
+    }
+    return hashCode;
+}
+
+size_t String::hashCode(const char* string, size_t size) {
     size_t hash = 0;
-    for (size_t i = 0; i < mStringBuffer->mSize; i++) {
-        hash = 31 * hash + mStringBuffer->mData[i];
+    for (size_t i = 0; i < size; i++) {
+        hash = 31 * hash + string[i];
     }
     return hash;
 }
 
 bool String::equals(const char* string) const {
-    if (mStringBuffer->mData && string) {
-        return strcmp(mStringBuffer->mData, string) == 0;
+    if (mData && string) {
+        return strcmp(mData, string) == 0;
     } else {
-        if (mStringBuffer->mData == nullptr && string == nullptr) {
+        if (mData == nullptr && string == nullptr) {
             return true;
         } else {
             return false;
@@ -117,10 +165,17 @@ bool String::equals(const char* string) const {
 }
 
 bool String::equals(const sp<String>& string) const {
-    if (mStringBuffer->mData && string->mStringBuffer->mData) {
-        return strcmp(mStringBuffer->mData, string->mStringBuffer->mData) == 0;
+    if (string.getPointer() == this) {
+        return true;
+    }
+    // The pool holds exactly one interned string per value.
+    if (isInterned() && string->isInterned()) {
+        return false;
+    }
+    if (mData && string->mData) {
+        return mSize == string->mSize && memcmp(mData, string->mData, mSize) == 0;
     } else {
-        if (mStringBuffer->mData == nullptr && string->mStringBuffer->mData == nullptr) {
+        if (mData == nullptr && string->mData == nullptr) {
             return true;
         } else {
             return false;
@@ -148,7 +203,7 @@ char String::charAt(size_t index) const {
     if (index >= length()) {
         throw IndexOutOfBoundsException();
     }
-    return mStringBuffer->mData[index];
+    return mData[index];
 }
 
 bool String::matches(const char* regex) const {
@@ -230,19 +285,19 @@ sp<String> String::substring(size_t beginIndex, size_t endIndex) const {
 }
 
 sp<String> String::toLowerCase() const {
-    sp<StringBuffer> stringBuffer = new StringBuffer(length());
+    sp<String> string = new String(length(), Uninitialized());
     for (size_t i = 0; i < length(); i++) {
-        stringBuffer->mData[i] = tolower(mStringBuffer->mData[i]);
+        string->mData[i] = tolower(mData[i]);
     }
-    return new String(stringBuffer);
+    return string;
 }
 
 sp<String> String::toUpperCase() const {
-    sp<StringBuffer> stringBuffer = new StringBuffer(length());
+    sp<String> string = new String(length(), Uninitialized());
     for (size_t i = 0; i < length(); i++) {
-        stringBuffer->mData[i] = toupper(mStringBuffer->mData[i]);
+        string->mData[i] = toupper(mData[i]);
     }
-    return new String(stringBuffer);
+    return string;
 }
 
 ssize_t String::indexOf(const char c) const {
@@ -345,12 +400,12 @@ sp<String> String::trim() const {
     size_t beginIndex;
     ssize_t endIndex;
     for (beginIndex = 0; beginIndex < length(); beginIndex++) {
-        if (!isspace(mStringBuffer->mData[beginIndex])) {
+        if (!isspace(mData[beginIndex])) {
             break;
         }
     }
     for (endIndex = length() - 1; endIndex >= 0; endIndex--) {
-        if (!isspace(mStringBuffer->mData[endIndex])) {
+        if (!isspace(mData[endIndex])) {
             break;
         }
     }
@@ -358,8 +413,7 @@ sp<String> String::trim() const {
         return const_cast<String*>(this);
     } else {
         if (beginIndex != length()) {
-            return new String((sp<StringBuffer>) new StringBuffer(mStringBuffer->mData + beginIndex,
-                    endIndex - beginIndex + 1));
+            return new String(mData + beginIndex, endIndex - beginIndex + 1);
         } else {
             return EMPTY_STRING;
         }
@@ -389,58 +443,58 @@ sp<StringArray> String::split(const sp<String>& separator) const {
 
 sp<String> String::valueOf(int8_t value) {
     size_t size = snprintf(NULL, 0, "%d", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%d", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%d", value);
+    return string;
 }
 
 sp<String> String::valueOf(uint8_t value) {
     size_t size = snprintf(NULL, 0, "%u", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%u", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%u", value);
+    return string;
 }
 
 sp<String> String::valueOf(int16_t value) {
     size_t size = snprintf(NULL, 0, "%d", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%d", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%d", value);
+    return string;
 }
 
 sp<String> String::valueOf(uint16_t value) {
     size_t size = snprintf(NULL, 0, "%u", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%u", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%u", value);
+    return string;
 }
 
 sp<String> String::valueOf(int32_t value) {
     size_t size = snprintf(NULL, 0, "%d", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%d", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%d", value);
+    return string;
 }
 
 sp<String> String::valueOf(uint32_t value) {
     size_t size = snprintf(NULL, 0, "%u", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%u", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%u", value);
+    return string;
 }
 
 sp<String> String::valueOf(float value) {
     size_t size = snprintf(NULL, 0, "%f", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%f", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%f", value);
+    return string;
 }
 
 sp<String> String::valueOf(double value) {
     size_t size = snprintf(NULL, 0, "%f", value);
-    sp<StringBuffer> stringBuffer = new StringBuffer(size);
-    snprintf(stringBuffer->mData, size + 1, "%f", value);
-    return new String(stringBuffer);
+    sp<String> string = new String(size, Uninitialized());
+    snprintf(string->mData, size + 1, "%f", value);
+    return string;
 }
 
 bool String::regionMatches(size_t toffset, const sp<String>& string, size_t ooffset, size_t len) {
@@ -457,8 +511,8 @@ bool String::regionMatches(size_t toffset, const sp<String>& string, size_t ooff
         return true;
     }
 
-    if (mStringBuffer->mData != nullptr) {
-        return strncmp(mStringBuffer->mData + toffset, string->c_str() + ooffset, len) == 0;
+    if (mData != nullptr) {
+        return strncmp(mData + toffset, string->c_str() + ooffset, len) == 0;
     } else {
         return false;
     }
@@ -469,23 +523,23 @@ bool String::regionMatches(size_t toffset, const char* string, size_t ooffset, s
 }
 
 sp<String> String::replace(char oldChar, char newChar) {
-    sp<StringBuffer> stringBuffer = new StringBuffer(c_str(), length());
+    sp<String> string = new String(c_str(), length());
     for (size_t i = 0; i < length(); i++) {
-        stringBuffer->mData[i] = (stringBuffer->mData[i] == oldChar) ? newChar : stringBuffer->mData[i];
+        string->mData[i] = (string->mData[i] == oldChar) ? newChar : string->mData[i];
     }
-    return new String(stringBuffer);
+    return string;
 }
 
 sp<String> String::append(const char* string, size_t size) const {
     if (string != nullptr && size > 0) {
-        return new String((sp<StringBuffer>) new StringBuffer(mStringBuffer->mData, mStringBuffer->mSize, string, size));
+        return new String(mData, mSize, string, size);
     }
     return const_cast<String*>(this);
 }
 
 sp<String> String::append(const char* string, size_t offset, size_t size) const {
     if (string != nullptr && size > 0) {
-        return new String((sp<StringBuffer>) new StringBuffer(mStringBuffer->mData, mStringBuffer->mSize, string + offset, size));
+        return new String(mData, mSize, string + offset, size);
     }
     return const_cast<String*>(this);
 }
@@ -513,45 +567,48 @@ sp<String> String::appendFormattedWithVarArgList(const char* format, va_list arg
     va_end(copyOfArgs);
 
     if (size != 0) {
-        sp<StringBuffer> stringBuffer = new StringBuffer(mStringBuffer->mSize + size);
-        memcpy(stringBuffer->mData, mStringBuffer->mData, mStringBuffer->mSize);
-        vsnprintf(stringBuffer->mData + mStringBuffer->mSize, size + 1, format, args);
-        return new String(stringBuffer);
+        sp<String> string = new String(mSize + size, Uninitialized());
+        memcpy(string->mData, mData, mSize);
+        vsnprintf(string->mData + mSize, size + 1, format, args);
+        return string;
     }
 
     return const_cast<String*>(this);
 }
 
-String::StringBuffer::StringBuffer(size_t size) {
-    mSize = size;
-    mData = (char*) malloc(mSize + 1);
-    mData[size] = '\0';
+sp<String> String::intern() const {
+    if (isInterned()) {
+        return const_cast<String*>(this);
+    }
+    return intern(mData, mSize, hashCode(mData, mSize));
 }
 
-String::StringBuffer::StringBuffer(const char* string, size_t size) {
-    if (string != nullptr) {
-        mSize = size;
-        mData = (char*) malloc(mSize + 1);
-        memcpy(mData, string, size);
-        mData[size] = '\0';
-    } else {
-        mSize = 0;
-        mData = nullptr;
+sp<String> String::intern(const char* string) {
+    if (string == nullptr) {
+        return nullptr;
     }
+    const size_t size = strlen(string);
+    return intern(string, size, hashCode(string, size));
 }
 
-String::StringBuffer::StringBuffer(const char* string1, size_t size1,
-        const char* string2, size_t size2) {
-    if (string1 != nullptr && string2 != nullptr) {
-        mSize = size1 + size2;
-        mData = (char*) malloc(mSize + 1);
-        memcpy(mData, string1, size1);
-        memcpy(mData + size1, string2, size2);
-        mData[size1 + size2] = '\0';
-    } else {
-        mSize = 0;
-        mData = nullptr;
+sp<String> String::intern(const char* string, size_t size, size_t hashCode) {
+    if (string == nullptr) {
+        return nullptr;
+    }
+    InternTable& internTable = getInternTable();
+    std::lock_guard<std::mutex> lock(internTable.lock);
+    auto range = internTable.strings.equal_range(hashCode);
+    for (auto itr = range.first; itr != range.second; ++itr) {
+        const sp<String>& internedString = itr->second;
+        if (internedString->mSize == size && memcmp(internedString->mData, string, size) == 0) {
+            return internedString;
+        }
     }
+    sp<String> internedString = new String(string, size);
+    internedString->mHashCode.store(hashCode, std::memory_order_relaxed);
+    internedString->mFlags |= FLAG_INTERNED;
+    internTable.strings.emplace(hashCode, internedString);
+    return internedString;
 }
 
 } /* namespace mindroid */
@@ -40,7 +40,7 @@ public:
     explicit String(const char c);
     explicit String(const sp<String>& string);
     explicit String(const sp<ByteArray>& byteArray);
-    virtual ~String() { }
+    virtual ~String();
 
     bool equals(const sp<Object>& other) const override;
     size_t hashCode() const override;
@@ -51,7 +51,7 @@ public:
     bool equalsIgnoreCase(const sp<String>& string) const;
 
     inline size_t length() const {
-        return mStringBuffer->mSize;
+        return mSize;
     }
 
     inline bool isEmpty() const {
@@ -59,7 +59,7 @@ public:
     }
 
     inline const char* c_str() const {
-        return mStringBuffer->mData;
+        return mData;
     }
 
     inline operator const char*() const {
@@ -117,6 +117,19 @@ public:
 
     sp<String> trim() const;
 
+    /**
+     * Returns the canonical representation of this string from the global pool of interned
+     * strings. Interned strings are never freed and have precomputed hash codes, and two interned
+     * strings are equal exactly if they are the same object. So intern only a bounded set of
+     * strings like constants, keys and names.
+     */
+    sp<String> intern() const;
+    static sp<String> intern(const char* string);
+
+    bool isInterned() const {
+        return (mFlags & FLAG_INTERNED) != 0;
+    }
+
     /**
      * @brief Splits the string at the separator
      *
@@ -211,7 +224,7 @@ public:
     sp<String> appendFormatted(const char* format, ...) const __attribute__((format (printf, 2, 3)));
 
     sp<ByteArray> getBytes() const {
-        return new ByteArray(reinterpret_cast<uint8_t*>(mStringBuffer->mData), mStringBuffer->mSize);
+        return new ByteArray(reinterpret_cast<uint8_t*>(mData), mSize);
     }
 
     static sp<String> format(const char* string) {
@@ -233,34 +246,23 @@ public:
     }
 
 private:
-    class StringBuffer : public LightweightObject<StringBuffer> {
-    public:
-        StringBuffer() :
-                mData(nullptr),
-                mSize(0) {
-        }
+    // Strings of up to INLINE_CAPACITY characters are stored within the String object itself.
+    static const size_t INLINE_CAPACITY = 22;
+    static const uint8_t FLAG_INTERNED = 1 << 0;
 
-        StringBuffer(size_t size);
-        StringBuffer(const char* string, size_t size);
-        StringBuffer(const char* string1, size_t size1, const char* string2, size_t size2);
+    struct Uninitialized {
+    };
 
-        ~StringBuffer() {
-            if (mData != nullptr) {
-                free(mData);
-            }
-        }
+    // Creates a string of the given size whose characters are written by the caller.
+    String(size_t size, Uninitialized);
 
-    private:
-        char* mData;
-        size_t mSize;
+    String(const char* string1, size_t size1, const char* string2, size_t size2);
 
-        friend class String;
-        friend class StringBuilder;
-    };
+    void init(const char* string, size_t size);
+    char* allocate(size_t size);
 
-    String(const sp<StringBuffer>& string) :
-            mStringBuffer(string) {
-    }
+    static size_t hashCode(const char* string, size_t size);
+    static sp<String> intern(const char* string, size_t size, size_t hashCode);
 
     sp<String> appendFormattedWithVarArgList(const char* format, va_list args) const;
 
@@ -277,10 +279,13 @@ private:
     template<typename T, typename std::enable_if<std::is_same<T, sp<String>>::value>::type* = nullptr> static const char* toValue(const T& value) { return (value != nullptr && value->c_str() != nullptr) ? value->c_str() : "nullptr"; }
     template<typename T, typename std::enable_if<std::is_same<T, std::string>::value>::type* = nullptr> static const char* toValue(const T& value) { return (value.c_str() != nullptr) ? value.c_str() : "nullptr"; }
 
-    sp<StringBuffer> mStringBuffer;
-
-    static const sp<StringBuffer> NULL_STRING_BUFFER;
-    static const sp<StringBuffer> EMPTY_STRING_BUFFER;
+    // Points to mInlineData, to an allocated buffer, or is nullptr for the null string.
+    char* mData;
+    size_t mSize;
+    // Computed on first use, 0 if not yet known.
+    mutable std::atomic<size_t> mHashCode;
+    uint8_t mFlags;
+    char mInlineData[INLINE_CAPACITY + 1];
 
     friend class StringBuilder;
 };
@@ -261,7 +261,7 @@ sp<String> StringBuilder::substring(size_t start, size_t end) const {
 }
 
 sp<String> StringBuilder::toString() const {
-    return new String(mString.c_str());
+    return new String(mString.c_str(), mString.size());
 }
 
 void StringBuilder::trimToSize() {
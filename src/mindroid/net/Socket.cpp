@@ -33,6 +33,7 @@
 #include <cstring>
 #include <cerrno>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 
@@ -359,6 +360,56 @@ void Socket::SocketOutputStream::write(const sp<ByteArray>& buffer, size_t offse
     } while (count > 0);
 }
 
+void Socket::SocketOutputStream::write(const sp<ByteArray>& buffer, size_t offset, size_t count,
+        const sp<ByteArray>& nextBuffer, size_t nextOffset, size_t nextCount) {
+    if (buffer == nullptr || nextBuffer == nullptr) {
+        throw NullPointerException();
+    }
+    if ((offset + count) > buffer->size() || (nextOffset + nextCount) > nextBuffer->size()) {
+        throw IndexOutOfBoundsException();
+    }
+    int32_t fd = getFd();
+    if (fd == -1) {
+        throw IOException("Socket already closed");
+    }
+
+    struct iovec vectors[2];
+    vectors[0].iov_base = buffer->c_arr() + offset;
+    vectors[0].iov_len = count;
+    vectors[1].iov_base = nextBuffer->c_arr() + nextOffset;
+    vectors[1].iov_len = nextCount;
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = 2;
+    while (message.msg_iovlen > 0 && message.msg_iov[0].iov_len == 0) {
+        message.msg_iov++;
+        message.msg_iovlen--;
+    }
+
+    while (message.msg_iovlen > 0) {
+#ifndef __APPLE__
+        ssize_t rc = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+#else
+        ssize_t rc = ::sendmsg(fd, &message, 0);
+#endif
+        if (rc < 0) {
+            throw IOException(String::format("Failed to write to socket (errno=%d)", errno));
+        }
+        // Skip what has been sent, including empty buffers.
+        size_t size = (size_t) rc;
+        while (message.msg_iovlen > 0 && size >= message.msg_iov[0].iov_len) {
+            size -= message.msg_iov[0].iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov[0].iov_base = static_cast<uint8_t*>(message.msg_iov[0].iov_base) + size;
+            message.msg_iov[0].iov_len -= size;
+        }
+    }
+}
+
 void Socket::setTcpNoDelay(bool enabled) {
     if (mFd == -1) {
         throw SocketException("Socket is closed");
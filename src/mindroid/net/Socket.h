@@ -193,6 +193,13 @@ public:
      */
     bool isClosed() const { return mIsClosed; }
 
+    /**
+     * Returns the file descriptor of this socket, or -1 if the socket is not open.
+     *
+     * @hide
+     */
+    int32_t getFileDescriptor() const { return mFd; }
+
     /**
      * Sets this socket's {@link SocketOptions#TCP_NODELAY} option.
      *
@@ -345,6 +352,9 @@ private:
 
         void write(int32_t b) override;
         void write(const sp<ByteArray>& buffer, size_t offset, size_t count) override;
+        // Gathers both buffers into one sendmsg call.
+        void write(const sp<ByteArray>& buffer, size_t offset, size_t count,
+                const sp<ByteArray>& nextBuffer, size_t nextOffset, size_t nextCount) override;
 
     private:
         SocketOutputStream(const sp<Socket>& socket) : mSocket(socket) {
@@ -234,10 +234,12 @@ bool URI::equals(const sp<URI>& uri) const {
 }
 
 size_t URI::hashCode() const {
-    if (mHashCode == 0) {
-        mHashCode = getHashString()->hashCode();
+    size_t hashCode = mHashCode.load(std::memory_order_relaxed);
+    if (hashCode == 0) {
+        hashCode = getHashString()->hashCode();
+        mHashCode.store(hashCode, std::memory_order_relaxed);
     }
-    return mHashCode;
+    return hashCode;
 }
 
 void URI::parseURI(const sp<String>& uri, bool serverBasedNamingAuthority) {
@@ -297,6 +299,11 @@ void URI::parseURI(const sp<String>& uri, bool serverBasedNamingAuthority) {
     }
 
     parseAuthority(serverBasedNamingAuthority);
+
+    if (mScheme != nullptr && mAuthority != nullptr) {
+        // Binder URIs usually consist of just the scheme and the authority.
+        mSchemeAndAuthority = (pathStart == uri->length()) ? uri : uri->substring(0, pathStart);
+    }
 }
 
 void URI::parseAuthority(bool serverBasedNamingAuthority) {
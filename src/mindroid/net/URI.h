@@ -150,6 +150,17 @@ public:
         return mString;
     }
 
+    /**
+     * Returns "scheme://authority" for URIs with a scheme and an authority, otherwise nullptr.
+     * The String is created once per URI and caches its hash code, so it is cheap to use as a
+     * map key.
+     *
+     * @hide
+     */
+    sp<String> getSchemeAndAuthority() const {
+        return mSchemeAndAuthority;
+    }
+
     /**
      * Returns true if this URI is absolute, which means that a scheme is
      * defined.
@@ -220,8 +231,9 @@ private:
     sp<String> mPath;
     sp<String> mQuery;
     sp<String> mFragment;
+    sp<String> mSchemeAndAuthority;
     bool mOpaque;
-    mutable size_t mHashCode = 0;
+    mutable std::atomic<size_t> mHashCode { 0 };
 };
 
 } /* namespace mindroid */
@@ -29,8 +29,8 @@
 namespace mindroid {
 
 const char* const Binder::TAG = "Binder";
-const sp<String> Binder::EXCEPTION_MESSAGE = String::valueOf("Binder transaction failure");
-const sp<String> Binder::Proxy::EXCEPTION_MESSAGE = String::valueOf("Binder transaction failure");
+const sp<String> Binder::EXCEPTION_MESSAGE = String::intern("Binder transaction failure");
+const sp<String> Binder::Proxy::EXCEPTION_MESSAGE = String::intern("Binder transaction failure");
 
 Binder::Binder() {
     setObjectLifetime(Object::OBJECT_LIFETIME_WEAK_REFERENCE);
@@ -20,29 +20,38 @@
 #include <mindroid/os/MessageQueue.h>
 #include <mindroid/os/Looper.h>
 #include <mindroid/lang/NullPointerException.h>
+#include <mindroid/lang/IllegalArgumentException.h>
 
 namespace mindroid {
 
+const int32_t Handler::PRIORITY_HIGH;
+const int32_t Handler::PRIORITY_NORMAL;
+const int32_t Handler::PRIORITY_LOW;
+
 Handler::Handler() : Handler(Looper::myLooper()) {
 }
 
 Handler::Handler(const sp<Callback>& callback) : Handler(Looper::myLooper(), callback) {
 }
 
-Handler::Handler(const sp<Looper>& looper) {
-    mLooper = looper;
-    if (mLooper == nullptr) {
-        throw NullPointerException("Can't create handler inside thread that has not called Looper.prepare()");
-    }
-    mMessageQueue = looper->mMessageQueue;
-    mCallback = nullptr;
+Handler::Handler(const sp<Looper>& looper) : Handler(looper, nullptr, PRIORITY_NORMAL) {
+}
+
+Handler::Handler(const sp<Looper>& looper, const sp<Callback>& callback) : Handler(looper, callback, PRIORITY_NORMAL) {
+}
+
+Handler::Handler(const sp<Looper>& looper, int32_t priority) : Handler(looper, nullptr, priority) {
 }
 
-Handler::Handler(const sp<Looper>& looper, const sp<Callback>& callback) {
+Handler::Handler(const sp<Looper>& looper, const sp<Callback>& callback, int32_t priority) :
+        mPriority(priority) {
     mLooper = looper;
     if (mLooper == nullptr) {
         throw NullPointerException("Can't create handler inside thread that has not called Looper.prepare()");
     }
+    if (priority < PRIORITY_HIGH || priority > PRIORITY_LOW) {
+        throw IllegalArgumentException("Invalid handler priority");
+    }
     mMessageQueue = looper->mMessageQueue;
     mCallback = callback;
 }
@@ -73,6 +82,11 @@ bool Handler::sendMessageAtTime(const sp<Message>& message, uint64_t uptimeMilli
     return mMessageQueue->enqueueMessage(message, uptimeMillis);
 }
 
+bool Handler::sendMessageAtTimeNanos(const sp<Message>& message, uint64_t uptimeNanos) {
+    message->target = this;
+    return mMessageQueue->enqueueMessageNanos(message, uptimeNanos);
+}
+
 bool Handler::removeMessages(int32_t what) {
     return mMessageQueue->removeMessages(this, what, nullptr);
 }
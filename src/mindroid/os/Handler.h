@@ -23,6 +23,8 @@
 #include <mindroid/os/SystemClock.h>
 #include <mindroid/os/Looper.h>
 #include <mindroid/util/concurrent/Executor.h>
+#include <type_traits>
+#include <utility>
 
 namespace mindroid {
 
@@ -66,6 +68,10 @@ class MessageQueue;
  */
 class Handler :
         public Object {
+    // Functions that are posted as PostRunnables instead of being converted to sp<Runnable>.
+    template<typename F>
+    using EnableIfFunction = typename std::enable_if<!std::is_convertible<F, sp<Runnable>>::value>::type;
+
 public:
     /**
      * Callback interface you can use when instantiating a Handler to avoid having to implement your
@@ -77,6 +83,16 @@ public:
         virtual bool handleMessage(const sp<Message>& msg) = 0;
     };
 
+    /**
+     * Priority lanes of a {@link MessageQueue}. Among the messages that are due, the Looper always
+     * dispatches the ones of higher lanes first, unless a message of a lower lane has been overdue
+     * for longer than the aging threshold of the MessageQueue (see
+     * {@link MessageQueue#setAgingThreshold}). Messages of the same lane keep their order.
+     */
+    static const int32_t PRIORITY_HIGH = 0;
+    static const int32_t PRIORITY_NORMAL = 1;
+    static const int32_t PRIORITY_LOW = 2;
+
     /**
      * Default constructor associates this handler with the queue for the current thread.
      *
@@ -101,6 +117,19 @@ public:
      */
     explicit Handler(const sp<Looper>& looper, const sp<Callback>& callback);
 
+    /**
+     * Use the provided queue instead of the default one and send all messages with the given
+     * priority (see {@link #PRIORITY_HIGH}, {@link #PRIORITY_NORMAL} and {@link #PRIORITY_LOW})
+     * unless a message sets its own priority.
+     */
+    explicit Handler(const sp<Looper>& looper, int32_t priority);
+
+    /**
+     * Use the provided queue instead of the default one, take a callback interface in which to
+     * handle messages and send all messages with the given priority.
+     */
+    explicit Handler(const sp<Looper>& looper, const sp<Callback>& callback, int32_t priority);
+
     virtual ~Handler() = default;
 
     Handler(const Handler&) = delete;
@@ -184,8 +213,11 @@ public:
         return Message::obtain(sp<Handler>(this), callback);
     }
 
-    sp<Message> obtainMessage(const std::function<void (void)>& func) {
-        return Message::obtain(sp<Handler>(this), new Runnable(func));
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Message> obtainMessage(F&& func) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        message->target = this;
+        return message;
     }
 
     /**
@@ -255,22 +287,38 @@ public:
         return sendMessageDelayed(getPostMessage(runnable), delayMillis) ? runnable : nullptr;
     }
 
+    /**
+     * Same as {@link #postAtTime(Runnable, long)}, but with the absolute time given in nanoseconds
+     * of the {@link mindroid.os.SystemClock#uptimeNanos} time-base.
+     */
+    sp<Runnable> postAtTimeNanos(const sp<Runnable>& runnable, uint64_t uptimeNanos) {
+        return sendMessageAtTimeNanos(getPostMessage(runnable), uptimeNanos) ? runnable : nullptr;
+    }
+
+    /**
+     * Same as {@link #postDelayed(Runnable, long)}, but with the delay given in nanoseconds.
+     */
+    sp<Runnable> postDelayedNanos(const sp<Runnable>& runnable, uint64_t delayNanos) {
+        return sendMessageDelayedNanos(getPostMessage(runnable), delayNanos) ? runnable : nullptr;
+    }
+
     /**
      * Causes the std::function func to be added to the message queue. The runnable will be run on the
-     * thread to which this handler is attached.
+     * thread to which this handler is attached. The function is moved into a Runnable that is pooled
+     * together with its Message, so posting small lambdas does not allocate.
      *
-     * @param runnable The std::function that will be executed.
+     * @param func The std::function or lambda that will be executed.
      *
      * @return Returns a Runnable if the std::function was successfully placed in to the message queue.
      * Returns nullptr on failure, usually because the looper processing the message queue is exiting.
      * Note that a result of true does not mean the Runnable will be processed -- if the looper is quit
      * before the delivery time of the message occurs then the message will be dropped.
      */
-    sp<Runnable> post(const std::function<void (void)>& func) {
-        return post(new Runnable(func));
-    }
-    sp<Runnable> post(std::function<void (void)>&& func) {
-        return post(new Runnable(func));
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> post(F&& func) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        sp<Runnable> runnable = message->callback;
+        return sendMessageDelayed(message, 0) ? std::move(runnable) : nullptr;
     }
 
     /**
@@ -287,11 +335,11 @@ public:
      * Note that a result of true does not mean the Runnable will be processed -- if the looper is quit
      * before the delivery time of the message occurs then the message will be dropped.
      */
-    sp<Runnable> postAtTime(const std::function<void (void)>& func, uint64_t uptimeMillis) {
-        return postAtTime(new Runnable(func), uptimeMillis);
-    }
-    sp<Runnable> postAtTime(std::function<void (void)>&& func, uint64_t uptimeMillis) {
-        return postAtTime(new Runnable(func), uptimeMillis);
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> postAtTime(F&& func, uint64_t uptimeMillis) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        sp<Runnable> runnable = message->callback;
+        return sendMessageAtTime(message, uptimeMillis) ? std::move(runnable) : nullptr;
     }
 
     /**
@@ -310,11 +358,12 @@ public:
      *
      * @see mindroid.os.SystemClock#uptimeMillis
      */
-    sp<Runnable> postAtTime(const std::function<void (void)>& func, const sp<Object>& token, uint64_t uptimeMillis) {
-        return postAtTime(new Runnable(func), token, uptimeMillis);
-    }
-    sp<Runnable> postAtTime(std::function<void (void)>&& func, const sp<Object>& token, uint64_t uptimeMillis) {
-        return postAtTime(new Runnable(func), token, uptimeMillis);
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> postAtTime(F&& func, const sp<Object>& token, uint64_t uptimeMillis) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        message->obj = token;
+        sp<Runnable> runnable = message->callback;
+        return sendMessageAtTime(message, uptimeMillis) ? std::move(runnable) : nullptr;
     }
 
     /**
@@ -329,11 +378,25 @@ public:
      * Note that a result of true does not mean the Runnable will be processed -- if the looper is quit
      * before the delivery time of the message occurs then the message will be dropped.
      */
-    sp<Runnable> postDelayed(const std::function<void (void)>& func, uint32_t delayMillis) {
-        return postDelayed(new Runnable(func), delayMillis);
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> postDelayed(F&& func, uint32_t delayMillis) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        sp<Runnable> runnable = message->callback;
+        return sendMessageDelayed(message, delayMillis) ? std::move(runnable) : nullptr;
     }
-    sp<Runnable> postDelayed(std::function<void (void)>&& func, uint32_t delayMillis) {
-        return postDelayed(new Runnable(func), delayMillis);
+
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> postAtTimeNanos(F&& func, uint64_t uptimeNanos) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        sp<Runnable> runnable = message->callback;
+        return sendMessageAtTimeNanos(message, uptimeNanos) ? std::move(runnable) : nullptr;
+    }
+
+    template<typename F, typename = EnableIfFunction<F>>
+    sp<Runnable> postDelayedNanos(F&& func, uint64_t delayNanos) {
+        sp<Message> message = getPostMessage(std::forward<F>(func));
+        sp<Runnable> runnable = message->callback;
+        return sendMessageDelayedNanos(message, delayNanos) ? std::move(runnable) : nullptr;
     }
 
     /**
@@ -409,7 +472,14 @@ public:
      * before the delivery time of the message occurs then the message will be dropped.
      */
     bool sendMessageDelayed(const sp<Message>& message, uint32_t delayMillis) {
-        return sendMessageAtTime(message, SystemClock::uptimeMillis() + delayMillis);
+        return sendMessageAtTimeNanos(message, SystemClock::uptimeNanos() + delayMillis * 1000000ULL);
+    }
+
+    /**
+     * Same as {@link #sendMessageDelayed(Message, long)}, but with the delay given in nanoseconds.
+     */
+    bool sendMessageDelayedNanos(const sp<Message>& message, uint64_t delayNanos) {
+        return sendMessageAtTimeNanos(message, SystemClock::uptimeNanos() + delayNanos);
     }
 
     /**
@@ -428,6 +498,13 @@ public:
      */
     bool sendMessageAtTime(const sp<Message>& message, uint64_t uptimeMillis);
 
+    /**
+     * Same as {@link #sendMessageAtTime(Message, long)}, but with the absolute time given in
+     * nanoseconds of the {@link mindroid.os.SystemClock#uptimeNanos} time-base. Use this for
+     * periodic work that needs sub-millisecond scheduling resolution.
+     */
+    bool sendMessageAtTimeNanos(const sp<Message>& message, uint64_t uptimeNanos);
+
     /**
      * Remove any pending posts of messages with code 'what' that are in the message queue.
      */
@@ -469,6 +546,13 @@ public:
         return mLooper;
     }
 
+    /**
+     * Returns the priority lane of the messages sent by this Handler.
+     */
+    int32_t getPriority() const {
+        return mPriority;
+    }
+
     /**
      * Enables a handler to act as executor target.
      */
@@ -478,6 +562,13 @@ private:
     sp<Message> getPostMessage(const sp<Runnable>& runnable);
     sp<Message> getPostMessage(const sp<Runnable>& runnable, const sp<Object>& token);
 
+    template<typename F>
+    static sp<Message> getPostMessage(F&& func) {
+        sp<Message> message = Message::obtain();
+        message->setPostCallback(std::forward<F>(func));
+        return message;
+    }
+
     static void handleCallback(const sp<Message>& message) {
         message->callback->run();
     }
@@ -486,6 +577,7 @@ private:
     sp<Looper> mLooper;
     sp<Callback> mCallback;
     wp<Executor> mExecutor;
+    const int32_t mPriority;
 };
 
 } /* namespace mindroid */
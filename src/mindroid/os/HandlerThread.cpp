@@ -25,25 +25,44 @@ HandlerThread::HandlerThread() :
         Thread(),
         mLock(new ReentrantLock()),
         mCondition(mLock->newCondition()),
-        mLooper(nullptr) {
+        mLooper(nullptr),
+        mFlags(0) {
 }
 
 HandlerThread::HandlerThread(const char* name) :
         Thread(name),
         mLock(new ReentrantLock()),
         mCondition(mLock->newCondition()),
-        mLooper(nullptr) {
+        mLooper(nullptr),
+        mFlags(0) {
 }
 
 HandlerThread::HandlerThread(const sp<String>& name) :
         Thread(name),
         mLock(new ReentrantLock()),
         mCondition(mLock->newCondition()),
-        mLooper(nullptr) {
+        mLooper(nullptr),
+        mFlags(0) {
+}
+
+HandlerThread::HandlerThread(const char* name, uint32_t flags) :
+        Thread(name),
+        mLock(new ReentrantLock()),
+        mCondition(mLock->newCondition()),
+        mLooper(nullptr),
+        mFlags(flags) {
+}
+
+HandlerThread::HandlerThread(const sp<String>& name, uint32_t flags) :
+        Thread(name),
+        mLock(new ReentrantLock()),
+        mCondition(mLock->newCondition()),
+        mLooper(nullptr),
+        mFlags(flags) {
 }
 
 void HandlerThread::run() {
-    Looper::prepare();
+    Looper::prepare(true, mFlags);
     mLock->lock();
     mLooper = Looper::myLooper();
     mCondition->signalAll();
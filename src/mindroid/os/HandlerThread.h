@@ -35,6 +35,13 @@ public:
     HandlerThread();
     HandlerThread(const char* name);
     HandlerThread(const sp<String>& name);
+
+    /**
+     * Constructs a HandlerThread whose Looper's {@link MessageQueue} is configured with a
+     * combination of MessageQueue::FLAG_* values.
+     */
+    HandlerThread(const char* name, uint32_t flags);
+    HandlerThread(const sp<String>& name, uint32_t flags);
     virtual ~HandlerThread() = default;
 
     HandlerThread(const HandlerThread&) = delete;
@@ -70,6 +77,7 @@ private:
     sp<ReentrantLock> mLock;
     sp<Condition> mCondition;
     sp<Looper> mLooper;
+    const uint32_t mFlags;
 };
 
 } /* namespace mindroid */
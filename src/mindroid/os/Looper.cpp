@@ -17,22 +17,56 @@
 
 #include <mindroid/os/Looper.h>
 #include <mindroid/os/Handler.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/PoolAllocator.h>
 #include <mindroid/lang/RuntimeException.h>
 
 namespace mindroid {
 
 thread_local sp<Looper> tlsLooper;
+std::mutex Looper::sLock;
+std::vector<wp<Looper>> Looper::sLoopers;
 
-Looper::Looper(bool quitAllowed) {
-    mMessageQueue = new MessageQueue(quitAllowed);
+Looper::Looper(bool quitAllowed, uint32_t flags) :
+        mAllocator(nullptr) {
+    if (flags & MessageQueue::FLAG_ALLOCATOR_ARENA) {
+        mAllocator = new PoolAllocator();
+        Allocator::setThreadAllocator(mAllocator);
+    }
+    mMessageQueue = new MessageQueue(quitAllowed, flags);
     mThread = Thread::currentThread();
 }
 
+Looper::~Looper() {
+    if (mAllocator != nullptr) {
+        // A Looper that never looped is destroyed by its thread_local reference on its own thread,
+        // which may still create objects while its thread_local variables are destroyed.
+        if (Allocator::getThreadAllocator() == mAllocator) {
+            Allocator::setThreadAllocator(nullptr);
+        }
+        mAllocator->close();
+    }
+}
+
 void Looper::prepare(bool quitAllowed) {
+    prepare(quitAllowed, 0);
+}
+
+void Looper::prepare(bool quitAllowed, uint32_t flags) {
     if (tlsLooper != nullptr) {
         throw RuntimeException("Only one Looper may be created per thread");
     }
-    tlsLooper = new Looper(quitAllowed);
+    tlsLooper = new Looper(quitAllowed, flags);
+
+    std::lock_guard<std::mutex> lock(sLock);
+    for (auto itr = sLoopers.begin(); itr != sLoopers.end();) {
+        if (itr->get() == nullptr) {
+            itr = sLoopers.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+    sLoopers.push_back(tlsLooper);
 }
 
 void Looper::loop() {
@@ -41,17 +75,83 @@ void Looper::loop() {
         throw RuntimeException("No Looper; Looper.prepare() wasn't called on this thread");
     }
     sp<MessageQueue> mq = me->mMessageQueue;
+    // The Looper closes its arena when it is destroyed, possibly on another thread, so the Looper
+    // thread stops allocating from it as soon as the Looper has quit.
+    class AllocatorScope {
+    public:
+        AllocatorScope(Allocator* allocator) : mAllocator(allocator) {
+        }
+
+        ~AllocatorScope() {
+            if (mAllocator != nullptr && Allocator::getThreadAllocator() == mAllocator) {
+                Allocator::setThreadAllocator(nullptr);
+            }
+        }
+
+    private:
+        Allocator* const mAllocator;
+    } allocatorScope(me->mAllocator);
+    const bool threadConfined = (mq->getFlags() & MessageQueue::FLAG_THREAD_CONFINED_MESSAGES) != 0;
+
+    if (mq->getFlags() & MessageQueue::FLAG_BATCHED_DISPATCH) {
+        for (;;) {
+            const std::vector<sp<Message>>* messages = mq->dequeueMessages();
+            if (messages == nullptr) {
+                return;
+            }
+            for (size_t i = 0; i < messages->size(); i++) {
+                const sp<Message>& message = (*messages)[i];
+                if (threadConfined && message->isUniquelyReferenced()) {
+                    message->setThreadConfined(true);
+                }
+                if (message->markDispatched()) {
+                    dispatchMessage(mq.getPointer(), message);
+                }
+            }
+        }
+    }
 
     for (;;) {
         sp<Message> message = mq->dequeueMessage();
         if (message == nullptr) {
             return;
         }
-        message->target->dispatchMessage(message);
+        // The sender may still hold a reference to the message.
+        if (threadConfined && message->isUniquelyReferenced()) {
+            message->setThreadConfined(true);
+        }
+        dispatchMessage(mq.getPointer(), message);
         message->recycle();
     }
 }
 
+void Looper::dispatchMessage(MessageQueue* mq, const sp<Message>& message) {
+    if (!mq->isInstrumentationEnabled()) {
+        message->target->dispatchMessage(message);
+        return;
+    }
+
+    // The handler may modify the message while handling it.
+    const sp<Handler> target = message->target;
+    const int32_t what = message->what;
+    const uint64_t when = message->when;
+    const uint64_t start = SystemClock::uptimeNanos();
+    target->dispatchMessage(message);
+    mq->getStats()->recordDispatch(target.getPointer(), what, when, start, SystemClock::uptimeNanos());
+}
+
+sp<ArrayList<sp<Looper>>> Looper::getLoopers() {
+    sp<ArrayList<sp<Looper>>> loopers = new ArrayList<sp<Looper>>();
+    std::lock_guard<std::mutex> lock(sLock);
+    for (const wp<Looper>& looper : sLoopers) {
+        sp<Looper> l = looper.get();
+        if (l != nullptr) {
+            loopers->add(l);
+        }
+    }
+    return loopers;
+}
+
 sp<Looper> Looper::myLooper() {
     return tlsLooper;
 }
@@ -21,10 +21,14 @@
 #include <mindroid/lang/Object.h>
 #include <mindroid/lang/Thread.h>
 #include <mindroid/os/MessageQueue.h>
+#include <mindroid/util/ArrayList.h>
+#include <mutex>
+#include <vector>
 
 namespace mindroid {
 
 class Runnable;
+class PoolAllocator;
 
 /**
  * Class used to run a message loop for a thread. Threads by default do not have a message loop
@@ -59,7 +63,7 @@ class Runnable;
 class Looper final :
         public Object {
 public:
-    virtual ~Looper() = default;
+    virtual ~Looper();
 
     Looper(const Looper&) = delete;
     Looper& operator=(const Looper&) = delete;
@@ -75,6 +79,12 @@ public:
 
     static void prepare(bool quitAllowed);
 
+    /**
+     * Same as {@link #prepare(bool)}, but configures the Looper's {@link MessageQueue} with a
+     * combination of MessageQueue::FLAG_* values.
+     */
+    static void prepare(bool quitAllowed, uint32_t flags);
+
     /**
      * Run the message queue in this thread. Be sure to call {@link #quit()} to end the loop.
      */
@@ -106,6 +116,12 @@ public:
      */
     void quit();
 
+    /**
+     * Returns the allocator arena of this Looper thread, or nullptr if the Looper was not prepared
+     * with {@link MessageQueue#FLAG_ALLOCATOR_ARENA}.
+     */
+    PoolAllocator* getAllocator() { return mAllocator; }
+
     /**
      * Return the Thread associated with this Looper.
      */
@@ -116,11 +132,22 @@ public:
         return mMessageQueue;
     }
 
+    /**
+     * Returns all Loopers of this process that are still alive.
+     */
+    static sp<ArrayList<sp<Looper>>> getLoopers();
+
 private:
-    Looper(bool quitAllowed);
+    Looper(bool quitAllowed, uint32_t flags);
+
+    static void dispatchMessage(MessageQueue* mq, const sp<Message>& message);
+
+    static std::mutex sLock;
+    static std::vector<wp<Looper>> sLoopers;
 
     sp<MessageQueue> mMessageQueue;
     sp<Thread> mThread;
+    PoolAllocator* mAllocator;
 
     friend class Handler;
 };
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mindroid/os/LooperStats.h>
+#include <mindroid/os/Handler.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/StringBuilder.h>
+#include <mindroid/util/Log.h>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <typeinfo>
+
+namespace mindroid {
+
+const char* const LooperStats::TAG = "LooperStats";
+
+LooperStats::Histogram::Histogram() {
+    reset();
+}
+
+void LooperStats::Histogram::add(uint64_t value) {
+    // Bucket i holds the values in [2^(i-1), 2^i).
+    const size_t index = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+    mBuckets[index]++;
+    mCount++;
+    mSum += value;
+    if (value > mMax) {
+        mMax = value;
+    }
+}
+
+void LooperStats::Histogram::reset() {
+    std::memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+uint64_t LooperStats::Histogram::getPercentile(uint32_t percentile) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    const uint64_t rank = (mCount * percentile + 99) / 100;
+    uint64_t count = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        count += mBuckets[i];
+        if (count >= rank && count > 0) {
+            const uint64_t upperBound = (i == 0) ? 0 : ((i == 64) ? UINT64_MAX : (1ULL << i) - 1);
+            return (upperBound < mMax) ? upperBound : mMax;
+        }
+    }
+    return mMax;
+}
+
+LooperStats::AtomicHistogram::AtomicHistogram() {
+    clear();
+}
+
+void LooperStats::AtomicHistogram::add(uint64_t value) {
+    // Bucket i holds the values in [2^(i-1), 2^i).
+    const size_t index = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+    // Single writer, so no atomic read-modify-write is needed.
+    mBuckets[index].store(mBuckets[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mCount.store(mCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mSum.store(mSum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > mMax.load(std::memory_order_relaxed)) {
+        mMax.store(value, std::memory_order_relaxed);
+    }
+}
+
+void LooperStats::AtomicHistogram::clear() {
+    for (size_t i = 0; i < Histogram::BUCKET_COUNT; i++) {
+        mBuckets[i].store(0, std::memory_order_relaxed);
+    }
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+}
+
+LooperStats::Histogram LooperStats::AtomicHistogram::snapshot() const {
+    Histogram histogram;
+    for (size_t i = 0; i < Histogram::BUCKET_COUNT; i++) {
+        histogram.mBuckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+    }
+    histogram.mCount = mCount.load(std::memory_order_relaxed);
+    histogram.mSum = mSum.load(std::memory_order_relaxed);
+    histogram.mMax = mMax.load(std::memory_order_relaxed);
+    return histogram;
+}
+
+LooperStats::LooperStats() :
+        mLock(new ReentrantLock()),
+        mResetPending(false),
+        mStartTime(SystemClock::uptimeNanos()),
+        mMessageCount(0),
+        mSlowDispatchCount(0),
+        mSlowDispatchThreshold(DEFAULT_SLOW_DISPATCH_THRESHOLD),
+        mHandlerClassCount(0) {
+    for (size_t i = 0; i < MAX_HANDLER_CLASSES; i++) {
+        mHandlingTimes[i].handlerClass.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+void LooperStats::recordQueueDepth(size_t depth) {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        clear();
+    }
+    mQueueDepth.add(depth);
+}
+
+void LooperStats::recordDispatch(const Handler* handler, int32_t what, uint64_t when, uint64_t start, uint64_t end) {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        clear();
+    }
+    const std::type_info& handlerClass = typeid(*handler);
+    // Messages for the front of the queue (when == 0) have no delivery time.
+    const uint64_t latency = (when != 0 && start > when) ? start - when : 0;
+    const uint64_t duration = end - start;
+
+    mMessageCount.store(mMessageCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (when != 0) {
+        mDispatchLatency.add(latency);
+    }
+    AtomicHistogram* handlingTime = getHandlingTime(handlerClass);
+    if (handlingTime != nullptr) {
+        handlingTime->add(duration);
+    }
+
+    if (duration >= mSlowDispatchThreshold.load(std::memory_order_relaxed)) {
+        const SlowDispatch slowDispatch = { &handlerClass, what, start, latency, duration };
+        {
+            AutoLock autoLock(mLock);
+            const uint64_t slowDispatchCount = mSlowDispatchCount.load(std::memory_order_relaxed);
+            if (mSlowDispatches.size() < MAX_SLOW_DISPATCHES) {
+                mSlowDispatches.push_back(slowDispatch);
+            } else {
+                mSlowDispatches[slowDispatchCount % MAX_SLOW_DISPATCHES] = slowDispatch;
+            }
+            mSlowDispatchCount.store(slowDispatchCount + 1, std::memory_order_relaxed);
+        }
+        Log::w(TAG, "Slow dispatch took %" PRIu64 "ms h=%s what=%d", duration / 1000000,
+                getClassName(handlerClass)->c_str(), what);
+    }
+}
+
+LooperStats::AtomicHistogram* LooperStats::getHandlingTime(const std::type_info& handlerClass) {
+    const size_t count = mHandlerClassCount.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        if (*mHandlingTimes[i].handlerClass.load(std::memory_order_relaxed) == handlerClass) {
+            return &mHandlingTimes[i].histogram;
+        }
+    }
+    if (count == MAX_HANDLER_CLASSES) {
+        return nullptr;
+    }
+    mHandlingTimes[count].handlerClass.store(&handlerClass, std::memory_order_relaxed);
+    // Publishes the new entry to the readers.
+    mHandlerClassCount.store(count + 1, std::memory_order_release);
+    return &mHandlingTimes[count].histogram;
+}
+
+void LooperStats::clear() {
+    mMessageCount.store(0, std::memory_order_relaxed);
+    mQueueDepth.clear();
+    mDispatchLatency.clear();
+    const size_t count = mHandlerClassCount.load(std::memory_order_relaxed);
+    mHandlerClassCount.store(0, std::memory_order_release);
+    for (size_t i = 0; i < count; i++) {
+        mHandlingTimes[i].handlerClass.store(nullptr, std::memory_order_relaxed);
+        mHandlingTimes[i].histogram.clear();
+    }
+    {
+        AutoLock autoLock(mLock);
+        mSlowDispatchCount.store(0, std::memory_order_relaxed);
+        mSlowDispatches.clear();
+    }
+    mResetPending.store(false, std::memory_order_release);
+}
+
+void LooperStats::setSlowDispatchThreshold(uint64_t thresholdNanos) {
+    mSlowDispatchThreshold.store(thresholdNanos, std::memory_order_relaxed);
+}
+
+uint64_t LooperStats::getMessageCount() {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return mMessageCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LooperStats::getSlowDispatchCount() {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return mSlowDispatchCount.load(std::memory_order_relaxed);
+}
+
+LooperStats::Histogram LooperStats::getQueueDepth() {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        return Histogram();
+    }
+    return mQueueDepth.snapshot();
+}
+
+LooperStats::Histogram LooperStats::getDispatchLatency() {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        return Histogram();
+    }
+    return mDispatchLatency.snapshot();
+}
+
+LooperStats::Histogram LooperStats::getHandlingTime(const char* handlerClass) {
+    if (mResetPending.load(std::memory_order_acquire)) {
+        return Histogram();
+    }
+    const size_t count = mHandlerClassCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        const std::type_info* type = mHandlingTimes[i].handlerClass.load(std::memory_order_relaxed);
+        if (type != nullptr && getClassName(*type)->equals(handlerClass)) {
+            return mHandlingTimes[i].histogram.snapshot();
+        }
+    }
+    return Histogram();
+}
+
+void LooperStats::reset() {
+    AutoLock autoLock(mLock);
+    mStartTime.store(SystemClock::uptimeNanos(), std::memory_order_relaxed);
+    mResetPending.store(true, std::memory_order_release);
+}
+
+sp<String> LooperStats::toString() {
+    AutoLock autoLock(mLock);
+    const bool isReset = mResetPending.load(std::memory_order_acquire);
+    const uint64_t duration = SystemClock::uptimeNanos() - mStartTime.load(std::memory_order_relaxed);
+    const uint64_t messageCount = isReset ? 0 : mMessageCount.load(std::memory_order_relaxed);
+    const uint64_t slowDispatchCount = isReset ? 0 : mSlowDispatchCount.load(std::memory_order_relaxed);
+    const Histogram queueDepth = isReset ? Histogram() : mQueueDepth.snapshot();
+    const Histogram dispatchLatency = isReset ? Histogram() : mDispatchLatency.snapshot();
+    sp<StringBuilder> sb = new StringBuilder();
+    sb->append(String::format("Messages: %" PRIu64 " (%.1f/s)\n", messageCount,
+            (duration > 0) ? messageCount * 1000000000.0 / duration : 0.0));
+    sb->append(String::format("Queue depth: mean %.1f, p50 %" PRIu64 ", p99 %" PRIu64 ", max %" PRIu64 "\n",
+            queueDepth.getMean(), queueDepth.getPercentile(50), queueDepth.getPercentile(99), queueDepth.getMax()));
+    sb->append(String::format("Dispatch latency: mean %.1fus, p50 %.1fus, p99 %.1fus, max %.1fus\n",
+            dispatchLatency.getMean() / 1000.0, dispatchLatency.getPercentile(50) / 1000.0,
+            dispatchLatency.getPercentile(99) / 1000.0, dispatchLatency.getMax() / 1000.0));
+    const size_t handlerClassCount = isReset ? 0 : mHandlerClassCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < handlerClassCount; i++) {
+        const std::type_info* type = mHandlingTimes[i].handlerClass.load(std::memory_order_relaxed);
+        if (type == nullptr) {
+            continue;
+        }
+        const Histogram handlingTime = mHandlingTimes[i].histogram.snapshot();
+        sb->append(String::format("Handler %s: %" PRIu64 " messages, mean %.1fus, p50 %.1fus, p99 %.1fus, max %.1fus\n",
+                getClassName(*type)->c_str(), handlingTime.getCount(),
+                handlingTime.getMean() / 1000.0, handlingTime.getPercentile(50) / 1000.0,
+                handlingTime.getPercentile(99) / 1000.0, handlingTime.getMax() / 1000.0));
+    }
+    sb->append(String::format("Slow dispatches (>= %" PRIu64 "ms): %" PRIu64,
+            mSlowDispatchThreshold.load(std::memory_order_relaxed) / 1000000, slowDispatchCount));
+    const size_t slowDispatches = isReset ? 0 : mSlowDispatches.size();
+    for (size_t i = 0; i < slowDispatches; i++) {
+        const SlowDispatch& slowDispatch = mSlowDispatches[(slowDispatchCount + i) % slowDispatches];
+        sb->append(String::format("\n  at %" PRIu64 "ms: h=%s what=%d took %.1fms, latency %.1fms",
+                slowDispatch.uptime / 1000000, getClassName(*slowDispatch.handlerClass)->c_str(), slowDispatch.what,
+                slowDispatch.duration / 1000000.0, slowDispatch.latency / 1000000.0));
+    }
+    return sb->toString();
+}
+
+sp<String> LooperStats::getClassName(const std::type_info& type) {
+    int status = 0;
+    char* name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    if (name == nullptr) {
+        return String::valueOf(type.name());
+    }
+    sp<String> className = String::valueOf(name);
+    std::free(name);
+    return className;
+}
+
+} /* namespace mindroid */
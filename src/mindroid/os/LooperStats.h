@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_OS_LOOPERSTATS_H_
+#define MINDROID_OS_LOOPERSTATS_H_
+
+#include <mindroid/lang/Object.h>
+#include <mindroid/lang/String.h>
+#include <mindroid/util/concurrent/locks/ReentrantLock.h>
+#include <atomic>
+#include <typeinfo>
+#include <vector>
+
+namespace mindroid {
+
+class Handler;
+
+/**
+ * Latency and throughput statistics of a {@link Looper} and its {@link MessageQueue}. The
+ * statistics are only collected while instrumentation is enabled for the MessageQueue (see
+ * {@link MessageQueue#setInstrumentationEnabled}).
+ *
+ * <p>
+ * All values are kept in histograms with power-of-two buckets, so recording a value costs a few
+ * instructions and percentiles are reported as bucket upper bounds. Only the Looper thread records
+ * values, so it updates the histograms with relaxed atomic stores and without locks. Other threads
+ * read snapshots of them.
+ */
+class LooperStats final :
+        public Object {
+private:
+    class AtomicHistogram;
+
+public:
+    class Histogram final {
+    public:
+        Histogram();
+
+        void add(uint64_t value);
+        void reset();
+
+        uint64_t getCount() const {
+            return mCount;
+        }
+
+        uint64_t getMax() const {
+            return mMax;
+        }
+
+        double getMean() const {
+            return (mCount > 0) ? (double) mSum / mCount : 0.0;
+        }
+
+        /**
+         * Returns the upper bound of the bucket that contains the given percentile (0 - 100).
+         */
+        uint64_t getPercentile(uint32_t percentile) const;
+
+    private:
+        static const size_t BUCKET_COUNT = 65;
+
+        uint64_t mBuckets[BUCKET_COUNT];
+        uint64_t mCount;
+        uint64_t mSum;
+        uint64_t mMax;
+
+        friend class AtomicHistogram;
+    };
+
+    /**
+     * Default threshold for slow dispatch events.
+     */
+    static const uint64_t DEFAULT_SLOW_DISPATCH_THRESHOLD = 100000000;
+
+    /**
+     * Maximum number of slow dispatch events that are kept.
+     */
+    static const size_t MAX_SLOW_DISPATCHES = 16;
+
+    /**
+     * Maximum number of Handler classes whose handling times are kept. The messages of further
+     * Handler classes are only counted.
+     */
+    static const size_t MAX_HANDLER_CLASSES = 16;
+
+    LooperStats();
+    virtual ~LooperStats() = default;
+    LooperStats(const LooperStats&) = delete;
+    LooperStats& operator=(const LooperStats&) = delete;
+
+    /**
+     * Records the number of pending messages at the time the Looper dequeues a message. Must only
+     * be called by the Looper thread.
+     */
+    void recordQueueDepth(size_t depth);
+
+    /**
+     * Records the dispatch of a message that was due at uptime <em>when</em> and was handled by
+     * <em>handler</em> from uptime <em>start</em> to uptime <em>end</em> (all in nanoseconds). Must
+     * only be called by the Looper thread.
+     */
+    void recordDispatch(const Handler* handler, int32_t what, uint64_t when, uint64_t start, uint64_t end);
+
+    /**
+     * Sets the handling time in nanoseconds above which a dispatch is recorded and logged as slow
+     * dispatch event.
+     */
+    void setSlowDispatchThreshold(uint64_t thresholdNanos);
+
+    uint64_t getMessageCount();
+    uint64_t getSlowDispatchCount();
+    Histogram getQueueDepth();
+
+    /**
+     * Returns the time in nanoseconds between the delivery time of a message and its dispatch.
+     */
+    Histogram getDispatchLatency();
+
+    /**
+     * Returns the handling time in nanoseconds of the messages of all Handlers of the given class.
+     */
+    Histogram getHandlingTime(const char* handlerClass);
+
+    /**
+     * Clears the statistics. The Looper thread clears its histograms before it records the next
+     * value, until then all statistics read as empty.
+     */
+    void reset();
+
+    sp<String> toString();
+
+private:
+    static const char* const TAG;
+
+    /**
+     * Histogram that the Looper thread updates without read-modify-write operations while other
+     * threads take snapshots of it.
+     */
+    class AtomicHistogram final {
+    public:
+        AtomicHistogram();
+
+        void add(uint64_t value);
+        void clear();
+        Histogram snapshot() const;
+
+    private:
+        std::atomic<uint64_t> mBuckets[Histogram::BUCKET_COUNT];
+        std::atomic<uint64_t> mCount;
+        std::atomic<uint64_t> mSum;
+        std::atomic<uint64_t> mMax;
+    };
+
+    struct HandlingTime {
+        std::atomic<const std::type_info*> handlerClass;
+        AtomicHistogram histogram;
+    };
+
+    struct SlowDispatch {
+        const std::type_info* handlerClass;
+        int32_t what;
+        uint64_t uptime;
+        uint64_t latency;
+        uint64_t duration;
+    };
+
+    static sp<String> getClassName(const std::type_info& type);
+
+    // Only called by the Looper thread.
+    void clear();
+    AtomicHistogram* getHandlingTime(const std::type_info& handlerClass);
+
+    // Guards the slow dispatch events.
+    sp<ReentrantLock> mLock;
+    std::atomic<bool> mResetPending;
+    std::atomic<uint64_t> mStartTime;
+    std::atomic<uint64_t> mMessageCount;
+    std::atomic<uint64_t> mSlowDispatchCount;
+    std::atomic<uint64_t> mSlowDispatchThreshold;
+    AtomicHistogram mQueueDepth;
+    AtomicHistogram mDispatchLatency;
+    HandlingTime mHandlingTimes[MAX_HANDLER_CLASSES];
+    std::atomic<size_t> mHandlerClassCount;
+    // Ring buffer of the latest slow dispatch events.
+    std::vector<SlowDispatch> mSlowDispatches;
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_OS_LOOPERSTATS_H_ */
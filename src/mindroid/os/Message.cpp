@@ -18,15 +18,22 @@
 #include <mindroid/os/Message.h>
 #include <mindroid/os/Handler.h>
 #include <mindroid/util/concurrent/Thenable.h>
+#include <mindroid/lang/Math.h>
+#include <mindroid/lang/IllegalArgumentException.h>
+#include <algorithm>
 
 namespace mindroid {
 
 MessagePool Message::sMessagePool;
+thread_local MessagePoolCache tlsMessagePoolCache;
 
 MessagePool::MessagePool() :
         MAX_SIZE(42),
         size(0),
-        lock(new ReentrantLock()) {
+        lock(new ReentrantLock()),
+        cacheCapacity(16),
+        hitCount(0),
+        missCount(0) {
 }
 
 MessagePool::~MessagePool() {
@@ -36,6 +43,86 @@ MessagePool::~MessagePool() {
     pool = nullptr;
 }
 
+MessagePoolCache::MessagePoolCache() :
+        size(0),
+        hitCount(0),
+        missCount(0) {
+    MessagePool& messagePool = Message::sMessagePool;
+    AutoLock autoLock(messagePool.lock);
+    messagePool.caches.push_back(this);
+}
+
+MessagePoolCache::~MessagePoolCache() {
+    spill(size);
+    MessagePool& messagePool = Message::sMessagePool;
+    AutoLock autoLock(messagePool.lock);
+    messagePool.hitCount += hitCount.load(std::memory_order_relaxed);
+    messagePool.missCount += missCount.load(std::memory_order_relaxed);
+    messagePool.caches.erase(std::find(messagePool.caches.begin(), messagePool.caches.end(), this));
+}
+
+sp<Message> MessagePoolCache::obtain() {
+    if (pool == nullptr) {
+        refill(Math::max(Message::sMessagePool.cacheCapacity.load(std::memory_order_relaxed) / 2, 1u));
+    }
+    if (pool != nullptr) {
+        sp<Message> message = pool;
+        pool = message->nextMessage;
+        message->nextMessage = nullptr;
+        message->flags = 0;
+        size--;
+        // Single writer, so no atomic read-modify-write is needed.
+        hitCount.store(hitCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return message;
+    }
+    missCount.store(missCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return new Message();
+}
+
+void MessagePoolCache::recycle(Message* message) {
+    message->nextMessage = pool;
+    pool = message;
+    size++;
+}
+
+void MessagePoolCache::trim() {
+    const uint32_t capacity = Message::sMessagePool.cacheCapacity.load(std::memory_order_relaxed);
+    if (size > capacity) {
+        spill(size - capacity / 2);
+    }
+}
+
+void MessagePoolCache::refill(uint32_t count) {
+    MessagePool& messagePool = Message::sMessagePool;
+    AutoLock autoLock(messagePool.lock);
+    while (count-- > 0 && messagePool.pool != nullptr) {
+        sp<Message> message = messagePool.pool;
+        messagePool.pool = message->nextMessage;
+        messagePool.size--;
+        recycle(message.getPointer());
+    }
+}
+
+void MessagePoolCache::spill(uint32_t count) {
+    MessagePool& messagePool = Message::sMessagePool;
+    AutoLock autoLock(messagePool.lock);
+    while (count-- > 0 && pool != nullptr) {
+        sp<Message> message = pool;
+        pool = message->nextMessage;
+        size--;
+        // Other threads obtain their messages from the global pool.
+        message->setThreadConfined(false);
+        // Messages that do not fit into the global pool are freed.
+        if (messagePool.size < messagePool.MAX_SIZE) {
+            message->nextMessage = messagePool.pool;
+            messagePool.pool = message;
+            messagePool.size++;
+        } else {
+            message->nextMessage = nullptr;
+        }
+    }
+}
+
 Message::Message() :
         what(0),
         arg1(0),
@@ -47,22 +134,19 @@ Message::Message() :
         target(nullptr),
         callback(nullptr),
         prevMessage(nullptr),
-        nextMessage(nullptr) {
+        nextMessage(nullptr),
+        nextPendingMessage(nullptr),
+        heapIndex(0),
+        prevIndexedMessages(),
+        nextIndexedMessages(),
+        sequenceNumber(0),
+        priority(PRIORITY_DEFAULT),
+        lane(0),
+        dispatchState(DISPATCH_STATE_PENDING) {
 }
 
 sp<Message> Message::obtain() {
-    {
-        AutoLock autoLock(sMessagePool.lock);
-        if (sMessagePool.pool != nullptr) {
-            sp<Message> message = sMessagePool.pool;
-            sMessagePool.pool = message->nextMessage;
-            message->nextMessage = nullptr;
-            message->flags = 0;
-            sMessagePool.size--;
-            return message;
-        }
-    }
-    return new Message();
+    return tlsMessagePoolCache.obtain();
 }
 
 sp<Message> Message::obtain(const sp<Message>& origMessage) {
@@ -80,50 +164,50 @@ sp<Message> Message::obtain(const sp<Message>& origMessage) {
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler) {
+sp<Message> Message::obtain(sp<Handler> handler) {
     sp<Message> message = obtain();
-    message->target = handler;
+    message->target = std::move(handler);
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler, const sp<Runnable>& callback) {
+sp<Message> Message::obtain(sp<Handler> handler, sp<Runnable> callback) {
     sp<Message> message = obtain();
-    message->target = handler;
-    message->callback = callback;
+    message->target = std::move(handler);
+    message->callback = std::move(callback);
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler, int32_t what) {
+sp<Message> Message::obtain(sp<Handler> handler, int32_t what) {
     sp<Message> message = obtain();
-    message->target = handler;
+    message->target = std::move(handler);
     message->what = what;
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler, int32_t what, const sp<Object>& obj) {
+sp<Message> Message::obtain(sp<Handler> handler, int32_t what, sp<Object> obj) {
     sp<Message> message = obtain();
-    message->target = handler;
+    message->target = std::move(handler);
     message->what = what;
-    message->obj = obj;
+    message->obj = std::move(obj);
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler, int32_t what, int32_t arg1, int32_t arg2) {
+sp<Message> Message::obtain(sp<Handler> handler, int32_t what, int32_t arg1, int32_t arg2) {
     sp<Message> message = obtain();
-    message->target = handler;
+    message->target = std::move(handler);
     message->what = what;
     message->arg1 = arg1;
     message->arg2 = arg2;
     return message;
 }
 
-sp<Message> Message::obtain(const sp<Handler>& handler, int32_t what, int32_t arg1, int32_t arg2, const sp<Object>& obj) {
+sp<Message> Message::obtain(sp<Handler> handler, int32_t what, int32_t arg1, int32_t arg2, sp<Object> obj) {
     sp<Message> message = obtain();
-    message->target = handler;
+    message->target = std::move(handler);
     message->what = what;
     message->arg1 = arg1;
     message->arg2 = arg2;
-    message->obj = obj;
+    message->obj = std::move(obj);
     return message;
 }
 
@@ -132,34 +216,60 @@ sp<Message> Message::obtain(const sp<Handler>& handler, int32_t what, int32_t ar
  * this function -- it has effectively been freed.
  */
 void Message::recycle() {
+    clearForRecycle();
+    tlsMessagePoolCache.recycle(this);
+    tlsMessagePoolCache.trim();
+}
+
+void Message::recycle(std::vector<sp<Message>>& messages) {
+    for (size_t i = 0; i < messages.size(); i++) {
+        messages[i]->clearForRecycle();
+        tlsMessagePoolCache.recycle(messages[i].getPointer());
+    }
+    tlsMessagePoolCache.trim();
+    messages.clear();
+}
+
+void Message::clearForRecycle() {
     if (result != nullptr) {
         result->cancel();
     }
 
+    // Keep the PostRunnable for the next Handler::post() unless somebody else still references it.
+    if ((flags & FLAG_POST_RUNNABLE) != 0 && callback != nullptr && callback->isUniquelyReferenced()) {
+        static_cast<PostRunnable*>(callback.getPointer())->reset();
+        postRunnable = std::move(callback);
+    }
+
     flags = FLAG_IN_USE;
     what = 0;
     arg1 = 0;
     arg2 = 0;
     obj = nullptr;
     when = 0;
+    priority = PRIORITY_DEFAULT;
     target = nullptr;
     callback = nullptr;
     data = nullptr;
     result = nullptr;
     prevMessage = nullptr;
     nextMessage = nullptr;
+}
 
-    {
-        AutoLock autoLock(sMessagePool.lock);
-        if (sMessagePool.size < sMessagePool.MAX_SIZE) {
-            nextMessage = sMessagePool.pool;
-            sMessagePool.pool = this;
-            sMessagePool.size++;
+bool Message::markDispatched() {
+    int32_t state = DISPATCH_STATE_PENDING;
+    while (!dispatchState.compare_exchange_weak(state, DISPATCH_STATE_DISPATCHED, std::memory_order_acquire, std::memory_order_acquire)) {
+        if (state == DISPATCH_STATE_CANCELED) {
+            return false;
         }
+        // Wait while the MessageQueue is matching the message against removeMessages() or hasMessages().
+        state = DISPATCH_STATE_PENDING;
     }
+    return true;
 }
 
 void Message::copyFrom(const sp<Message>& otherMessage) {
+    this->flags = (this->flags & FLAG_IN_USE) | (otherMessage->flags & FLAG_ASYNCHRONOUS);
     this->what = otherMessage->what;
     this->arg1 = otherMessage->arg1;
     this->arg2 = otherMessage->arg2;
@@ -171,6 +281,47 @@ void Message::copyFrom(const sp<Message>& otherMessage) {
     }
 }
 
+void Message::setPriority(int32_t priority) {
+    if (priority != PRIORITY_DEFAULT && (priority < Handler::PRIORITY_HIGH || priority > Handler::PRIORITY_LOW)) {
+        throw IllegalArgumentException("Invalid message priority");
+    }
+    this->priority = priority;
+}
+
+void Message::setPoolCapacity(uint32_t capacity) {
+    AutoLock autoLock(sMessagePool.lock);
+    sMessagePool.MAX_SIZE = capacity;
+    while (sMessagePool.size > capacity) {
+        sp<Message> message = sMessagePool.pool;
+        sMessagePool.pool = message->nextMessage;
+        message->nextMessage = nullptr;
+        sMessagePool.size--;
+    }
+}
+
+void Message::setPoolCacheCapacity(uint32_t capacity) {
+    sMessagePool.cacheCapacity.store(capacity, std::memory_order_relaxed);
+    tlsMessagePoolCache.trim();
+}
+
+uint64_t Message::getPoolHitCount() {
+    AutoLock autoLock(sMessagePool.lock);
+    uint64_t hitCount = sMessagePool.hitCount;
+    for (MessagePoolCache* cache : sMessagePool.caches) {
+        hitCount += cache->hitCount.load(std::memory_order_relaxed);
+    }
+    return hitCount;
+}
+
+uint64_t Message::getPoolMissCount() {
+    AutoLock autoLock(sMessagePool.lock);
+    uint64_t missCount = sMessagePool.missCount;
+    for (MessagePoolCache* cache : sMessagePool.caches) {
+        missCount += cache->missCount.load(std::memory_order_relaxed);
+    }
+    return missCount;
+}
+
 void Message::sendToTarget() {
     target->sendMessage(this);
 }
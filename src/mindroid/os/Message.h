@@ -19,16 +19,25 @@
 #define MINDROID_OS_MESSAGE_H_
 
 #include <mindroid/lang/Object.h>
+#include <mindroid/lang/Runnable.h>
 #include <mindroid/util/concurrent/locks/ReentrantLock.h>
 #include <mindroid/os/Bundle.h>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace mindroid {
 
-class Runnable;
 class Handler;
 class Message;
 class Thenable;
 
+/// @private
+struct MessagePoolCache;
+
 /// @private
 struct MessagePool {
     MessagePool();
@@ -38,6 +47,98 @@ struct MessagePool {
     sp<Message> pool;
     uint32_t size;
     sp<ReentrantLock> lock;
+    // Capacity of the per-thread caches in front of the global pool.
+    std::atomic<uint32_t> cacheCapacity;
+    // The caches of all running threads, for the statistics. Guarded by lock.
+    std::vector<MessagePoolCache*> caches;
+    // Statistics of the caches of threads that have terminated.
+    uint64_t hitCount;
+    uint64_t missCount;
+};
+
+/// @private
+struct MessagePoolCache {
+    MessagePoolCache();
+    ~MessagePoolCache();
+
+    sp<Message> obtain();
+    void recycle(Message* message);
+    void trim();
+    void refill(uint32_t count);
+    void spill(uint32_t count);
+
+    sp<Message> pool;
+    uint32_t size;
+    // Only written by the thread of the cache and read by the statistics getters of the pool.
+    std::atomic<uint64_t> hitCount;
+    std::atomic<uint64_t> missCount;
+};
+
+/**
+ * Runnable for the functions that are posted to a {@link Handler}. Functions that fit into
+ * BUFFER_SIZE bytes are stored inline. The Runnable stays with its Message when the Message is
+ * recycled and is reused by the next post.
+ *
+ * @private
+ */
+class PostRunnable final :
+        public Runnable {
+public:
+    static const size_t BUFFER_SIZE = 64;
+
+    virtual ~PostRunnable() {
+        reset();
+    }
+
+    void run() override {
+        if (mInvoke != nullptr) {
+            mInvoke(mFunction);
+        }
+    }
+
+private:
+    PostRunnable() :
+            mFunction(nullptr),
+            mInvoke(nullptr),
+            mDestroy(nullptr) {
+    }
+
+    template<typename F>
+    void set(F&& func) {
+        typedef typename std::decay<F>::type Function;
+        reset();
+        set<Function>(std::forward<F>(func),
+                std::integral_constant<bool, sizeof(Function) <= BUFFER_SIZE && alignof(Function) <= alignof(std::max_align_t)>());
+        mInvoke = [] (void* function) { (*static_cast<Function*>(function))(); };
+    }
+
+    template<typename Function, typename F>
+    void set(F&& func, std::true_type /* inline */) {
+        mFunction = new (&mBuffer) Function(std::forward<F>(func));
+        mDestroy = [] (void* function) { static_cast<Function*>(function)->~Function(); };
+    }
+
+    template<typename Function, typename F>
+    void set(F&& func, std::false_type /* inline */) {
+        mFunction = new Function(std::forward<F>(func));
+        mDestroy = [] (void* function) { delete static_cast<Function*>(function); };
+    }
+
+    void reset() {
+        if (mDestroy != nullptr) {
+            mDestroy(mFunction);
+            mFunction = nullptr;
+            mInvoke = nullptr;
+            mDestroy = nullptr;
+        }
+    }
+
+    typename std::aligned_storage<BUFFER_SIZE, alignof(std::max_align_t)>::type mBuffer;
+    void* mFunction;
+    void (*mInvoke)(void*);
+    void (*mDestroy)(void*);
+
+    friend class Message;
 };
 
 /**
@@ -108,7 +209,7 @@ public:
      * @param handler Handler to assign to the returned Message object's <em>target</em> member.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler);
+    static sp<Message> obtain(sp<Handler> handler);
 
     /**
      * Same as {@link #obtain(Handler)}, but assigns a callback Runnable on the Message that is
@@ -118,7 +219,7 @@ public:
      * @param callback Runnable that will execute when the message is handled.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler, const sp<Runnable>& callback);
+    static sp<Message> obtain(sp<Handler> handler, sp<Runnable> callback);
 
     /**
      * Same as {@link #obtain()}, but sets the values for both <em>target</em> and <em>what</em>
@@ -128,7 +229,7 @@ public:
      * @param what Value to assign to the <em>what</em> member.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler, int32_t what);
+    static sp<Message> obtain(sp<Handler> handler, int32_t what);
 
     /**
      * Same as {@link #obtain()}, but sets the values of the <em>target</em>, <em>what</em>, and
@@ -139,7 +240,7 @@ public:
      * @param obj The <em>object</em> method to set.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler, int32_t what, const sp<Object>& obj);
+    static sp<Message> obtain(sp<Handler> handler, int32_t what, sp<Object> obj);
 
     /**
      * Same as {@link #obtain()}, but sets the values of the <em>target</em>, <em>what</em>,
@@ -151,7 +252,7 @@ public:
      * @param arg2 The <em>arg2</em> value to set.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler, int32_t what, int32_t arg1, int32_t arg2);
+    static sp<Message> obtain(sp<Handler> handler, int32_t what, int32_t arg1, int32_t arg2);
 
     /**
      * Same as {@link #obtain()}, but sets the values of the <em>target</em>, <em>what</em>,
@@ -164,7 +265,7 @@ public:
      * @param obj The <em>obj</em> value to set.
      * @return A Message object from the global pool.
      */
-    static sp<Message> obtain(const sp<Handler>& handler, int32_t what, int32_t arg1, int32_t arg2, const sp<Object>& obj);
+    static sp<Message> obtain(sp<Handler> handler, int32_t what, int32_t arg1, int32_t arg2, sp<Object> obj);
 
     /**
      * Make this message like otherMessage. Performs a shallow copy of the data field. Does not copy the linked
@@ -176,6 +277,13 @@ public:
      * Return the targeted delivery time of this message, in milliseconds.
      */
     uint64_t getWhen() const {
+        return when / 1000000;
+    }
+
+    /**
+     * Return the targeted delivery time of this message, in nanoseconds.
+     */
+    uint64_t getWhenNanos() const {
         return when;
     }
 
@@ -194,6 +302,65 @@ public:
         return target;
     }
 
+    /**
+     * Sets the priority lane of this message, one of {@link Handler#PRIORITY_HIGH},
+     * {@link Handler#PRIORITY_NORMAL} or {@link Handler#PRIORITY_LOW}. Overrides the priority of
+     * the target Handler.
+     */
+    void setPriority(int32_t priority);
+
+    /**
+     * Returns the priority set with {@link #setPriority}, or PRIORITY_DEFAULT if the message
+     * inherits the priority of its target Handler.
+     */
+    int32_t getPriority() const {
+        return priority;
+    }
+
+    /**
+     * Priority of messages that inherit the priority of their target Handler.
+     */
+    static const int32_t PRIORITY_DEFAULT = -1;
+
+    /**
+     * Returns true if the message is asynchronous, meaning that it is not subject to
+     * {@link Looper} synchronization barriers.
+     *
+     * @return True if the message is asynchronous.
+     *
+     * @see #setAsynchronous(bool)
+     */
+    bool isAsynchronous() const {
+        return (flags & FLAG_ASYNCHRONOUS) != 0;
+    }
+
+    /**
+     * Sets whether the message is asynchronous, meaning that it is not subject to {@link Looper}
+     * synchronization barriers.
+     *
+     * <p>
+     * Certain operations, such as the processing of urgent binder transactions, may introduce
+     * synchronization barriers into the {@link MessageQueue} (see
+     * {@link MessageQueue#postSyncBarrier}) to prevent subsequent messages from being delivered
+     * until some condition is met. Asynchronous messages are exempt from synchronization barriers.
+     *
+     * <p>
+     * Asynchronous messages of a priority lane may be delivered out of order with respect to the
+     * synchronous messages of that lane that are held back by a barrier, but they are always
+     * delivered in order among themselves.
+     *
+     * @param async True if the message is asynchronous.
+     *
+     * @see #isAsynchronous()
+     */
+    void setAsynchronous(bool async) {
+        if (async) {
+            flags |= FLAG_ASYNCHRONOUS;
+        } else {
+            flags &= ~FLAG_ASYNCHRONOUS;
+        }
+    }
+
     /**
      * Retrieve callback object that will execute when this message is handled. This object must
      * implement Runnable. This is called by the <em>target</em> {@link Handler} that is receiving
@@ -246,6 +413,29 @@ public:
      */
     void sendToTarget();
 
+    /**
+     * Sets the maximum number of recycled messages that are kept in the global pool.
+     */
+    static void setPoolCapacity(uint32_t capacity);
+
+    /**
+     * Sets the maximum number of recycled messages that each thread keeps in its own cache in
+     * front of the global pool. A thread only takes the lock of the global pool when its cache
+     * runs empty or full, and then moves half of the cache capacity at once. A capacity of 0
+     * disables the caches.
+     */
+    static void setPoolCacheCapacity(uint32_t capacity);
+
+    /**
+     * Returns how many messages have been obtained from the pool instead of being allocated.
+     */
+    static uint64_t getPoolHitCount();
+
+    /**
+     * Returns how many messages had to be allocated because the pool was empty.
+     */
+    static uint64_t getPoolMissCount();
+
 private:
     bool isInUse() {
         return ((flags & FLAG_IN_USE) == FLAG_IN_USE);
@@ -261,15 +451,63 @@ private:
      */
     void recycle();
 
+    /**
+     * Returns a batch of Message instances to the global pool while taking the pool lock only once.
+     */
+    static void recycle(std::vector<sp<Message>>& messages);
+
+    void clearForRecycle();
+
+    /**
+     * Moves the function into the PostRunnable of this Message and makes it the callback.
+     */
+    template<typename F>
+    void setPostCallback(F&& func) {
+        if (postRunnable == nullptr) {
+            postRunnable = new PostRunnable();
+        }
+        static_cast<PostRunnable*>(postRunnable.getPointer())->set(std::forward<F>(func));
+        callback = std::move(postRunnable);
+        flags |= FLAG_POST_RUNNABLE;
+    }
+
     static const int32_t FLAG_IN_USE = 1 << 0;
+    static const int32_t FLAG_ASYNCHRONOUS = 1 << 1;
+    static const int32_t FLAG_POST_RUNNABLE = 1 << 2;
+
+    // Dispatch states of messages that have been dequeued as part of a batch.
+    static const int32_t DISPATCH_STATE_PENDING = 0;
+    static const int32_t DISPATCH_STATE_DISPATCHED = 1;
+    static const int32_t DISPATCH_STATE_CANCELED = 2;
+    static const int32_t DISPATCH_STATE_MATCHING = 3;
+
+    /**
+     * Claims a message of a batch for dispatching. Returns false if it has been removed from the
+     * MessageQueue in the meantime.
+     */
+    bool markDispatched();
 
     int32_t flags;
+    // Delivery time in nanoseconds of uptime.
     uint64_t when;
     sp<Bundle> data;
     sp<Handler> target;
     sp<Runnable> callback;
+    // Unused PostRunnable that is kept for the next Handler::post().
+    sp<Runnable> postRunnable;
     sp<Message> prevMessage;
     sp<Message> nextMessage;
+    Message* nextPendingMessage;
+    size_t heapIndex;
+    // Intrusive chains of the MessageQueue's message index.
+    Message* prevIndexedMessages[3];
+    Message* nextIndexedMessages[3];
+    uint64_t sequenceNumber;
+    int32_t priority;
+    // Priority lane of the MessageQueue that holds the message.
+    int32_t lane;
+    // Arbitrates between the Looper and removeMessages() for dequeued but not yet dispatched messages.
+    std::atomic<int32_t> dispatchState;
     static MessagePool sMessagePool;
 
     /**
@@ -283,6 +521,7 @@ private:
     friend class Looper;
     friend class Handler;
     friend struct MessagePool;
+    friend struct MessagePoolCache;
     friend class Binder;
 };
 
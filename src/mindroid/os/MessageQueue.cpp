@@ -24,7 +24,9 @@
 #include <mindroid/lang/Math.h>
 #include <mindroid/lang/IllegalArgumentException.h>
 #include <mindroid/lang/IllegalStateException.h>
+#include <mindroid/lang/NullPointerException.h>
 #include <mindroid/util/Log.h>
+#include <algorithm>
 #include <climits>
 
 namespace mindroid {
@@ -32,15 +34,37 @@ namespace mindroid {
 const char* const MessageQueue::TAG = "MessageQueue";
 
 MessageQueue::MessageQueue(bool quitAllowed) :
-        mHeadMessage(nullptr),
-        mTailMessage(nullptr),
+        MessageQueue(quitAllowed, 0) {
+}
+
+MessageQueue::MessageQueue(bool quitAllowed, uint32_t flags) :
+        mAgingThreshold(DEFAULT_AGING_THRESHOLD),
+        mNextBarrierToken(0),
+        mSequenceNumber(0),
+        mMessageCount(0),
+        mIndexLookupCount(0),
+        mIndexHitCount(0),
         mLock(new ReentrantLock()),
         mCondition(mLock->newCondition()),
         mQuitAllowed(quitAllowed),
-        mQuitting(false) {
+        mFlags(flags),
+        mQuitting(false),
+        mPendingMessages(nullptr),
+        mBlocked(false),
+        mInstrumented((flags & FLAG_INSTRUMENTATION) != 0),
+        mStats(new LooperStats()) {
 }
 
-MessageQueue::~MessageQueue() { }
+MessageQueue::~MessageQueue() {
+    // Release messages that raced with quit().
+    Message* message = mPendingMessages.exchange(nullptr, std::memory_order_acquire);
+    while (message != nullptr) {
+        Message* nextMessage = message->nextPendingMessage;
+        message->nextPendingMessage = nullptr;
+        message->decStrongReference(this);
+        message = nextMessage;
+    }
+}
 
 bool MessageQueue::quit() {
     if (!mQuitAllowed) {
@@ -53,24 +77,39 @@ bool MessageQueue::quit() {
     }
     mQuitting = true;
 
-    sp<Message> curMessage = mHeadMessage;
-    while (curMessage != nullptr) {
-        sp<Message> nextMessage = curMessage->nextMessage;
-        curMessage->recycle();
-        curMessage = nextMessage;
-    }
-    mHeadMessage = nullptr;
-    mTailMessage = nullptr;
+    drainPendingMessages();
+    recycleMessages();
+    // The Looper recycles its current batch with the next call of dequeueMessages().
+    matchBatchMessages([] (const Message*) { return true; }, true);
 
     mCondition->signal();
     return true;
 }
 
 bool MessageQueue::enqueueMessage(const sp<Message>& message, uint64_t when) {
+    if (when == 0) {
+        return enqueueMessageNanos(message, 0);
+    }
+    // Messages for the same millisecond keep the order in which they have been sent, also relative to
+    // messages that have been sent with nanosecond times during that millisecond.
+    const uint64_t now = SystemClock::uptimeNanos();
+    return enqueueMessageNanos(message, std::min(when * 1000000 + 999999, std::max(when * 1000000, now)));
+}
+
+bool MessageQueue::enqueueMessageNanos(const sp<Message>& message, uint64_t when) {
     if (message->target == nullptr) {
         throw IllegalArgumentException("Message must have a target");
     }
 
+    // Other threads touch the references of queued messages.
+    if (message->isThreadConfined()) {
+        message->setThreadConfined(false);
+    }
+
+    if ((mFlags & FLAG_LOCK_FREE_ENQUEUE) && when != 0 && when <= SystemClock::uptimeNanos()) {
+        return enqueuePendingMessage(message, when);
+    }
+
     AutoLock autoLock(mLock);
 
     if (message->isInUse()) {
@@ -84,23 +123,100 @@ bool MessageQueue::enqueueMessage(const sp<Message>& message, uint64_t when) {
     }
 
     message->markInUse();
+    insertMessage(message, when);
+    mCondition->signal();
+    return true;
+}
+
+bool MessageQueue::enqueuePendingMessage(const sp<Message>& message, uint64_t when) {
+    if (message->isInUse()) {
+        throw IllegalStateException("Message is already in use");
+    }
+
+    if (mQuitting.load(std::memory_order_acquire)) {
+        Log::w(TAG, "%p is sending a message to a Handler on a dead thread", message->target.getPointer());
+        message->recycle();
+        return false;
+    }
+
+    message->markInUse();
+    message->when = when;
+
+    // The pending messages list owns a strong reference to each message until it has been drained.
+    Message* pendingMessage = message.getPointer();
+    pendingMessage->incStrongReference(this);
+    Message* headMessage = mPendingMessages.load(std::memory_order_relaxed);
+    do {
+        pendingMessage->nextPendingMessage = headMessage;
+    } while (!mPendingMessages.compare_exchange_weak(headMessage, pendingMessage, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    // Only take the lock if the Looper thread is (about to be) waiting for new messages.
+    if (mBlocked.load(std::memory_order_seq_cst)) {
+        AutoLock autoLock(mLock);
+        mCondition->signal();
+    }
+    return true;
+}
+
+void MessageQueue::drainPendingMessages() {
+    if (mPendingMessages.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    Message* message = mPendingMessages.exchange(nullptr, std::memory_order_acquire);
+
+    // Restore FIFO order.
+    Message* prevMessage = nullptr;
+    while (message != nullptr) {
+        Message* nextMessage = message->nextPendingMessage;
+        message->nextPendingMessage = prevMessage;
+        prevMessage = message;
+        message = nextMessage;
+    }
+
+    message = prevMessage;
+    while (message != nullptr) {
+        Message* nextMessage = message->nextPendingMessage;
+        message->nextPendingMessage = nullptr;
+        insertMessage(message, message->when);
+        message->decStrongReference(this);
+        message = nextMessage;
+    }
+}
+
+void MessageQueue::insertMessage(const sp<Message>& message, uint64_t when) {
     message->when = when;
+    const int32_t priority = (message->priority != Message::PRIORITY_DEFAULT) ? message->priority : message->target->getPriority();
+    message->lane = 2 * priority + (message->isAsynchronous() ? 1 : 0);
+    message->sequenceNumber = mSequenceNumber++;
+    mMessageCount++;
+    if (mFlags & FLAG_MESSAGE_INDEX) {
+        indexMessage(message.getPointer());
+    }
+
+    Lane& lane = mLanes[message->lane];
+    if (mFlags & FLAG_TIMER_HEAP) {
+        message->heapIndex = lane.messageHeap.size();
+        lane.messageHeap.push_back(message);
+        siftUp(lane.messageHeap, message->heapIndex);
+        return;
+    }
 
-    if (mHeadMessage == nullptr || when == 0 || when < mHeadMessage->when) {
-        sp<Message> oldHeadMessage = mHeadMessage;
-        mHeadMessage = message;
+    if (lane.headMessage == nullptr || when == 0 || when < lane.headMessage->when) {
+        sp<Message> oldHeadMessage = lane.headMessage;
+        lane.headMessage = message;
         if (oldHeadMessage != nullptr) {
-            oldHeadMessage->prevMessage = mHeadMessage;
+            oldHeadMessage->prevMessage = lane.headMessage;
         } else {
-            mTailMessage = mHeadMessage;
+            lane.tailMessage = lane.headMessage;
         }
-        mHeadMessage->nextMessage = oldHeadMessage;
-    } else if (when >= mTailMessage->when) {
-        message->prevMessage = mTailMessage;
-        mTailMessage->nextMessage = message;
-        mTailMessage = message;
+        lane.headMessage->nextMessage = oldHeadMessage;
+    } else if (when >= lane.tailMessage->when) {
+        message->prevMessage = lane.tailMessage;
+        lane.tailMessage->nextMessage = message;
+        lane.tailMessage = message;
     } else {
-        sp<Message> curMessage = mTailMessage;
+        sp<Message> curMessage = lane.tailMessage;
         sp<Message> nextMessage;
         for (;;) {
             nextMessage = curMessage;
@@ -114,117 +230,350 @@ bool MessageQueue::enqueueMessage(const sp<Message>& message, uint64_t when) {
         nextMessage->prevMessage = message;
         curMessage->nextMessage = message;
     }
-    mCondition->signal();
-    return true;
 }
 
-sp<Message> MessageQueue::dequeueMessage() {
+Message* MessageQueue::peekMessage(uint64_t now) const {
+    const SyncBarrier* barrier = mSyncBarriers.empty() ? nullptr : &mSyncBarriers.front();
+    Message* dueMessage = nullptr;
+    Message* agedMessage = nullptr;
+    Message* nextMessage = nullptr;
+    for (size_t i = 0; i < LANE_COUNT; i += 2) {
+        Message* messages[2];
+        for (size_t j = 0; j < 2; j++) {
+            const Lane& lane = mLanes[i + j];
+            if (mFlags & FLAG_TIMER_HEAP) {
+                messages[j] = lane.messageHeap.empty() ? nullptr : lane.messageHeap[0].getPointer();
+            } else {
+                messages[j] = lane.headMessage.getPointer();
+            }
+        }
+        // Synchronous messages behind the first barrier are stalled.
+        Message* message = messages[0];
+        if (message != nullptr && barrier != nullptr && isBehind(message, *barrier)) {
+            message = nullptr;
+        }
+        if (messages[1] != nullptr && (message == nullptr || isBefore(messages[1], message))) {
+            message = messages[1];
+        }
+        if (message == nullptr) {
+            continue;
+        }
+
+        if (message->when <= now) {
+            if (dueMessage == nullptr) {
+                dueMessage = message;
+            } else if (message->when != 0 && now - message->when >= mAgingThreshold &&
+                    (agedMessage == nullptr || message->when < agedMessage->when)) {
+                agedMessage = message;
+            }
+        } else if (nextMessage == nullptr || message->when < nextMessage->when) {
+            nextMessage = message;
+        }
+    }
+
+    // Due messages of higher lanes go first, unless a lower lane has been starved for too long.
+    if (agedMessage != nullptr && agedMessage->when < dueMessage->when) {
+        return agedMessage;
+    }
+    return (dueMessage != nullptr) ? dueMessage : nextMessage;
+}
+
+void MessageQueue::removeMessage(const sp<Message>& message) {
+    mMessageCount--;
+    if (mFlags & FLAG_MESSAGE_INDEX) {
+        unindexMessage(message.getPointer());
+    }
+
+    Lane& lane = mLanes[message->lane];
+    if (mFlags & FLAG_TIMER_HEAP) {
+        std::vector<sp<Message>>& messageHeap = lane.messageHeap;
+        const size_t index = message->heapIndex;
+        const size_t lastIndex = messageHeap.size() - 1;
+        if (index != lastIndex) {
+            swapMessages(messageHeap, index, lastIndex);
+        }
+        messageHeap.pop_back();
+        if (index != lastIndex) {
+            siftDown(messageHeap, index);
+            siftUp(messageHeap, index);
+        }
+        message->heapIndex = 0;
+        return;
+    }
+
+    sp<Message> prevMessage = message->prevMessage;
+    sp<Message> nextMessage = message->nextMessage;
+    if (prevMessage != nullptr) {
+        prevMessage->nextMessage = nextMessage;
+    } else {
+        lane.headMessage = nextMessage;
+    }
+    if (nextMessage != nullptr) {
+        nextMessage->prevMessage = prevMessage;
+    } else {
+        lane.tailMessage = prevMessage;
+    }
+    message->prevMessage = nullptr;
+    message->nextMessage = nullptr;
+}
+
+void MessageQueue::recycleMessages() {
+    mMessageCount = 0;
+    mMessageIndex.clear();
+
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        Lane& lane = mLanes[i];
+        for (size_t j = 0; j < lane.messageHeap.size(); j++) {
+            lane.messageHeap[j]->recycle();
+        }
+        lane.messageHeap.clear();
+
+        sp<Message> curMessage = lane.headMessage;
+        while (curMessage != nullptr) {
+            sp<Message> nextMessage = curMessage->nextMessage;
+            curMessage->recycle();
+            curMessage = nextMessage;
+        }
+        lane.headMessage = nullptr;
+        lane.tailMessage = nullptr;
+    }
+}
+
+bool MessageQueue::isBefore(const Message* message, const Message* otherMessage) {
+    if (message->when != otherMessage->when) {
+        return message->when < otherMessage->when;
+    }
+    // Like the sorted list, messages for the front of the queue (when == 0) are LIFO, all others FIFO.
+    if (message->when == 0) {
+        return message->sequenceNumber > otherMessage->sequenceNumber;
+    }
+    return message->sequenceNumber < otherMessage->sequenceNumber;
+}
+
+bool MessageQueue::isBehind(const Message* message, const SyncBarrier& barrier) {
+    if (message->when != barrier.when) {
+        return message->when > barrier.when;
+    }
+    return message->sequenceNumber > barrier.sequenceNumber;
+}
+
+void MessageQueue::siftUp(std::vector<sp<Message>>& messageHeap, size_t index) {
+    while (index > 0) {
+        const size_t parentIndex = (index - 1) / 2;
+        if (!isBefore(messageHeap[index].getPointer(), messageHeap[parentIndex].getPointer())) {
+            break;
+        }
+        swapMessages(messageHeap, index, parentIndex);
+        index = parentIndex;
+    }
+}
+
+void MessageQueue::siftDown(std::vector<sp<Message>>& messageHeap, size_t index) {
+    const size_t size = messageHeap.size();
     for (;;) {
-        AutoLock autoLock(mLock);
-        if (mQuitting) {
-            return nullptr;
+        const size_t leftChildIndex = 2 * index + 1;
+        const size_t rightChildIndex = leftChildIndex + 1;
+        size_t minIndex = index;
+        if (leftChildIndex < size && isBefore(messageHeap[leftChildIndex].getPointer(), messageHeap[minIndex].getPointer())) {
+            minIndex = leftChildIndex;
+        }
+        if (rightChildIndex < size && isBefore(messageHeap[rightChildIndex].getPointer(), messageHeap[minIndex].getPointer())) {
+            minIndex = rightChildIndex;
         }
+        if (minIndex == index) {
+            break;
+        }
+        swapMessages(messageHeap, index, minIndex);
+        index = minIndex;
+    }
+}
 
-        const uint64_t now = SystemClock::uptimeMillis();
-        sp<Message> message = mHeadMessage;
+void MessageQueue::swapMessages(std::vector<sp<Message>>& messageHeap, size_t index, size_t otherIndex) {
+    // Moving sp<Message> objects avoids reference counting.
+    std::swap(messageHeap[index], messageHeap[otherIndex]);
+    messageHeap[index]->heapIndex = index;
+    messageHeap[otherIndex]->heapIndex = otherIndex;
+}
 
-        if (message != nullptr) {
-            if (now < message->when) {
-                mCondition->await(Math::min(message->when - now, (uint64_t) Integer::MAX_VALUE));
-            } else {
-                mHeadMessage = message->nextMessage;
-                if (mHeadMessage != nullptr) {
-                    mHeadMessage->prevMessage = nullptr;
-                } else {
-                    mTailMessage = nullptr;
+sp<Message> MessageQueue::dequeueMessage() {
+    int32_t pendingIdleHandlerCount = -1;
+    std::vector<sp<IdleHandler>> idleHandlers;
+    for (;;) {
+        {
+            AutoLock autoLock(mLock);
+            if (mQuitting) {
+                return nullptr;
+            }
+
+            drainPendingMessages();
+
+            const uint64_t now = SystemClock::uptimeNanos();
+            sp<Message> message = peekMessage(now);
+
+            if (message != nullptr && now >= message->when) {
+                if (isInstrumentationEnabled()) {
+                    mStats->recordQueueDepth(mMessageCount);
                 }
-                message->prevMessage = nullptr;
-                message->nextMessage = nullptr;
+                removeMessage(message);
                 return message;
             }
+
+            if (!getIdleHandlers(pendingIdleHandlerCount, idleHandlers)) {
+                awaitMessage(message, now);
+                continue;
+            }
+        }
+
+        runIdleHandlers(idleHandlers);
+        pendingIdleHandlerCount = 0;
+    }
+}
+
+const std::vector<sp<Message>>* MessageQueue::dequeueMessages() {
+    int32_t pendingIdleHandlerCount = -1;
+    std::vector<sp<IdleHandler>> idleHandlers;
+    for (;;) {
+        {
+            AutoLock autoLock(mLock);
+            Message::recycle(mBatchMessages);
+            if (mQuitting) {
+                return nullptr;
+            }
+
+            drainPendingMessages();
+
+            const uint64_t now = SystemClock::uptimeNanos();
+            sp<Message> message = peekMessage(now);
+
+            if (message != nullptr && now >= message->when && isInstrumentationEnabled()) {
+                mStats->recordQueueDepth(mMessageCount);
+            }
+            while (message != nullptr && now >= message->when && mBatchMessages.size() < MAX_BATCH_SIZE) {
+                removeMessage(message);
+                message->dispatchState.store(Message::DISPATCH_STATE_PENDING, std::memory_order_relaxed);
+                mBatchMessages.push_back(std::move(message));
+                message = peekMessage(now);
+            }
+            if (!mBatchMessages.empty()) {
+                return &mBatchMessages;
+            }
+
+            if (!getIdleHandlers(pendingIdleHandlerCount, idleHandlers)) {
+                awaitMessage(message, now);
+                continue;
+            }
+        }
+
+        runIdleHandlers(idleHandlers);
+        pendingIdleHandlerCount = 0;
+    }
+}
+
+void MessageQueue::awaitMessage(const sp<Message>& message, uint64_t now) {
+    mBlocked.store(true, std::memory_order_seq_cst);
+    if (mPendingMessages.load(std::memory_order_seq_cst) == nullptr) {
+        if (message != nullptr) {
+            mCondition->awaitNanos(Math::min(message->when - now, (uint64_t) Integer::MAX_VALUE * 1000000));
         } else {
             mCondition->await();
         }
     }
+    mBlocked.store(false, std::memory_order_relaxed);
 }
 
-bool MessageQueue::hasMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object) {
-    if (handler == nullptr) {
+bool MessageQueue::getIdleHandlers(int32_t& pendingIdleHandlerCount, std::vector<sp<IdleHandler>>& idleHandlers) {
+    // Idle handlers only run the first time the queue becomes idle during a dequeue call.
+    if (pendingIdleHandlerCount < 0) {
+        pendingIdleHandlerCount = (int32_t) mIdleHandlers.size();
+    }
+    if (pendingIdleHandlerCount <= 0) {
         return false;
     }
+    idleHandlers = mIdleHandlers;
+    return true;
+}
+
+void MessageQueue::runIdleHandlers(const std::vector<sp<IdleHandler>>& idleHandlers) {
+    for (size_t i = 0; i < idleHandlers.size(); i++) {
+        if (!idleHandlers[i]->queueIdle()) {
+            removeIdleHandler(idleHandlers[i]);
+        }
+    }
+}
+
+int32_t MessageQueue::postSyncBarrier() {
+    AutoLock autoLock(mLock);
+    // Enqueue a new sync barrier token. Messages that have already been enqueued for the current
+    // time are not affected, later ones are stalled.
+    drainPendingMessages();
+    const int32_t token = mNextBarrierToken++;
+    mSyncBarriers.push_back({ token, SystemClock::uptimeNanos(), mSequenceNumber++ });
+    return token;
+}
 
+void MessageQueue::removeSyncBarrier(int32_t token) {
     AutoLock autoLock(mLock);
-    sp<Message> curMessage = mHeadMessage;
-    while (curMessage != nullptr) {
-        if (curMessage->target == handler && curMessage->what == what && (object == nullptr || curMessage->obj == object)) {
-            return true;
+    for (auto itr = mSyncBarriers.begin(); itr != mSyncBarriers.end(); ++itr) {
+        if (itr->token == token) {
+            const bool needWake = (itr == mSyncBarriers.begin());
+            mSyncBarriers.erase(itr);
+            if (needWake && !mQuitting) {
+                mCondition->signal();
+            }
+            return;
         }
-        curMessage = curMessage->nextMessage;
     }
-    return false;
+    throw IllegalStateException("The specified message queue synchronization barrier token has not been posted or has already been removed");
 }
 
-bool MessageQueue::hasMessages(const sp<Handler>& handler, const sp<Runnable>& runnable, const sp<Object>& object) {
+void MessageQueue::addIdleHandler(const sp<IdleHandler>& handler) {
     if (handler == nullptr) {
-        return false;
+        throw NullPointerException("Can't add a null IdleHandler");
     }
+    AutoLock autoLock(mLock);
+    mIdleHandlers.push_back(handler);
+}
 
+void MessageQueue::removeIdleHandler(const sp<IdleHandler>& handler) {
     AutoLock autoLock(mLock);
-    sp<Message> curMessage = mHeadMessage;
-    while (curMessage != nullptr) {
-        if (curMessage->target == handler && curMessage->callback == runnable && (object == nullptr || curMessage->obj == object)) {
-            return true;
-        }
-        curMessage = curMessage->nextMessage;
+    auto itr = std::find(mIdleHandlers.begin(), mIdleHandlers.end(), handler);
+    if (itr != mIdleHandlers.end()) {
+        mIdleHandlers.erase(itr);
     }
-    return false;
 }
 
-bool MessageQueue::removeMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object) {
+bool MessageQueue::hasMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object) {
     if (handler == nullptr) {
         return false;
     }
 
-    bool foundMessage = false;
+    return hasMessages({ handler.getPointer(), (uintptr_t) what, INDEX_BY_WHAT }, [&] (const Message* message) {
+        return message->target == handler && message->what == what && (object == nullptr || message->obj == object);
+    });
+}
 
-    AutoLock autoLock(mLock);
-    sp<Message> curMessage = mHeadMessage;
-
-    // Remove all matching messages at the front of the message queue.
-    while (curMessage != nullptr && curMessage->target == handler && curMessage->what == what && (object == nullptr || curMessage->obj == object)) {
-        foundMessage = true;
-        sp<Message> nextMessage = curMessage->nextMessage;
-        mHeadMessage = nextMessage;
-        if (mHeadMessage != nullptr) {
-            mHeadMessage->prevMessage = nullptr;
-        } else {
-            mTailMessage = nullptr;
-        }
-        curMessage->recycle();
-        curMessage = nextMessage;
+bool MessageQueue::hasMessages(const sp<Handler>& handler, const sp<Runnable>& runnable, const sp<Object>& object) {
+    if (handler == nullptr) {
+        return false;
     }
 
-    // Remove all matching messages after the front of the message queue.
-    while (curMessage != nullptr) {
-        sp<Message> nextMessage = curMessage->nextMessage;
-        if (nextMessage != nullptr) {
-            if (nextMessage->target == handler && nextMessage->what == what && (object == nullptr || nextMessage->obj == object)) {
-                foundMessage = true;
-                sp<Message> nextButOneMessage = nextMessage->nextMessage;
-                if (nextButOneMessage != nullptr) {
-                    nextButOneMessage->prevMessage = curMessage;
-                } else {
-                    mTailMessage = curMessage;
-                }
-                curMessage->nextMessage = nextButOneMessage;
-                nextMessage->recycle();
-                continue;
-            }
-        }
-        curMessage = nextMessage;
+    // Messages without a callback are only indexed by their target.
+    const IndexKey key = (runnable != nullptr) ?
+            IndexKey{ handler.getPointer(), (uintptr_t) runnable.getPointer(), INDEX_BY_CALLBACK } :
+            IndexKey{ handler.getPointer(), 0, INDEX_BY_HANDLER };
+    return hasMessages(key, [&] (const Message* message) {
+        return message->target == handler && message->callback == runnable && (object == nullptr || message->obj == object);
+    });
+}
+
+bool MessageQueue::removeMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object) {
+    if (handler == nullptr) {
+        return false;
     }
 
-    return foundMessage;
+    return removeMessages({ handler.getPointer(), (uintptr_t) what, INDEX_BY_WHAT }, [&] (const Message* message) {
+        return message->target == handler && message->what == what && (object == nullptr || message->obj == object);
+    });
 }
 
 bool MessageQueue::removeCallbacks(const sp<Handler>& handler, const sp<Runnable>& runnable, const sp<Object>& object) {
@@ -232,93 +581,214 @@ bool MessageQueue::removeCallbacks(const sp<Handler>& handler, const sp<Runnable
         return false;
     }
 
-    bool foundMessage = false;
+    return removeMessages({ handler.getPointer(), (uintptr_t) runnable.getPointer(), INDEX_BY_CALLBACK }, [&] (const Message* message) {
+        return message->target == handler && message->callback == runnable && (object == nullptr || message->obj == object);
+    });
+}
 
+bool MessageQueue::removeCallbacksAndMessages(const sp<Handler>& handler, const sp<Object>& object) {
+    if (handler == nullptr) {
+        return false;
+    }
+
+    return removeMessages({ handler.getPointer(), 0, INDEX_BY_HANDLER }, [&] (const Message* message) {
+        return message->target == handler && (object == nullptr || message->obj == object);
+    });
+}
+
+void MessageQueue::setAgingThreshold(uint64_t thresholdNanos) {
     AutoLock autoLock(mLock);
-    sp<Message> curMessage = mHeadMessage;
-
-    // Remove all matching messages at the front of the message queue.
-    while (curMessage != nullptr && curMessage->target == handler && curMessage->callback == runnable && (object == nullptr || curMessage->obj == object)) {
-        foundMessage = true;
-        sp<Message> nextMessage = curMessage->nextMessage;
-        mHeadMessage = nextMessage;
-        if (mHeadMessage != nullptr) {
-            mHeadMessage->prevMessage = nullptr;
-        } else {
-            mTailMessage = nullptr;
+    mAgingThreshold = thresholdNanos;
+}
+
+size_t MessageQueue::getMessageCount() {
+    AutoLock autoLock(mLock);
+    drainPendingMessages();
+    return mMessageCount;
+}
+
+uint64_t MessageQueue::getIndexLookupCount() {
+    AutoLock autoLock(mLock);
+    return mIndexLookupCount;
+}
+
+uint64_t MessageQueue::getIndexHitCount() {
+    AutoLock autoLock(mLock);
+    return mIndexHitCount;
+}
+
+template<typename Predicate>
+bool MessageQueue::hasMessages(const IndexKey& key, Predicate predicate) {
+    AutoLock autoLock(mLock);
+    drainPendingMessages();
+
+    if (matchBatchMessages(predicate, false)) {
+        return true;
+    }
+
+    if (mFlags & FLAG_MESSAGE_INDEX) {
+        Message* curMessage = lookupMessages(key);
+        while (curMessage != nullptr) {
+            if (predicate(curMessage)) {
+                return true;
+            }
+            curMessage = curMessage->nextIndexedMessages[key.index];
         }
-        curMessage->recycle();
-        curMessage = nextMessage;
+        return false;
     }
 
-    // Remove all matching messages after the front of the message queue.
-    while (curMessage != nullptr) {
-        sp<Message> nextMessage = curMessage->nextMessage;
-        if (nextMessage != nullptr) {
-            if (nextMessage->target == handler && nextMessage->callback == runnable && (object == nullptr || nextMessage->obj == object)) {
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        const Lane& lane = mLanes[i];
+        for (size_t j = 0; j < lane.messageHeap.size(); j++) {
+            if (predicate(lane.messageHeap[j].getPointer())) {
+                return true;
+            }
+        }
+
+        Message* curMessage = lane.headMessage.getPointer();
+        while (curMessage != nullptr) {
+            if (predicate(curMessage)) {
+                return true;
+            }
+            curMessage = curMessage->nextMessage.getPointer();
+        }
+    }
+    return false;
+}
+
+template<typename Predicate>
+bool MessageQueue::removeMessages(const IndexKey& key, Predicate predicate) {
+    AutoLock autoLock(mLock);
+    drainPendingMessages();
+
+    bool foundMessage = matchBatchMessages(predicate, true);
+
+    if (mFlags & FLAG_MESSAGE_INDEX) {
+        Message* curMessage = lookupMessages(key);
+        while (curMessage != nullptr) {
+            Message* nextMessage = curMessage->nextIndexedMessages[key.index];
+            if (predicate(curMessage)) {
                 foundMessage = true;
-                sp<Message> nextButOneMessage = nextMessage->nextMessage;
-                if (nextButOneMessage != nullptr) {
-                    nextButOneMessage->prevMessage = curMessage;
-                } else {
-                    mTailMessage = curMessage;
-                }
-                curMessage->nextMessage = nextButOneMessage;
-                nextMessage->recycle();
-                continue;
+                sp<Message> message = curMessage;
+                removeMessage(message);
+                message->recycle();
             }
+            curMessage = nextMessage;
         }
-        curMessage = nextMessage;
+        return foundMessage;
     }
 
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        const Lane& lane = mLanes[i];
+        // Removing a message reorders the heap, so collect all matching messages first.
+        std::vector<sp<Message>> messages;
+        for (size_t j = 0; j < lane.messageHeap.size(); j++) {
+            if (predicate(lane.messageHeap[j].getPointer())) {
+                messages.push_back(lane.messageHeap[j]);
+            }
+        }
+        for (size_t j = 0; j < messages.size(); j++) {
+            foundMessage = true;
+            removeMessage(messages[j]);
+            messages[j]->recycle();
+        }
+
+        sp<Message> curMessage = lane.headMessage;
+        while (curMessage != nullptr) {
+            sp<Message> nextMessage = curMessage->nextMessage;
+            if (predicate(curMessage.getPointer())) {
+                foundMessage = true;
+                removeMessage(curMessage);
+                curMessage->recycle();
+            }
+            curMessage = nextMessage;
+        }
+    }
     return foundMessage;
 }
 
-bool MessageQueue::removeCallbacksAndMessages(const sp<Handler>& handler, const sp<Object>& object) {
-    if (handler == nullptr) {
-        return false;
+template<typename Predicate>
+bool MessageQueue::matchBatchMessages(Predicate predicate, bool cancel) {
+    bool foundMessage = false;
+    for (size_t i = 0; i < mBatchMessages.size(); i++) {
+        Message* message = mBatchMessages[i].getPointer();
+        // Keep the Looper from dispatching the message while matching it.
+        int32_t state = Message::DISPATCH_STATE_PENDING;
+        if (!message->dispatchState.compare_exchange_strong(state, Message::DISPATCH_STATE_MATCHING, std::memory_order_acquire)) {
+            continue;
+        }
+        const bool match = predicate(message);
+        message->dispatchState.store((match && cancel) ? Message::DISPATCH_STATE_CANCELED : Message::DISPATCH_STATE_PENDING, std::memory_order_release);
+        if (match) {
+            foundMessage = true;
+            if (!cancel) {
+                break;
+            }
+        }
     }
+    return foundMessage;
+}
 
-    bool foundMessage = false;
+MessageQueue::IndexKey MessageQueue::getIndexKey(int32_t index, const Message* message) {
+    switch (index) {
+    case INDEX_BY_WHAT:
+        return { message->target.getPointer(), (uintptr_t) message->what, INDEX_BY_WHAT };
+    case INDEX_BY_CALLBACK:
+        return { message->target.getPointer(), (uintptr_t) message->callback.getPointer(), INDEX_BY_CALLBACK };
+    default:
+        return { message->target.getPointer(), 0, INDEX_BY_HANDLER };
+    }
+}
 
-    AutoLock autoLock(mLock);
-    sp<Message> curMessage = mHeadMessage;
-
-    // Remove all matching messages at the front of the message queue.
-    while (curMessage != nullptr && curMessage->target == handler && (object == nullptr || curMessage->obj == object)) {
-        foundMessage = true;
-        sp<Message> nextMessage = curMessage->nextMessage;
-        mHeadMessage = nextMessage;
-        if (mHeadMessage != nullptr) {
-            mHeadMessage->prevMessage = nullptr;
-        } else {
-            mTailMessage = nullptr;
+void MessageQueue::indexMessage(Message* message) {
+    for (int32_t index = 0; index < INDEX_COUNT; index++) {
+        if (index == INDEX_BY_CALLBACK && message->callback == nullptr) {
+            continue;
+        }
+        // Prepend the message to the chain of its index key.
+        Message*& headMessage = mMessageIndex[getIndexKey(index, message)];
+        message->prevIndexedMessages[index] = nullptr;
+        message->nextIndexedMessages[index] = headMessage;
+        if (headMessage != nullptr) {
+            headMessage->prevIndexedMessages[index] = message;
         }
-        curMessage->recycle();
-        curMessage = nextMessage;
+        headMessage = message;
     }
+}
 
-    // Remove all matching messages after the front of the message queue.
-    while (curMessage != nullptr) {
-        sp<Message> nextMessage = curMessage->nextMessage;
-        if (nextMessage != nullptr) {
-            if (nextMessage->target == handler && (object == nullptr || nextMessage->obj == object)) {
-                foundMessage = true;
-                sp<Message> nextButOneMessage = nextMessage->nextMessage;
-                if (nextButOneMessage != nullptr) {
-                    nextButOneMessage->prevMessage = curMessage;
-                } else {
-                    mTailMessage = curMessage;
-                }
-                curMessage->nextMessage = nextButOneMessage;
-                nextMessage->recycle();
-                continue;
+void MessageQueue::unindexMessage(Message* message) {
+    for (int32_t index = 0; index < INDEX_COUNT; index++) {
+        if (index == INDEX_BY_CALLBACK && message->callback == nullptr) {
+            continue;
+        }
+        Message* prevMessage = message->prevIndexedMessages[index];
+        Message* nextMessage = message->nextIndexedMessages[index];
+        if (prevMessage != nullptr) {
+            prevMessage->nextIndexedMessages[index] = nextMessage;
+        } else {
+            const IndexKey key = getIndexKey(index, message);
+            if (nextMessage != nullptr) {
+                mMessageIndex[key] = nextMessage;
+            } else {
+                mMessageIndex.erase(key);
             }
         }
-        curMessage = nextMessage;
+        if (nextMessage != nullptr) {
+            nextMessage->prevIndexedMessages[index] = prevMessage;
+        }
+        message->prevIndexedMessages[index] = nullptr;
+        message->nextIndexedMessages[index] = nullptr;
     }
+}
 
-    return foundMessage;
+Message* MessageQueue::lookupMessages(const IndexKey& key) {
+    mIndexLookupCount++;
+    auto itr = mMessageIndex.find(key);
+    if (itr == mMessageIndex.end()) {
+        return nullptr;
+    }
+    mIndexHitCount++;
+    return itr->second;
 }
 
 } /* namespace mindroid */
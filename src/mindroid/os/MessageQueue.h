@@ -19,7 +19,11 @@
 #define MINDROID_OS_MESSAGEQUEUE_H_
 
 #include <mindroid/lang/Object.h>
+#include <mindroid/os/LooperStats.h>
 #include <mindroid/util/concurrent/locks/ReentrantLock.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 
 namespace mindroid {
 
@@ -35,33 +39,321 @@ class Runnable;
  * <p>
  * You can retrieve the MessageQueue for the current thread with {@link Looper#myQueue()
  * Looper.myQueue()}.
+ *
+ * <p>
+ * The behavior of a MessageQueue can be tuned by passing a combination of FLAG_* values to
+ * {@link Looper#prepare(bool, uint32_t) Looper.prepare()}.
  */
 class MessageQueue final :
         public Object {
 public:
+    /**
+     * Messages that are due immediately bypass the queue lock and are pushed onto a lock-free
+     * multi-producer single-consumer list. The Looper thread drains this list in batches into the
+     * time-ordered message list. Messages of the same producer are still dispatched in FIFO order.
+     * Use this mode for Loopers that are fed by many producer threads.
+     */
+    static const uint32_t FLAG_LOCK_FREE_ENQUEUE = 1 << 0;
+
+    /**
+     * Keeps pending messages in a binary min-heap ordered by delivery time instead of a sorted
+     * linked list. Enqueuing and dequeuing a message costs O(log n) instead of O(n), which pays off
+     * for Loopers with many pending timeouts.
+     */
+    static const uint32_t FLAG_TIMER_HEAP = 1 << 1;
+
+    /**
+     * Maintains a secondary index of pending messages keyed by their target Handler and their
+     * <em>what</em> value or callback. hasMessages(), removeMessages(), removeCallbacks() and
+     * removeCallbacksAndMessages() then only visit the matching messages instead of scanning the
+     * whole queue.
+     */
+    static const uint32_t FLAG_MESSAGE_INDEX = 1 << 2;
+
+    /**
+     * Lets the {@link Looper} take all messages that are due (up to MAX_BATCH_SIZE) with a single
+     * acquisition of the queue lock and return them to the message pool in bulk once they have
+     * been dispatched. Messages of a batch that have not been dispatched yet are still visible to
+     * hasMessages() and can still be removed by removeMessages() and removeCallbacks().
+     */
+    static const uint32_t FLAG_BATCHED_DISPATCH = 1 << 3;
+
+    /**
+     * Enables the collection of {@link LooperStats} right from the start (see
+     * setInstrumentationEnabled()).
+     */
+    static const uint32_t FLAG_INSTRUMENTATION = 1 << 4;
+
+    /**
+     * Lets the {@link Looper} switch dequeued messages that are no longer referenced by their
+     * senders to plain, non-atomic reference counting (see {@link Object#setThreadConfined}). The
+     * messages stay confined to the Looper thread while they are dispatched, recycled into its
+     * message pool cache and obtained from there again until they are sent to a MessageQueue.
+     * Handlers of such a Looper must not hand dispatched messages over to other threads.
+     * Builds without NDEBUG check the owner thread of each confined message, which moves its
+     * reference count out of the object into an allocated WeakReferenceImpl.
+     */
+    static const uint32_t FLAG_THREAD_CONFINED_MESSAGES = 1 << 5;
+
+    /**
+     * Gives the {@link Looper} thread its own {@link PoolAllocator} arena for all objects that it
+     * creates (see {@link Allocator#setThreadAllocator}). The objects of the Looper thread then stay
+     * close together in memory and do not contend with other threads for the default allocator.
+     * The arena is released with the Looper once all its objects have been freed.
+     */
+    static const uint32_t FLAG_ALLOCATOR_ARENA = 1 << 6;
+
+    /**
+     * Maximum number of messages that the Looper takes from the queue at once (see
+     * FLAG_BATCHED_DISPATCH).
+     */
+    static const size_t MAX_BATCH_SIZE = 64;
+
+    /**
+     * Callback interface for discovering when a thread is going to block waiting for more
+     * messages.
+     */
+    class IdleHandler :
+            public Object {
+    public:
+        /**
+         * Called when the message queue has run out of messages and will now wait for more.
+         * Return true to keep your idle handler active, false to have it removed. This may be
+         * called if there are still messages pending in the queue, but they are all scheduled to
+         * be dispatched after the current time.
+         */
+        virtual bool queueIdle() = 0;
+    };
+
     MessageQueue(bool quitAllowed);
+    MessageQueue(bool quitAllowed, uint32_t flags);
     virtual ~MessageQueue();
     MessageQueue(const MessageQueue&) = delete;
     MessageQueue& operator=(const MessageQueue&) = delete;
 
     bool quit();
     bool enqueueMessage(const sp<Message>& message, uint64_t when);
+    bool enqueueMessageNanos(const sp<Message>& message, uint64_t whenNanos);
     sp<Message> dequeueMessage();
+
+    /**
+     * Returns the next batch of due messages (see FLAG_BATCHED_DISPATCH). The batch is owned by
+     * the MessageQueue and remains valid until the next call of dequeueMessages(), which also
+     * recycles its messages. Returns nullptr if the MessageQueue is quitting.
+     */
+    const std::vector<sp<Message>>* dequeueMessages();
+
+    /**
+     * Posts a synchronization barrier to the Looper's message queue.
+     *
+     * <p>
+     * Message processing occurs as usual until the message queue encounters the synchronization
+     * barrier that has been posted. When the barrier is encountered, later synchronous messages
+     * in the queue are stalled (prevented from being executed) until the barrier is released by
+     * calling {@link #removeSyncBarrier} and specifying the token that identifies the
+     * synchronization barrier.
+     *
+     * <p>
+     * This method is used to immediately postpone execution of all subsequently posted
+     * synchronous messages until a condition is met that releases the barrier. Asynchronous
+     * messages (see {@link Message#isAsynchronous}) are exempt from the barrier and continue to be
+     * processed as usual.
+     *
+     * <p>
+     * This call must be always matched by a call to {@link #removeSyncBarrier} with the same
+     * token to ensure that the message queue resumes normal operation. Otherwise the application
+     * will probably hang!
+     *
+     * @return A token that uniquely identifies the barrier. This token must be passed to
+     * {@link #removeSyncBarrier} to release the barrier.
+     */
+    int32_t postSyncBarrier();
+
+    /**
+     * Removes a synchronization barrier.
+     *
+     * @param token The synchronization barrier token that was returned by {@link #postSyncBarrier}.
+     *
+     * @throws IllegalStateException if the barrier was not found.
+     */
+    void removeSyncBarrier(int32_t token);
+
+    /**
+     * Add a new {@link IdleHandler} to this message queue. This may be removed automatically for
+     * you by returning false from {@link IdleHandler#queueIdle IdleHandler.queueIdle()} when it is
+     * invoked, or explicitly removing it with {@link #removeIdleHandler}.
+     *
+     * <p>
+     * This method is safe to call from any thread.
+     *
+     * @param handler The IdleHandler to be added.
+     */
+    void addIdleHandler(const sp<IdleHandler>& handler);
+
+    /**
+     * Remove an {@link IdleHandler} from the queue that was previously added with
+     * {@link #addIdleHandler}. If the given object is not currently in the idle list, nothing is
+     * done.
+     *
+     * <p>
+     * This method is safe to call from any thread.
+     *
+     * @param handler The IdleHandler to be removed.
+     */
+    void removeIdleHandler(const sp<IdleHandler>& handler);
     bool hasMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object);
     bool hasMessages(const sp<Handler>& handler, const sp<Runnable>& runnable, const sp<Object>& object);
     bool removeMessages(const sp<Handler>& handler, int32_t what, const sp<Object>& object);
     bool removeCallbacks(const sp<Handler>& handler, const sp<Runnable>& runnable, const sp<Object>& object);
     bool removeCallbacksAndMessages(const sp<Handler>& handler, const sp<Object>& object);
 
+    uint32_t getFlags() const {
+        return mFlags;
+    }
+
+    /**
+     * Default aging threshold for the priority lanes.
+     */
+    static const uint64_t DEFAULT_AGING_THRESHOLD = 50000000;
+
+    /**
+     * Sets the time in nanoseconds after which an overdue message of a lower priority lane
+     * competes with the messages of higher lanes by delivery time only. This bounds how long
+     * {@link Handler#PRIORITY_LOW} messages can be starved by a flood of higher priority messages.
+     */
+    void setAgingThreshold(uint64_t thresholdNanos);
+
+    /**
+     * Enables or disables the collection of queue depth, dispatch latency and handling time
+     * statistics for this MessageQueue and its {@link Looper}. While disabled, the Looper only
+     * pays for a single relaxed atomic load per message.
+     *
+     * <p>
+     * This method is safe to call from any thread.
+     */
+    void setInstrumentationEnabled(bool enabled) {
+        mInstrumented.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isInstrumentationEnabled() const {
+        return mInstrumented.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the statistics that have been collected while instrumentation was enabled.
+     */
+    sp<LooperStats> getStats() const {
+        return mStats;
+    }
+
+    /**
+     * Returns the number of messages that are currently waiting in the queue.
+     */
+    size_t getMessageCount();
+
+    /**
+     * Returns how many lookups went through the message index (see FLAG_MESSAGE_INDEX).
+     */
+    uint64_t getIndexLookupCount();
+
+    /**
+     * Returns how many lookups through the message index found at least one matching message.
+     */
+    uint64_t getIndexHitCount();
+
 private:
     static const char* const TAG;
 
-    sp<Message> mHeadMessage;
-    sp<Message> mTailMessage;
+    enum {
+        INDEX_BY_HANDLER = 0,
+        INDEX_BY_WHAT = 1,
+        INDEX_BY_CALLBACK = 2,
+        INDEX_COUNT = 3
+    };
+
+    struct IndexKey {
+        const Handler* handler;
+        uintptr_t value;
+        int32_t index;
+
+        bool operator==(const IndexKey& other) const {
+            return handler == other.handler && value == other.value && index == other.index;
+        }
+    };
+
+    struct IndexKeyHash {
+        size_t operator()(const IndexKey& key) const {
+            return (reinterpret_cast<uintptr_t>(key.handler) * 31 + key.value) * 31 + key.index;
+        }
+    };
+
+    bool enqueuePendingMessage(const sp<Message>& message, uint64_t when);
+    void drainPendingMessages();
+    void insertMessage(const sp<Message>& message, uint64_t when);
+    Message* peekMessage(uint64_t now) const;
+    void removeMessage(const sp<Message>& message);
+    void recycleMessages();
+    void awaitMessage(const sp<Message>& message, uint64_t now);
+    bool getIdleHandlers(int32_t& pendingIdleHandlerCount, std::vector<sp<IdleHandler>>& idleHandlers);
+    void runIdleHandlers(const std::vector<sp<IdleHandler>>& idleHandlers);
+    template<typename Predicate> bool hasMessages(const IndexKey& key, Predicate predicate);
+    template<typename Predicate> bool removeMessages(const IndexKey& key, Predicate predicate);
+    template<typename Predicate> bool matchBatchMessages(Predicate predicate, bool cancel);
+
+    static IndexKey getIndexKey(int32_t index, const Message* message);
+    void indexMessage(Message* message);
+    void unindexMessage(Message* message);
+    Message* lookupMessages(const IndexKey& key);
+
+    static bool isBefore(const Message* message, const Message* otherMessage);
+    static void siftUp(std::vector<sp<Message>>& messageHeap, size_t index);
+    static void siftDown(std::vector<sp<Message>>& messageHeap, size_t index);
+    static void swapMessages(std::vector<sp<Message>>& messageHeap, size_t index, size_t otherIndex);
+
+    // Two lanes per Handler priority, the first for synchronous and the second for asynchronous
+    // messages (see Message::setAsynchronous()).
+    static const size_t LANE_COUNT = 6;
+
+    struct SyncBarrier {
+        int32_t token;
+        uint64_t when;
+        uint64_t sequenceNumber;
+    };
+
+    static bool isBehind(const Message* message, const SyncBarrier& barrier);
+
+    struct Lane {
+        sp<Message> headMessage;
+        sp<Message> tailMessage;
+        // Binary min-heap of pending messages (see FLAG_TIMER_HEAP).
+        std::vector<sp<Message>> messageHeap;
+    };
+
+    Lane mLanes[LANE_COUNT];
+    uint64_t mAgingThreshold;
+    // Sync barriers ordered by (when, sequenceNumber).
+    std::vector<SyncBarrier> mSyncBarriers;
+    int32_t mNextBarrierToken;
+    uint64_t mSequenceNumber;
+    size_t mMessageCount;
+    // Heads of the intrusive message chains per index key (see FLAG_MESSAGE_INDEX).
+    std::unordered_map<IndexKey, Message*, IndexKeyHash> mMessageIndex;
+    uint64_t mIndexLookupCount;
+    uint64_t mIndexHitCount;
+    // Dequeued messages that the Looper is dispatching (see FLAG_BATCHED_DISPATCH).
+    std::vector<sp<Message>> mBatchMessages;
+    std::vector<sp<IdleHandler>> mIdleHandlers;
     sp<ReentrantLock> mLock;
     sp<Condition> mCondition;
     const bool mQuitAllowed;
-    bool mQuitting;
+    const uint32_t mFlags;
+    std::atomic<bool> mQuitting;
+    // Lock-free LIFO list of immediate messages (see FLAG_LOCK_FREE_ENQUEUE).
+    std::atomic<Message*> mPendingMessages;
+    // Set by the Looper thread before waiting on mCondition.
+    std::atomic<bool> mBlocked;
+    std::atomic<bool> mInstrumented;
+    const sp<LooperStats> mStats;
 };
 
 } /* namespace mindroid */
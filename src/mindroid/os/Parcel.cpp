@@ -19,39 +19,154 @@
 #include <mindroid/os/RemoteException.h>
 #include <mindroid/lang/Math.h>
 #include <mindroid/lang/IllegalStateException.h>
-#include <mindroid/io/IOException.h>
+#include <mindroid/io/EOFException.h>
+#include <mindroid/lang/IndexOutOfBoundsException.h>
 #include <mindroid/net/URISyntaxException.h>
 #include <mindroid/runtime/system/Runtime.h>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
 namespace mindroid {
 
+const size_t Parcel::POOL_SIZE_CLASSES[POOL_SIZE_CLASS_COUNT] = { 64, 256, 1024, 4096, 16384 };
+
+struct ParcelPool {
+    std::mutex lock;
+    std::vector<sp<Parcel>> parcels[Parcel::POOL_SIZE_CLASS_COUNT];
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+};
+
+static ParcelPool& getParcelPool() {
+    // Never destroyed, Parcels may be recycled during static destruction.
+    static ParcelPool* sParcelPool = new ParcelPool();
+    return *sParcelPool;
+}
+
+// Values are stored in big-endian byte order like by DataOutputStream.
+static inline void storeShort(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t) (value >> 8);
+    data[1] = (uint8_t) value;
+}
+
+static inline void storeInt(uint8_t* data, uint32_t value) {
+    data[0] = (uint8_t) (value >> 24);
+    data[1] = (uint8_t) (value >> 16);
+    data[2] = (uint8_t) (value >> 8);
+    data[3] = (uint8_t) value;
+}
+
+static inline void storeLong(uint8_t* data, uint64_t value) {
+    storeInt(data, (uint32_t) (value >> 32));
+    storeInt(data + 4, (uint32_t) value);
+}
+
+static inline uint16_t loadShort(const uint8_t* data) {
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+static inline uint32_t loadInt(const uint8_t* data) {
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+static inline uint64_t loadLong(const uint8_t* data) {
+    return ((uint64_t) loadInt(data) << 32) | loadInt(data + 4);
+}
+
+void Parcel::OutputBuffer::grow(size_t size) {
+    sp<ByteArray> buffer = new ByteArray((mCount + size) * 2);
+    std::memcpy(buffer->c_arr(), mBuffer->c_arr(), mCount);
+    mBuffer = buffer;
+}
+
 Parcel::Parcel() {
-    mOutputStream = new ByteArrayOutputStream();
-    mDataOutputStream = new DataOutputStream(mOutputStream);
+    mOutputStream = new OutputBuffer();
 }
 
 Parcel::Parcel(size_t size) {
-    mOutputStream = new ByteArrayOutputStream(size);
-    mDataOutputStream = new DataOutputStream(mOutputStream);
+    mOutputStream = new OutputBuffer(size);
 }
 
 Parcel::Parcel(const sp<ByteArray>& buffer, size_t offset, size_t size) {
-    if (offset == 0 && size == buffer->size()) {
-        mOutputStream = new ByteArrayOutputStream(buffer);
-    } else {
-        mOutputStream = new ByteArrayOutputStream(size);
-        mOutputStream->write(buffer, offset, size);
+    if (offset > buffer->size() || buffer->size() - offset < size) {
+        throw IndexOutOfBoundsException();
     }
-    mDataOutputStream = new DataOutputStream(mOutputStream);
-    asInputStream();
+    mOutputStream = new OutputBuffer(buffer, offset + size);
+    mOffset = offset;
+    mBorrowed = true;
+    setInput();
 }
 
 sp<Parcel> Parcel::obtain() {
-    return new Parcel();
+    sp<Parcel> parcel = obtainFromPool(0);
+    return (parcel != nullptr) ? parcel : new Parcel();
 }
 
 sp<Parcel> Parcel::obtain(size_t size) {
-    return new Parcel(size);
+    sp<Parcel> parcel = obtainFromPool(size);
+    return (parcel != nullptr) ? parcel : new Parcel(size);
+}
+
+sp<Parcel> Parcel::obtainFromPool(size_t size) {
+    ParcelPool& pool = getParcelPool();
+    std::lock_guard<std::mutex> lock(pool.lock);
+    // Bucket i holds buffers from POOL_SIZE_CLASSES[i] up to the next size class, so only the
+    // bucket that size falls into needs a capacity check.
+    for (size_t i = 0; i < POOL_SIZE_CLASS_COUNT; i++) {
+        if (!pool.parcels[i].empty() && pool.parcels[i].back()->mOutputStream->getByteArray()->size() >= size) {
+            sp<Parcel> parcel = std::move(pool.parcels[i].back());
+            pool.parcels[i].pop_back();
+            parcel->mPooled = false;
+            pool.hitCount++;
+            return parcel;
+        }
+    }
+    pool.missCount++;
+    return nullptr;
+}
+
+void Parcel::recycle() {
+    mOutputStream->reset();
+    mOffset = 0;
+    mPosition = 0;
+    mInput = false;
+    mBorrowed = false;
+    mInputStream = nullptr;
+    mExtras = nullptr;
+
+    sp<ByteArray> buffer = mOutputStream->getByteArray();
+    const size_t capacity = buffer->size();
+    // The buffer must only be referenced by the output stream and the local reference, otherwise
+    // the next user of the Parcel would overwrite data that is still in use, e.g. by a Message
+    // that wraps a received buffer.
+    if (capacity < POOL_SIZE_CLASSES[0] || capacity > MAX_POOLED_CAPACITY || buffer->getStrongReferenceCount() > 2) {
+        return;
+    }
+    size_t sizeClass = POOL_SIZE_CLASS_COUNT - 1;
+    while (POOL_SIZE_CLASSES[sizeClass] > capacity) {
+        sizeClass--;
+    }
+    ParcelPool& pool = getParcelPool();
+    std::lock_guard<std::mutex> lock(pool.lock);
+    // A Parcel that is recycled twice must not be handed out twice.
+    if (!mPooled && pool.parcels[sizeClass].size() < MAX_POOL_SIZE) {
+        mPooled = true;
+        pool.parcels[sizeClass].push_back(this);
+    }
+}
+
+uint64_t Parcel::getPoolHitCount() {
+    ParcelPool& pool = getParcelPool();
+    std::lock_guard<std::mutex> lock(pool.lock);
+    return pool.hitCount;
+}
+
+uint64_t Parcel::getPoolMissCount() {
+    ParcelPool& pool = getParcelPool();
+    std::lock_guard<std::mutex> lock(pool.lock);
+    return pool.missCount;
 }
 
 sp<Parcel> Parcel::obtain(const sp<ByteArray>& buffer) {
@@ -70,83 +185,57 @@ sp<Parcel> Parcel::obtain(const sp<ByteArray>& buffer, size_t offset, size_t siz
 
 void Parcel::putBoolean(bool value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeBoolean(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    mOutputStream->reserve(1)[0] = value ? 1 : 0;
 }
 
 void Parcel::putByte(uint8_t value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeByte(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    mOutputStream->reserve(1)[0] = value;
 }
 
 void Parcel::putChar(char value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeChar(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    mOutputStream->reserve(1)[0] = (uint8_t) value;
 }
 
 void Parcel::putShort(int16_t value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeShort(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    storeShort(mOutputStream->reserve(2), (uint16_t) value);
 }
 
 void Parcel::putInt(int32_t value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeInt(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    storeInt(mOutputStream->reserve(4), (uint32_t) value);
 }
 
 void Parcel::putLong(int64_t value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeLong(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    storeLong(mOutputStream->reserve(8), (uint64_t) value);
 }
 
 void Parcel::putFloat(float value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeFloat(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    storeInt(mOutputStream->reserve(4), (uint32_t) Float::floatToIntBits(value));
 }
 
 void Parcel::putDouble(double value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeDouble(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    storeLong(mOutputStream->reserve(8), (uint64_t) Double::doubleToLongBits(value));
 }
 
 void Parcel::putString(const sp<String>& value) {
     checkOutput();
-    try {
-        mDataOutputStream->writeUTF(value);
-    } catch (const IOException& e) {
-        throw RemoteException(e);
+    if (value == nullptr) {
+        throw NullPointerException();
+    }
+    // Same encoding as DataOutputStream::writeUTF.
+    const size_t length = value->length();
+    if (length == 0) {
+        return;
     }
+    uint8_t* data = mOutputStream->reserve(2 + length);
+    storeShort(data, (uint16_t) length);
+    std::memcpy(data + 2, value->c_str(), length);
 }
 
 void Parcel::putBytes(const sp<ByteArray>& buffer) {
@@ -159,6 +248,30 @@ void Parcel::putBytes(const sp<ByteArray>& buffer, size_t offset, size_t size) {
     mOutputStream->write(buffer, offset, size);
 }
 
+void Parcel::putInts(const int32_t* values, size_t count) {
+    checkOutput();
+    uint8_t* data = mOutputStream->reserve(count * 4);
+    for (size_t i = 0; i < count; i++) {
+        storeInt(data + i * 4, (uint32_t) values[i]);
+    }
+}
+
+void Parcel::putLongs(const int64_t* values, size_t count) {
+    checkOutput();
+    uint8_t* data = mOutputStream->reserve(count * 8);
+    for (size_t i = 0; i < count; i++) {
+        storeLong(data + i * 8, (uint64_t) values[i]);
+    }
+}
+
+void Parcel::putDoubles(const double* values, size_t count) {
+    checkOutput();
+    uint8_t* data = mOutputStream->reserve(count * 8);
+    for (size_t i = 0; i < count; i++) {
+        storeLong(data + i * 8, (uint64_t) Double::doubleToLongBits(values[i]));
+    }
+}
+
 void Parcel::putBinder(const sp<IBinder>& binder) {
     try {
         sp<URI> descriptor = new URI(binder->getInterfaceDescriptor());
@@ -180,99 +293,51 @@ void Parcel::putBinder(const sp<IBinder>& base, const sp<IBinder>& binder) {
 }
 
 bool Parcel::getBoolean() {
-    checkInput();
-    try {
-        return mDataInputStream->readBoolean();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return read(1)[0] != 0;
 }
 
 uint8_t Parcel::getByte() {
-    checkInput();
-    try {
-        return mDataInputStream->readByte();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return read(1)[0];
 }
 
 char Parcel::getChar() {
-    checkInput();
-    try {
-        return mDataInputStream->readChar();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return (char) read(1)[0];
 }
 
 uint16_t Parcel::getShort() {
-    checkInput();
-    try {
-        return mDataInputStream->readShort();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return loadShort(read(2));
 }
 
 int32_t Parcel::getInt() {
-    checkInput();
-    try {
-        return mDataInputStream->readInt();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return (int32_t) loadInt(read(4));
 }
 
 uint64_t Parcel::getLong() {
-    checkInput();
-    try {
-        return mDataInputStream->readLong();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return loadLong(read(8));
 }
 
 float Parcel::getFloat() {
-    checkInput();
-    try {
-        return mDataInputStream->readFloat();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return Float::intBitsToFloat(loadInt(read(4)));
 }
 
 double Parcel::getDouble() {
-    checkInput();
-    try {
-        return mDataInputStream->readDouble();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    return Double::longBitsToDouble(loadLong(read(8)));
 }
 
 sp<String> Parcel::getString() {
-    checkInput();
-    try {
-        return mDataInputStream->readUTF();
-    } catch (const IOException& e) {
-        throw RemoteException(e);
-    }
+    // Same encoding as DataInputStream::readUTF, but the String is built straight from the buffer.
+    const size_t size = loadShort(read(2));
+    return new String(read(size), size);
 }
 
 sp<ByteArray> Parcel::getBytes() {
-    checkInput();
-    sp<ByteArray> buffer = new ByteArray(mInputStream->available());
-    mInputStream->read(buffer);
-    return buffer;
+    return getBytes(SIZE_MAX);
 }
 
 sp<ByteArray> Parcel::getBytes(size_t size) {
     checkInput();
-    size = Math::min(mInputStream->available(), size);
-    sp<ByteArray> buffer = new ByteArray(size);
-    mInputStream->read(buffer, 0, size);
-    return buffer;
+    size = Math::min(mOutputStream->size() - mPosition, size);
+    return new ByteArray(read(size), size);
 }
 
 sp<IBinder> Parcel::getBinder() {
@@ -286,27 +351,38 @@ sp<IBinder> Parcel::getBinder() {
 }
 
 sp<ByteArray> Parcel::getByteArray() {
+    if (mOffset != 0) {
+        unshare();
+    }
     return mOutputStream->getByteArray();
 }
 
+void Parcel::writeTo(const sp<OutputStream>& outputStream) {
+    outputStream->write(mOutputStream->getByteArray(), mOffset, size());
+}
+
 sp<ByteArrayInputStream> Parcel::asInputStream() {
+    setInput();
     if (mInputStream == nullptr) {
-        mInputStream = new ByteArrayInputStream(mOutputStream->getByteArray(), 0, mOutputStream->size());
-        mDataInputStream = new DataInputStream(mInputStream);
+        mInputStream = new ByteArrayInputStream(mOutputStream->getByteArray(), mPosition, mOutputStream->size() - mPosition);
     }
     return mInputStream;
 }
 
 sp<ByteArrayOutputStream> Parcel::asOutputStream() {
-    if (mInputStream != nullptr) {
+    if (mInput) {
+        mInput = false;
         mInputStream = nullptr;
-        mDataInputStream = nullptr;
+    }
+    // Appending to a borrowed buffer would overwrite data of its owner.
+    if (mBorrowed) {
+        unshare();
     }
     return mOutputStream;
 }
 
 sp<Parcel> Parcel::asInput() {
-    asInputStream();
+    setInput();
     return this;
 }
 
@@ -316,17 +392,45 @@ sp<Parcel> Parcel::asOutput() {
 }
 
 void Parcel::checkOutput() {
-    if (mInputStream != nullptr) {
+    if (mInput) {
         throw IllegalStateException("Parcel is in input mode");
     }
 }
 
 void Parcel::checkInput() {
-    if (mInputStream == nullptr) {
+    if (!mInput) {
         throw IllegalStateException("Parcel is in output mode");
     }
 }
 
+const uint8_t* Parcel::read(size_t size) {
+    checkInput();
+    if (mOutputStream->size() - mPosition < size) {
+        throw RemoteException(EOFException());
+    }
+    const uint8_t* data = mOutputStream->data() + mPosition;
+    mPosition += size;
+    return data;
+}
+
+void Parcel::setInput() {
+    if (!mInput) {
+        mInput = true;
+        mPosition = mOffset;
+    }
+}
+
+void Parcel::unshare() {
+    const size_t size = this->size();
+    sp<OutputBuffer> outputStream = new OutputBuffer(Math::max(size, (size_t) 64));
+    std::memcpy(outputStream->reserve(size), mOutputStream->data() + mOffset, size);
+    mPosition -= Math::min(mPosition, mOffset);
+    mOutputStream = outputStream;
+    mOffset = 0;
+    mBorrowed = false;
+    mInputStream = nullptr;
+}
+
 sp<URI> Parcel::toUri(const sp<IBinder>& base, const sp<IBinder>& binder) {
     try {
         sp<URI> descriptor = new URI(binder->getInterfaceDescriptor());
@@ -49,22 +49,44 @@ public:
 
     static sp<Parcel> obtain(size_t size);
 
+    /**
+     * Retrieve a Parcel in input mode that borrows the buffer without copying it. The buffer must
+     * not be modified while the Parcel is in use. Switching the Parcel to output mode copies the
+     * data.
+     */
     static sp<Parcel> obtain(const sp<ByteArray>& buffer);
 
+    /**
+     * Retrieve a Parcel in input mode that borrows size bytes of the buffer starting at offset,
+     * e.g. the payload of a received message, without copying them.
+     */
     static sp<Parcel> obtain(const sp<ByteArray>& buffer, size_t offset, size_t size);
 
     /**
      * Put a Parcel object back into the pool.  You must not touch
      * the object after this call.
      */
-    void recycle() {
-    }
+    void recycle();
+
+    /**
+     * Returns the number of obtain() calls that were served from the pool.
+     *
+     * @hide
+     */
+    static uint64_t getPoolHitCount();
+
+    /**
+     * Returns the number of obtain() calls that allocated a new Parcel.
+     *
+     * @hide
+     */
+    static uint64_t getPoolMissCount();
 
     /**
      * Returns the total amount of data contained in the parcel.
      */
     size_t size() {
-        return mOutputStream->size();
+        return mOutputStream->size() - mOffset;
     }
 
     /**
@@ -189,6 +211,27 @@ public:
 
     void putBytes(const sp<ByteArray>& buffer, size_t offset, size_t size);
 
+    /**
+     * Write an array of integer values into the parcel at the current dataPosition(),
+     * growing dataCapacity() if needed. The values are stored like count calls to putInt(),
+     * without a length prefix.
+     */
+    void putInts(const int32_t* values, size_t count);
+
+    /**
+     * Write an array of long integer values into the parcel at the current dataPosition(),
+     * growing dataCapacity() if needed. The values are stored like count calls to putLong(),
+     * without a length prefix.
+     */
+    void putLongs(const int64_t* values, size_t count);
+
+    /**
+     * Write an array of double precision floating point values into the parcel at the current
+     * dataPosition(), growing dataCapacity() if needed. The values are stored like count calls to
+     * putDouble(), without a length prefix.
+     */
+    void putDoubles(const double* values, size_t count);
+
     void putBinder(const sp<IBinder>& binder);
 
     void putBinder(const sp<IBinder>& base, const sp<IBinder>& binder);
@@ -237,8 +280,22 @@ public:
 
     sp<IBinder> getBinder();
 
+    /**
+     * Returns the buffer of the parcel without copying it. The first size() bytes are the
+     * contents of the parcel. Only a Parcel that borrows a slice at a non-zero offset of another
+     * buffer has to copy its contents into a buffer of its own first.
+     */
     sp<ByteArray> getByteArray();
 
+    /**
+     * Writes the contents of the parcel to the output stream without copying them.
+     */
+    void writeTo(const sp<OutputStream>& outputStream);
+
+    /**
+     * Returns a stream over the unread contents of the parcel. The stream has a read position
+     * of its own.
+     */
     sp<ByteArrayInputStream> asInputStream();
 
     sp<ByteArrayOutputStream> asOutputStream();
@@ -747,15 +804,76 @@ public:
     void removeExtra(const sp<String>& name);
 
 private:
+    /**
+     * Recycled Parcels keep their buffers. The pool has a bucket per size class, so
+     * obtain(size_t) gets a buffer that is large enough. Parcels whose buffers are larger than
+     * MAX_POOLED_CAPACITY or still referenced elsewhere are not pooled.
+     */
+    static const size_t POOL_SIZE_CLASS_COUNT = 5;
+    static const size_t POOL_SIZE_CLASSES[POOL_SIZE_CLASS_COUNT];
+    static const size_t MAX_POOL_SIZE = 8;
+    static const size_t MAX_POOLED_CAPACITY = 64 * 1024;
+
+    /**
+     * ByteArrayOutputStream that lets the Parcel store values directly into its buffer. It
+     * produces the same bytes as a DataOutputStream on top of a ByteArrayOutputStream.
+     */
+    class OutputBuffer final : public ByteArrayOutputStream {
+    public:
+        OutputBuffer() = default;
+
+        explicit OutputBuffer(size_t size) :
+                ByteArrayOutputStream(size) {
+        }
+
+        OutputBuffer(const sp<ByteArray>& buffer, size_t count) :
+                ByteArrayOutputStream(buffer) {
+            mCount = count;
+        }
+
+        uint8_t* data() {
+            return mBuffer->c_arr();
+        }
+
+        /**
+         * Appends size bytes and returns a pointer to them.
+         */
+        uint8_t* reserve(size_t size) {
+            if (mCount + size > mBuffer->size()) {
+                grow(size);
+            }
+            uint8_t* data = mBuffer->c_arr() + mCount;
+            mCount += size;
+            return data;
+        }
+
+    private:
+        void grow(size_t size);
+    };
+
     Parcel();
     Parcel(size_t size);
     Parcel(const sp<ByteArray>& buffer, size_t offset, size_t size);
 
-    sp<ByteArrayOutputStream> mOutputStream;
+    static sp<Parcel> obtainFromPool(size_t size);
+
+    const uint8_t* read(size_t size);
+    void setInput();
+    void unshare();
+
+    // The contents are the bytes from mOffset up to the size of mOutputStream. mOffset is only
+    // non-zero while the Parcel borrows a slice of another buffer.
+    sp<OutputBuffer> mOutputStream;
+    size_t mOffset = 0;
+    size_t mPosition = 0;
+    bool mInput = false;
+    bool mBorrowed = false;
     sp<ByteArrayInputStream> mInputStream;
-    sp<DataOutputStream> mDataOutputStream;
     sp<DataInputStream> mDataInputStream;
     sp<Bundle> mExtras;
+    bool mPooled = false;
+
+    friend struct ParcelPool;
 };
 
 } /* namespace mindroid */
@@ -36,7 +36,8 @@ Process::Process(const sp<String>& name) :
         mName(name),
         mLock(new ReentrantLock()),
         mCondition(mLock->newCondition()) {
-    mMainThread = new HandlerThread(String::format("Process {%s}", name->c_str()));
+    // Service processes are fed by many binder and client threads.
+    mMainThread = new HandlerThread(String::format("Process {%s}", name->c_str()), MessageQueue::FLAG_LOCK_FREE_ENQUEUE);
     mServices = new HashMap<sp<ComponentName>, sp<Service>>();
 }
 
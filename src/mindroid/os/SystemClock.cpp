@@ -30,6 +30,12 @@ uint64_t SystemClock::uptimeMillis() {
     return (((uint64_t) now.tv_sec * 1000LL) + (now.tv_nsec / 1000000LL));
 }
 
+uint64_t SystemClock::uptimeNanos() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (((uint64_t) now.tv_sec * 1000000000LL) + now.tv_nsec);
+}
+
 uint64_t SystemClock::elapsedRealtime() {
     timespec now;
 #ifdef CLOCK_BOOTTIME
@@ -117,6 +117,14 @@ public:
      */
     static uint64_t uptimeMillis();
 
+    /**
+     * Returns nanoseconds since boot, not counting time spent in deep sleep. This is the same clock
+     * as {@link #uptimeMillis}, but with nanosecond resolution.
+     *
+     * @return nanoseconds of non-sleep uptime since boot.
+     */
+    static uint64_t uptimeNanos();
+
     /**
      * Returns milliseconds since boot, including time spent in sleep.
      *
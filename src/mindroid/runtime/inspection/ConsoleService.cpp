@@ -16,6 +16,9 @@
 
 #include <mindroid/runtime/inspection/ConsoleService.h>
 #include <mindroid/lang/StringBuilder.h>
+#include <mindroid/lang/IllegalArgumentException.h>
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/os/Looper.h>
 
 namespace mindroid {
 
@@ -99,6 +102,52 @@ void ConsoleService::addCommands() {
         }
         return sb->toString();
     });
+
+    addCommand("looper stats", "Print Looper statistics ('looper stats enable|disable|reset' to control instrumentation)", [=] (const sp<StringArray>& arguments) {
+        const sp<String> action = (arguments != nullptr && arguments->size() > 0) ? arguments->get(0) : nullptr;
+        sp<StringBuilder> sb = new StringBuilder();
+        sp<ArrayList<sp<Looper>>> loopers = Looper::getLoopers();
+        auto itr = loopers->iterator();
+        while (itr.hasNext()) {
+            sp<Looper> looper = itr.next();
+            sp<MessageQueue> queue = looper->getQueue();
+            if (action != nullptr) {
+                if (action->equals("enable")) {
+                    queue->setInstrumentationEnabled(true);
+                } else if (action->equals("disable")) {
+                    queue->setInstrumentationEnabled(false);
+                } else if (action->equals("reset")) {
+                    queue->getStats()->reset();
+                } else {
+                    throw IllegalArgumentException(String::format("Invalid argument: %s", action->c_str()));
+                }
+                continue;
+            }
+            sb->append(String::format("Looper %s: %s\n", looper->getThread()->getName()->c_str(),
+                    queue->isInstrumentationEnabled() ? "instrumented" : "not instrumented"));
+            sb->append(queue->getStats()->toString());
+            if (itr.hasNext()) {
+                sb->append("\n\n");
+            }
+        }
+        return (action != nullptr) ? String::valueOf("OK") : sb->toString();
+    });
+
+    addCommand("allocator stats", "Print allocator statistics of the process and of the Looper arenas", [=] (const sp<StringArray>& arguments) {
+        sp<StringBuilder> sb = new StringBuilder();
+        sb->append("Default allocator: ");
+        sb->append(Allocator::getDefault()->dump());
+        sp<ArrayList<sp<Looper>>> loopers = Looper::getLoopers();
+        auto itr = loopers->iterator();
+        while (itr.hasNext()) {
+            sp<Looper> looper = itr.next();
+            if (looper->getAllocator() != nullptr) {
+                sb->append(String::format("\n\nLooper %s: ", looper->getThread()->getName()->c_str()));
+                sb->append(looper->getAllocator()->dump());
+            }
+        }
+        return sb->toString();
+    });
 }
 
 } /* namespace mindroid */
@@ -16,17 +16,19 @@
 
 #include <mindroid/runtime/system/Mindroid.h>
 #include <mindroid/runtime/system/Runtime.h>
+#include <mindroid/lang/Class.h>
 #include <mindroid/lang/IllegalArgumentException.h>
+#include <mindroid/lang/UnsupportedOperationException.h>
 #include <mindroid/os/Handler.h>
 #include <mindroid/os/HandlerThread.h>
 #include <mindroid/os/Parcel.h>
+#include <mindroid/os/SystemClock.h>
 #include <mindroid/net/ServerSocket.h>
 #include <mindroid/net/Socket.h>
 #include <mindroid/net/InetSocketAddress.h>
 #include <mindroid/net/URI.h>
 #include <mindroid/net/URISyntaxException.h>
 #include <mindroid/io/DataInputStream.h>
-#include <mindroid/io/DataOutputStream.h>
 #include <mindroid/io/IOException.h>
 #include <mindroid/io/EOFException.h>
 #include <mindroid/util/Log.h>
@@ -39,6 +41,9 @@ namespace mindroid {
 
 const char* const Mindroid::TAG = "Mindroid";
 const sp<String> Mindroid::TIMEOUT = String::valueOf("timeout");
+const sp<String> Mindroid::DATA_INPUT_STREAM = String::intern("dataInputStream");
+const sp<String> Mindroid::SEND_QUEUE = String::intern("sendQueue");
+static const sp<String> MINDROID_SCHEME = String::valueOf("mindroid");
 sp<HandlerThread> Mindroid::sThread = nullptr;
 sp<Handler> Mindroid::sExecutor = nullptr;
 
@@ -59,8 +64,16 @@ sp<Promise<sp<Void>>> Mindroid::start(const sp<URI>& uri, const sp<Bundle>& extr
             if (plugin != nullptr) {
                 sp<ServiceDiscoveryConfigurationReader::Configuration::Server> server = plugin->server;
                 if (server != nullptr) {
-                    mServer = new Server(mRuntime);
                     try {
+                        if (server->ioThreads > 0) {
+                            if (!Reactor::isSupported()) {
+                                Log::println('E', TAG, "I/O threads are not supported on this platform");
+                                return new Promise<sp<Void>>(sp<Exception>(new UnsupportedOperationException("ioThreads")));
+                            }
+                            mReactor = new Reactor(server->ioThreads);
+                            mReactor->start();
+                        }
+                        mServer = new Server(mRuntime, mReactor);
                         mServer->start(server->uri);
                     } catch (const IOException& e) {
                         Log::println('E', TAG, "IOException");
@@ -77,6 +90,9 @@ sp<Promise<sp<Void>>> Mindroid::stop(const sp<URI>& uri, const sp<Bundle>& extra
     if (mServer != nullptr) {
         mServer->shutdown(nullptr);
     }
+    if (mReactor != nullptr) {
+        mReactor->shutdown();
+    }
     sThread->quit();
     return new Promise<sp<Void>>(sp<Void>(nullptr));
 }
@@ -119,36 +135,34 @@ sp<Promise<sp<Parcel>>> Mindroid::transact(const sp<IBinder>& binder, int32_t wh
     sp<Client> client;
     {
         AutoLock autoLock(mLock);
-        client = mClients->get(nodeId);
-        if (client == nullptr) {
+        sp<ClientPool> pool = mClients->get(nodeId);
+        if (pool == nullptr) {
             if (mConfiguration != nullptr) {
                 sp<ServiceDiscoveryConfigurationReader::Configuration::Node> node = mConfiguration->nodes->get(nodeId);
-                if (node  != nullptr) {
+                if (node != nullptr) {
                     sp<ServiceDiscoveryConfigurationReader::Configuration::Plugin> plugin = node->plugins->get(binder->getUri()->getScheme());
-                    if (plugin != nullptr) {
-                        sp<ServiceDiscoveryConfigurationReader::Configuration::Server> server = plugin->server;
-                        if (server != nullptr) {
-                            try {
-                                client = new Client(this, node->id);
-                                client->start(server->uri);
-                                if (!client->isClosed()) {
-                                    mClients->put(nodeId, client);
-                                } else {
-                                    throw RemoteException("Binder transaction failure");
-                                }
-                            } catch (const IOException& e) {
-                                throw RemoteException("Binder transaction failure");
-                            }
-                        } else {
-                            throw RemoteException("Binder transaction failure");
-                        }
-                    } else {
-                        throw RemoteException("Binder transaction failure");
+                    if (plugin != nullptr && plugin->server != nullptr) {
+                        pool = new ClientPool(plugin->server);
+                        mClients->put(nodeId, pool);
                     }
+                }
+            }
+            if (pool == nullptr) {
+                throw RemoteException("Binder transaction failure");
+            }
+        }
+        const size_t index = pool->select(binder);
+        client = pool->clients->get(index);
+        if (client == nullptr) {
+            try {
+                client = new Client(this, nodeId);
+                client->start(pool->server->uri);
+                if (!client->isClosed()) {
+                    pool->clients->set(index, client);
                 } else {
                     throw RemoteException("Binder transaction failure");
                 }
-            } else {
+            } catch (const IOException& e) {
                 throw RemoteException("Binder transaction failure");
             }
         }
@@ -172,19 +186,102 @@ sp<Promise<sp<Void>>> Mindroid::disconnect(const sp<URI>& node, const sp<Bundle>
     return nullptr;
 }
 
+size_t Mindroid::getConnectionCount(uint32_t nodeId) {
+    AutoLock autoLock(mLock);
+    size_t count = 0;
+    sp<ClientPool> pool = mClients->get(nodeId);
+    if (pool != nullptr) {
+        for (size_t i = 0; i < pool->clients->size(); i++) {
+            sp<Client> client = pool->clients->get(i);
+            if (client != nullptr && !client->isClosed()) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
 void Mindroid::onShutdown(const sp<Client>& client) {
     AutoLock autoLock(mLock);
-    mClients->remove(client->getNodeId());
+    sp<ClientPool> pool = mClients->get(client->getNodeId());
+    if (pool != nullptr) {
+        for (size_t i = 0; i < pool->clients->size(); i++) {
+            if (pool->clients->get(i) == client) {
+                pool->clients->set(i, nullptr);
+            }
+        }
+    }
+}
+
+Mindroid::ClientPool::ClientPool(const sp<ServiceDiscoveryConfigurationReader::Configuration::Server>& server) :
+        server(server) {
+    for (uint32_t i = 0; i < server->connections; i++) {
+        clients->add(nullptr);
+    }
+}
+
+size_t Mindroid::ClientPool::select(const sp<IBinder>& binder) const {
+    if (server->routing == ServiceDiscoveryConfigurationReader::Configuration::Server::ROUTING_LEAST_LOADED) {
+        size_t index = 0;
+        int32_t minCount = INT32_MAX;
+        size_t emptySlot = SIZE_MAX;
+        for (size_t i = 0; i < clients->size(); i++) {
+            sp<Client> client = clients->get(i);
+            if (client == nullptr) {
+                if (emptySlot == SIZE_MAX) {
+                    emptySlot = i;
+                }
+                continue;
+            }
+            const int32_t count = client->getInFlightTransactionCount();
+            if (count < minCount) {
+                minCount = count;
+                index = i;
+            }
+        }
+        // Another connection is only opened if all open connections are busy.
+        if (emptySlot != SIZE_MAX && minCount > 0) {
+            return emptySlot;
+        }
+        return index;
+    }
+    // The lower half of binder ids counts up per node, so consecutive binders use different connections.
+    return (size_t) ((uint32_t) (binder->getId() & 0xFFFFFFFFL) % clients->size());
 }
 
-sp<Mindroid::Message> Mindroid::Message::newMessage(const sp<DataInputStream>& inputStream) {
-    int32_t type = inputStream->readInt();
+sp<Mindroid::Message> Mindroid::Message::newMessage(const sp<DataInputStream>& inputStream, const sp<Reactor::ReceiveBuffer>& receiveBuffer) {
+    const uint8_t b = inputStream->readUnsignedByte();
+    if ((b & FORMAT_V2_FLAG) != 0) {
+        int32_t type = b & ~FORMAT_V2_FLAG;
+        uint64_t binderId = (uint64_t) inputStream->readLong();
+        int32_t transactionId = inputStream->readInt();
+        int32_t what = inputStream->readInt();
+        int32_t size = inputStream->readInt();
+        if (size < 0 || size > MAX_MESSAGE_SIZE) {
+            throw IOException(String::format("Invalid input message size: binderId=%" PRIu64 ", transactionId=%d, what=%d, size=%d", binderId, transactionId, what, size));
+        }
+        if (receiveBuffer != nullptr) {
+            // An incomplete message is decoded again for each chunk that is received, so the payload
+            // is not allocated before it is there.
+            receiveBuffer->require(size);
+        }
+        sp<ByteArray> data = new ByteArray(size);
+        inputStream->readFully(data, 0, size);
+        return new Message(type, binderId, transactionId, what, data, size);
+    }
+
+    // The first byte of FORMAT_V1 messages is the most significant byte of the type.
+    int32_t type = (b << 24) | (inputStream->readUnsignedByte() << 16);
+    type |= inputStream->readUnsignedShort();
     sp<String> uri = inputStream->readUTF();
     int32_t transactionId = inputStream->readInt();
     int32_t what = inputStream->readInt();
     int32_t size = inputStream->readInt();
     if (size < 0 || size > MAX_MESSAGE_SIZE) {
-        throw IOException(String::format("Invalid input message size: uri=%s, transactionId=%d, what=%d, size=%d", uri, transactionId, what, size));
+        throw IOException(String::format("Invalid input message size: uri=%s, transactionId=%d, what=%d, size=%d", uri->c_str(), transactionId, what, size));
+    }
+    if (receiveBuffer != nullptr) {
+        receiveBuffer->require(size);
     }
     sp<ByteArray> data = new ByteArray(size);
     inputStream->readFully(data, 0, size);
@@ -199,23 +296,75 @@ sp<Mindroid::Message> Mindroid::Message::newMessage(const sp<DataInputStream>& i
     }
 }
 
-void Mindroid::Message::write(const sp<DataOutputStream>& outputStream) {
+void Mindroid::Message::write(const sp<OutputStream>& outputStream) {
     if (size < 0 || size > MAX_MESSAGE_SIZE) {
-        throw IOException(String::format("Invalid output message size: uri=%s, transactionId=%d, what=%d, size=%d", uri, transactionId, what, size));
+        throw IOException(String::format("Invalid output message size: transactionId=%d, what=%d, size=%d", transactionId, what, size));
+    }
+    // Parcels encode like DataOutputStream, so the header is encoded into a pooled Parcel.
+    sp<Parcel> header;
+    if (format == FORMAT_V2) {
+        header = Parcel::obtain(FORMAT_V2_HEADER_SIZE);
+        header->putByte((uint8_t) (FORMAT_V2_FLAG | this->type));
+        header->putLong((int64_t) this->binderId);
+    } else {
+        header = Parcel::obtain(HEADER_SIZE + this->uri->length());
+        header->putInt(this->type);
+        header->putString(this->uri);
     }
-    outputStream->writeInt(this->type);
-    outputStream->writeUTF(this->uri);
-    outputStream->writeInt(this->transactionId);
-    outputStream->writeInt(this->what);
-    outputStream->writeInt(this->size);
-    outputStream->write(this->data, 0, this->size);
-    if (type != MESSAGE_TYPE_TRANSACTION) {
-        outputStream->writeInt(0);
+    header->putInt(this->transactionId);
+    header->putInt(this->what);
+    header->putInt((int32_t) this->size);
+    if (format == FORMAT_V2 || type == MESSAGE_TYPE_TRANSACTION) {
+        outputStream->write(header->getByteArray(), 0, header->size(), this->data, 0, this->size);
+    } else {
+        // FORMAT_V1 exception messages are small, so their payload and trailer are copied into the header.
+        header->putBytes(this->data, 0, this->size);
+        header->putInt(0);
+        outputStream->write(header->getByteArray(), 0, header->size());
     }
     outputStream->flush();
+    header->recycle();
+}
+
+Mindroid::SendQueue::SendQueue(const sp<OutputStream>& outputStream) : mOutputStream(outputStream) {
+}
+
+void Mindroid::SendQueue::send(const sp<Message>& message) {
+    {
+        AutoLock autoLock(mLock);
+        if (mHasFailed) {
+            throw IOException("Connection is broken");
+        }
+        mMessages->add(message);
+        if (mIsSending) {
+            return;
+        }
+        mIsSending = true;
+    }
+
+    while (true) {
+        sp<Message> m;
+        {
+            AutoLock autoLock(mLock);
+            if (mMessages->isEmpty()) {
+                mIsSending = false;
+                return;
+            }
+            m = mMessages->remove(0);
+        }
+        try {
+            m->write(mOutputStream);
+        } catch (const IOException& e) {
+            AutoLock autoLock(mLock);
+            mHasFailed = true;
+            mIsSending = false;
+            mMessages->clear();
+            throw;
+        }
+    }
 }
 
-Mindroid::Server::Server(const sp<Runtime>& runtime) : AbstractServer(), mRuntime(runtime) {
+Mindroid::Server::Server(const sp<Runtime>& runtime, const sp<Reactor>& reactor) : AbstractServer(reactor), mRuntime(runtime) {
 }
 
 void Mindroid::Server::onConnected(const sp<AbstractServer::Connection>& connection) {
@@ -229,55 +378,58 @@ void Mindroid::Server::onDisconnected(const sp<AbstractServer::Connection>& conn
 }
 
 void Mindroid::Server::onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) {
-    if (!context->containsKey("dataInputStream")) {
+    if (!context->containsKey(DATA_INPUT_STREAM)) {
         sp<DataInputStream> dataInputStream = new DataInputStream(inputStream);
-        context->putObject("dataInputStream", dataInputStream);
-    }
-    if (!context->containsKey("datOutputStream")) {
-        sp<DataOutputStream> dataOutputStream = new DataOutputStream(outputStream);
-        context->putObject("dataOutputStream", dataOutputStream);
+        context->putObject(DATA_INPUT_STREAM, dataInputStream);
+        context->putObject(SEND_QUEUE, new SendQueue(outputStream));
     }
-    sp<DataInputStream> dataInputStream = object_cast<DataInputStream>(context->getObject("dataInputStream"));
-    sp<DataOutputStream> dataOutputStream = object_cast<DataOutputStream>(context->getObject("dataOutputStream"));
+    sp<DataInputStream> dataInputStream = object_cast<DataInputStream>(context->getObject(DATA_INPUT_STREAM));
+    sp<SendQueue> sendQueue = object_cast<SendQueue>(context->getObject(SEND_QUEUE));
 
     try {
-        sp<Message> message = Message::newMessage(dataInputStream);
+        sp<Message> message = Message::newMessage(dataInputStream, Class<Reactor::ReceiveBuffer>::cast(inputStream));
 
         if (message->type == Mindroid::Message::MESSAGE_TYPE_TRANSACTION) {
             try {
-                sp<IBinder> binder = mRuntime->getBinder(URI::create(message->uri));
+                // FORMAT_V2 messages are dispatched by binder id without parsing a URI.
+                sp<IBinder> binder = (message->format == Message::FORMAT_V2) ?
+                        sp<IBinder>(mRuntime->getBinder(message->binderId)) : mRuntime->getBinder(message->uri);
                 if (binder != nullptr) {
+                    // The next message is read right away, so replies of slow services do not hold up others.
                     sp<Promise<sp<Parcel>>> result = binder->transact(message->what, Parcel::obtain(message->data), 0);
                     if (result != nullptr) {
-                        try {
-                            result->then([=] (const sp<Parcel>& value, const sp<Exception>& exception) {
-                                AutoLock autoLock(mLock);
+                        wp<AbstractServer::Connection> connection = object_cast<AbstractServer::Connection>(context->getObject("connection"));
+                        result->then([=] (const sp<Parcel>& value, const sp<Exception>& exception) {
+                            try {
                                 if (exception == nullptr) {
-                                    Message::newMessage(message->uri, message->transactionId, message->what, value->getByteArray(), value->size())->write(dataOutputStream);
+                                    sendQueue->send(message->newReply(Message::MESSAGE_TYPE_TRANSACTION, value->getByteArray(), value->size()));
+                                    value->recycle();
                                 } else {
-                                    Message::newExceptionMessage(message->uri, message->transactionId, message->what, BINDER_TRANSACTION_FAILURE)->write(dataOutputStream);
+                                    sendQueue->send(message->newReply(Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION, BINDER_TRANSACTION_FAILURE, BINDER_TRANSACTION_FAILURE->size()));
+                                }
+                            } catch (const IOException& e) {
+                                sp<AbstractServer::Connection> c = connection.get();
+                                if (c != nullptr) {
+                                    try {
+                                        c->close();
+                                    } catch (const IOException& ignore) {
+                                    }
                                 }
-                            });
-                        } catch (const IOException& e) {
-                            try {
-                                object_cast<Client::Connection>(context->getObject("connection"))->close();
-                            } catch (const IOException& ignore) {
                             }
-                        }
+                        });
                     }
                 } else {
-                    AutoLock autoLock(mLock);
-                    Message::newExceptionMessage(message->uri, message->transactionId, message->what, BINDER_TRANSACTION_FAILURE)->write(dataOutputStream);
+                    sendQueue->send(message->newReply(Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION, BINDER_TRANSACTION_FAILURE, BINDER_TRANSACTION_FAILURE->size()));
                 }
             } catch (const IllegalArgumentException& e) {
                 Log::e(TAG, "IllegalArgumentException");
-                AutoLock autoLock(mLock);
-                Message::newExceptionMessage(message->uri, message->transactionId, message->what, BINDER_TRANSACTION_FAILURE)->write(dataOutputStream);
+                sendQueue->send(message->newReply(Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION, BINDER_TRANSACTION_FAILURE, BINDER_TRANSACTION_FAILURE->size()));
             } catch (const RemoteException& e) {
                 Log::e(TAG, "RemoteException");
-                AutoLock autoLock(mLock);
-                Message::newExceptionMessage(message->uri, message->transactionId, message->what, BINDER_TRANSACTION_FAILURE)->write(dataOutputStream);
+                sendQueue->send(message->newReply(Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION, BINDER_TRANSACTION_FAILURE, BINDER_TRANSACTION_FAILURE->size()));
             }
+        } else if (message->type == Message::MESSAGE_TYPE_FORMAT_NEGOTIATION) {
+            sendQueue->send(Message::newFormatNegotiationMessage((message->what >= Message::FORMAT_V2) ? Message::FORMAT_V2 : Message::FORMAT_V1));
         } else {
             Log::e(TAG, "Invalid message type: %d", message->type);
         }
@@ -289,22 +441,32 @@ void Mindroid::Server::onTransact(const sp<Bundle>& context, const sp<InputStrea
     }
 }
 
-Mindroid::Client::Client(const sp<Mindroid>& plugin, uint32_t nodeId) : AbstractClient(nodeId),
+Mindroid::Client::Client(const sp<Mindroid>& plugin, uint32_t nodeId) : AbstractClient(nodeId, plugin->mReactor),
         mPlugin(plugin),
         mTransactionIdGenerator(new AtomicInteger(1)) {
+    mTransactionSlotCondition = mLock->newCondition();
 }
 
 void Mindroid::Client::shutdown(const sp<Exception>& cause) {
     sp<Client> self = this;
     sp<Client::Connection> connection = getConnection();
 
-    mPlugin->onShutdown(this);
-    mPlugin.clear();
+    // Both a failed transaction and the connection may shut the client down.
+    sp<Mindroid> plugin;
+    {
+        AutoLock autoLock(mLock);
+        plugin = mPlugin;
+        mPlugin.clear();
+    }
+    if (plugin == nullptr) {
+        return;
+    }
+    plugin->onShutdown(this);
 
-    auto itr = mTransactions->iterator();
+    sp<ArrayList<sp<Promise<sp<Parcel>>>>> transactions = mTransactions->values();
+    auto itr = transactions->iterator();
     while (itr.hasNext()) {
-        auto entry = itr.next();
-        sp<Promise<sp<Parcel>>> promise = entry.getValue();
+        sp<Promise<sp<Parcel>>> promise = itr.next();
         promise->completeWith(sp<Exception>(new RemoteException()));
     }
 
@@ -322,6 +484,9 @@ void Mindroid::Client::shutdown(const sp<Exception>& cause) {
 }
 
 void Mindroid::Client::onConnected() {
+    mSendQueue = new SendQueue(getOutputStream());
+    // Servers that do not know FORMAT_V2 ignore the negotiation, so the client keeps sending FORMAT_V1.
+    mSendQueue->send(Message::newFormatNegotiationMessage(Message::FORMAT_V2));
     sp<InetSocketAddress> remoteSocketAddress = getRemoteSocketAddress();
     Log::d(TAG, "Connected to %s", (remoteSocketAddress != nullptr) ? remoteSocketAddress->toString()->c_str() : "nullptr");
 }
@@ -333,48 +498,77 @@ void Mindroid::Client::onDisconnected(const sp<Exception>& cause) {
 
 sp<Promise<sp<Parcel>>> Mindroid::Client::transact(const sp<IBinder>& binder, int32_t what, const sp<Parcel>& data, int32_t flags) {
     const int32_t transactionId = mTransactionIdGenerator->getAndIncrement();
+    sp<Promise<sp<Parcel>>> promise;
     sp<Promise<sp<Parcel>>> result;
-    try {
-        sp<Bundle> context = getContext();
-        if (!context->containsKey("datOutputStream")) {
-            sp<DataOutputStream> dataOutputStream = new DataOutputStream(getOutputStream());
-            context->putObject("dataOutputStream", dataOutputStream);
+    if ((flags & Binder::FLAG_ONEWAY) == 0) {
+        const uint64_t timeout = data->getLongExtra(Mindroid::TIMEOUT, Mindroid::DEFAULT_TRANSACTION_TIMEOUT);
+        if (!acquireTransactionSlot(timeout)) {
+            throw RemoteException("Binder transaction failure: Too many transactions in flight");
         }
-        sp<DataOutputStream> dataOutputStream = object_cast<DataOutputStream>(context->getObject("dataOutputStream"));
-
-        if ((flags & Binder::FLAG_ONEWAY) != 0) {
-            result = nullptr;
+        promise = new Promise<sp<Parcel>>(Executors::SYNCHRONOUS_EXECUTOR);
+        result = promise->orTimeout(timeout)
+                ->then([=] (const sp<Parcel>& value, const sp<Exception>& exception) {
+                    mTransactions->remove(transactionId);
+                    releaseTransactionSlot();
+                });
+        mTransactions->put(transactionId, promise);
+    }
+    try {
+        sp<URI> uri = binder->getUri();
+        // FORMAT_V2 messages address binders by id, which only identifies binders of the mindroid scheme.
+        if (mFormat == Message::FORMAT_V2 && MINDROID_SCHEME->equals(uri->getScheme())) {
+            mSendQueue->send(Message::newMessage(binder->getId(), transactionId, what, data->getByteArray(), data->size()));
         } else {
-            sp<Promise<sp<Parcel>>> promise = new Promise<sp<Parcel>>(Executors::SYNCHRONOUS_EXECUTOR);
-            result = promise->orTimeout(data->getLongExtra(Mindroid::TIMEOUT, Mindroid::DEFAULT_TRANSACTION_TIMEOUT))
-                    ->then([=] (const sp<Parcel>& value, const sp<Exception>& exception) {
-                        mTransactions->remove(transactionId);
-                    });
-            mTransactions->put(transactionId, promise);
+            mSendQueue->send(Message::newMessage(uri->toString(), transactionId, what, data->getByteArray(), data->size()));
         }
-        AutoLock autoLock(mLock);
-        Message::newMessage(binder->getUri()->toString(), transactionId, what, data->getByteArray(), data->size())->write(dataOutputStream);
     } catch (const IOException& e) {
-        mTransactions->remove(transactionId);
+        if (promise != nullptr) {
+            promise->completeWith(sp<Exception>(new RemoteException()));
+        }
         shutdown(new IOException(e));
         throw RemoteException("Binder transaction failure", e);
     }
     return result;
 }
 
+bool Mindroid::Client::acquireTransactionSlot(uint64_t timeout) {
+    AutoLock autoLock(mLock);
+    const uint64_t deadline = SystemClock::uptimeMillis() + timeout;
+    while (mInFlightTransactionCount >= MAX_IN_FLIGHT_TRANSACTIONS) {
+        const uint64_t now = SystemClock::uptimeMillis();
+        if (now >= deadline) {
+            return false;
+        }
+        mTransactionSlotCondition->await(deadline - now);
+    }
+    mInFlightTransactionCount++;
+    return true;
+}
+
+void Mindroid::Client::releaseTransactionSlot() {
+    AutoLock autoLock(mLock);
+    mInFlightTransactionCount--;
+    mTransactionSlotCondition->signal();
+}
+
 void Mindroid::Client::onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) {
-    if (!context->containsKey("dataInputStream")) {
+    if (!context->containsKey(DATA_INPUT_STREAM)) {
         sp<DataInputStream> dataInputStream = new DataInputStream(inputStream);
-        context->putObject("dataInputStream", dataInputStream);
+        context->putObject(DATA_INPUT_STREAM, dataInputStream);
     }
-    sp<DataInputStream> dataInputStream = object_cast<DataInputStream>(context->getObject("dataInputStream"));
+    sp<DataInputStream> dataInputStream = object_cast<DataInputStream>(context->getObject(DATA_INPUT_STREAM));
 
     try {
-        sp<Message> message = Message::newMessage(dataInputStream);
+        sp<Message> message = Message::newMessage(dataInputStream, Class<Reactor::ReceiveBuffer>::cast(inputStream));
+        if (message->type == Message::MESSAGE_TYPE_FORMAT_NEGOTIATION) {
+            if (message->what >= Message::FORMAT_V2) {
+                mFormat = Message::FORMAT_V2;
+            }
+            return;
+        }
 
-        sp<Promise<sp<Parcel>>> promise = mTransactions->get(message->transactionId);
+        sp<Promise<sp<Parcel>>> promise = mTransactions->remove(message->transactionId);
         if (promise != nullptr) {
-            mTransactions->remove(message->transactionId);
             if (message->type == Message::MESSAGE_TYPE_TRANSACTION) {
                 promise->complete(Parcel::obtain(message->data)->asInput());
             } else {
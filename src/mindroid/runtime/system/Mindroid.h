@@ -28,6 +28,8 @@
 #include <mindroid/util/HashMap.h>
 #include <mindroid/util/HashSet.h>
 #include <mindroid/util/LinkedList.h>
+#include <mindroid/util/concurrent/ConcurrentHashMap.h>
+#include <atomic>
 
 namespace mindroid {
 
@@ -37,7 +39,6 @@ class Socket;
 class InputStream;
 class OutputStream;
 class DataInputStream;
-class DataOutputStream;
 class Lock;
 class Condition;
 class AtomicInteger;
@@ -48,7 +49,11 @@ class Mindroid : public Plugin {
 public:
     static const char* const TAG;
     static const sp<String> TIMEOUT;
+    static const sp<String> DATA_INPUT_STREAM;
+    static const sp<String> SEND_QUEUE;
     static const uint64_t DEFAULT_TRANSACTION_TIMEOUT = 10000;
+    // Number of transactions that a client may have in flight on its connection before transact blocks.
+    static const int32_t MAX_IN_FLIGHT_TRANSACTIONS = 128;
 
     Mindroid();
     virtual ~Mindroid() = default;
@@ -79,15 +84,49 @@ public:
     sp<Promise<sp<Void>>> connect(const sp<URI>& node, const sp<Bundle>& extras) override;
     sp<Promise<sp<Void>>> disconnect(const sp<URI>& node, const sp<Bundle>& extras) override;
 
+    /**
+     * Returns the number of connections that are open to the server of node {@code nodeId}.
+     */
+    size_t getConnectionCount(uint32_t nodeId);
+
     class Message : public Object {
     public:
         static const int32_t MESSAGE_TYPE_TRANSACTION = 1;
         static const int32_t MESSAGE_TYPE_EXCEPTION_TRANSACTION = 2;
+        // Announces the highest wire format of the sender in what. Peers that do not know it ignore it.
+        static const int32_t MESSAGE_TYPE_FORMAT_NEGOTIATION = 3;
         static const int32_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024; //64MB
+        /**
+         * The wire format of Mindroid.java. The header starts with the type as int, so its first byte
+         * is always 0, and carries the target URI as UTF string.
+         */
+        static const int32_t FORMAT_V1 = 1;
+        /**
+         * The compact wire format. The header starts with a byte of the type and FORMAT_V2_FLAG and
+         * carries the target binder id as long. Peers only use it once both have negotiated it.
+         */
+        static const int32_t FORMAT_V2 = 2;
+        static const uint8_t FORMAT_V2_FLAG = 0x80;
+        // Type, URI length, transaction id, what and size.
+        static const size_t HEADER_SIZE = 18;
+        // Type, binder id, transaction id, what and size.
+        static const size_t FORMAT_V2_HEADER_SIZE = 21;
 
         Message(int32_t type, const sp<String>& uri, int32_t transactionId, int32_t what, const sp<ByteArray>& data, size_t size) :
                 type(type),
+                format(FORMAT_V1),
                 uri(uri),
+                binderId(0),
+                transactionId(transactionId),
+                what(what),
+                data(data),
+                size(size) {
+        }
+
+        Message(int32_t type, uint64_t binderId, int32_t transactionId, int32_t what, const sp<ByteArray>& data, size_t size) :
+                type(type),
+                format(FORMAT_V2),
+                binderId(binderId),
                 transactionId(transactionId),
                 what(what),
                 data(data),
@@ -102,6 +141,10 @@ public:
             return new Message(MESSAGE_TYPE_TRANSACTION, uri, transactionId, what, data, size);
         }
 
+        static sp<Message> newMessage(uint64_t binderId, int32_t transactionId, int32_t what, const sp<ByteArray>& data, size_t size) {
+            return new Message(MESSAGE_TYPE_TRANSACTION, binderId, transactionId, what, data, size);
+        }
+
         static sp<Message> newExceptionMessage(const sp<String>& uri, int32_t transactionId, int32_t what, const sp<ByteArray>& data) {
             return newExceptionMessage(uri, transactionId, what, data, data->size());
         }
@@ -110,21 +153,79 @@ public:
             return new Message(MESSAGE_TYPE_EXCEPTION_TRANSACTION, uri, transactionId, what, data, size);
         }
 
-        static sp<Message> newMessage(const sp<DataInputStream>& inputStream);
+        /**
+         * Creates the reply of type {@code type} to this message in the format of this message.
+         */
+        sp<Message> newReply(int32_t type, const sp<ByteArray>& data, size_t size) const {
+            if (format == FORMAT_V2) {
+                return new Message(type, binderId, transactionId, what, data, size);
+            } else {
+                return new Message(type, uri, transactionId, what, data, size);
+            }
+        }
 
-        void write(const sp<DataOutputStream>& outputStream);
+        /**
+         * Creates the message that announces {@code format} as the highest supported wire format. It
+         * is encoded in FORMAT_V1.
+         */
+        static sp<Message> newFormatNegotiationMessage(int32_t format) {
+            // Addressed to the plugin itself since writeUTF does not encode empty strings.
+            return new Message(MESSAGE_TYPE_FORMAT_NEGOTIATION, String::valueOf("mindroid://"), 0, format, new ByteArray(0), 0);
+        }
+
+        /**
+         * Reads a message from {@code inputStream}. In reactor mode, {@code receiveBuffer} is the
+         * stream under {@code inputStream}, and the payload is only allocated once it has been
+         * received completely.
+         */
+        static sp<Message> newMessage(const sp<DataInputStream>& inputStream, const sp<Reactor::ReceiveBuffer>& receiveBuffer = nullptr);
+
+        /**
+         * Writes the message with a single gathering write of its header and payload, so that it
+         * costs one system call on socket streams. Callers serialize the writes to a stream.
+         */
+        void write(const sp<OutputStream>& outputStream);
 
         int32_t type;
+        int32_t format;
+        // The target of FORMAT_V1 messages.
         sp<String> uri;
+        // The target of FORMAT_V2 messages.
+        uint64_t binderId;
         int32_t transactionId;
         int32_t what;
         sp<ByteArray> data;
         size_t size;
     };
 
+    /**
+     * Queue of the messages that are sent over one connection. Senders do not wait for each other:
+     * A sender that finds the queue idle writes the queued messages until the queue is empty, all
+     * other senders just enqueue their message and return. So a write that blocks on a full socket
+     * only stalls the sender that drains the queue and not every other transaction.
+     */
+    class SendQueue : public Object {
+    public:
+        SendQueue(const sp<OutputStream>& outputStream);
+
+        /**
+         * Sends {@code message} now or after the messages that are already queued.
+         *
+         * @throws IOException if writing this or an earlier message to the connection has failed.
+         */
+        void send(const sp<Message>& message);
+
+    private:
+        sp<OutputStream> mOutputStream;
+        sp<ReentrantLock> mLock = new ReentrantLock();
+        sp<LinkedList<sp<Message>>> mMessages = new LinkedList<sp<Message>>();
+        bool mIsSending = false;
+        bool mHasFailed = false;
+    };
+
     class Server : public AbstractServer {
     public:
-        Server(const sp<Runtime>& runtime);
+        Server(const sp<Runtime>& runtime, const sp<Reactor>& reactor);
         void onConnected(const sp<AbstractServer::Connection>& connection) override;
         void onDisconnected(const sp<AbstractServer::Connection>& connection, const sp<Exception>& cause) override;
         void onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) override;
@@ -132,7 +233,6 @@ public:
     private:
         const sp<ByteArray> BINDER_TRANSACTION_FAILURE = String::valueOf("Binder transaction failure")->getBytes();
         sp<Runtime> mRuntime;
-        sp<ReentrantLock> mLock = new ReentrantLock();
     };
 
     class Client : public AbstractClient {
@@ -145,21 +245,52 @@ public:
         void onDisconnected(const sp<Exception>& cause) override;
         void onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) override;
 
+        int32_t getInFlightTransactionCount() const {
+            return mInFlightTransactionCount;
+        }
+
     private:
+        bool acquireTransactionSlot(uint64_t timeout);
+        void releaseTransactionSlot();
+
         sp<Mindroid> mPlugin;
         sp<AtomicInteger> mTransactionIdGenerator;
-        // FIXME: Fix concurrent access to collections.
-        sp<HashMap<int32_t, sp<Promise<sp<Parcel>>>>> mTransactions = new HashMap<int32_t, sp<Promise<sp<Parcel>>>>();
+        // Replies complete their transactions by transaction id, in whatever order they arrive.
+        sp<ConcurrentHashMap<int32_t, sp<Promise<sp<Parcel>>>>> mTransactions = new ConcurrentHashMap<int32_t, sp<Promise<sp<Parcel>>>>();
+        sp<SendQueue> mSendQueue;
         sp<ReentrantLock> mLock = new ReentrantLock();
+        sp<Condition> mTransactionSlotCondition;
+        std::atomic<int32_t> mInFlightTransactionCount {0};
+        // Messages are sent in FORMAT_V1 until the server has negotiated FORMAT_V2.
+        std::atomic<int32_t> mFormat {Message::FORMAT_V1};
     };
 
 private:
+    /**
+     * The clients of the connections to one remote node. A slot is empty until a transaction is
+     * routed to it and after its client has shut down.
+     */
+    class ClientPool : public Object {
+    public:
+        ClientPool(const sp<ServiceDiscoveryConfigurationReader::Configuration::Server>& server);
+
+        /**
+         * Returns the slot of the client that carries the next transaction to {@code binder}.
+         */
+        size_t select(const sp<IBinder>& binder) const;
+
+        sp<ServiceDiscoveryConfigurationReader::Configuration::Server> server;
+        sp<ArrayList<sp<Client>>> clients = new ArrayList<sp<Client>>();
+    };
+
     void onShutdown(const sp<Client>& client);
 
     sp<ServiceDiscoveryConfigurationReader::Configuration> mConfiguration;
+    // Serves the connections of the server and the clients if the server is configured with I/O threads.
+    sp<Reactor> mReactor;
     sp<Server> mServer;
     // FIXME: Fix concurrent access to collections.
-    sp<HashMap<uint32_t, sp<Client>>> mClients = new HashMap<uint32_t, sp<Client>>();
+    sp<HashMap<uint32_t, sp<ClientPool>>> mClients = new HashMap<uint32_t, sp<ClientPool>>();
     sp<HashMap<uint32_t, sp<HashMap<uint64_t, wp<IBinder>>>>> mProxies = new HashMap<uint32_t, sp<HashMap<uint64_t, wp<IBinder>>>>();
     sp<Lock> mLock;
     static sp<HandlerThread> sThread;
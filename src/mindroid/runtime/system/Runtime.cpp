@@ -30,7 +30,7 @@ namespace mindroid {
 const char* const Runtime::TAG = "Runtime";
 std::mutex Runtime::sLock;
 sp<Runtime> Runtime::sRuntime;
-const sp<String> Runtime::MINDROID_SCHEME = String::valueOf("mindroid");
+const sp<String> Runtime::MINDROID_SCHEME = String::intern("mindroid");
 const sp<String> Runtime::MINDROID_SCHEME_WITH_SEPARATOR = String::valueOf("mindroid://");
 
 CLASS(mindroid, Mindroid);
@@ -39,13 +39,13 @@ Runtime::Runtime(uint32_t nodeId, const sp<File>& configurationFile) :
         mNodeId(nodeId),
         mLock(new ReentrantLock()),
         mPlugins(new HashMap<sp<String>, sp<Plugin>>()),
-        mBinderIds(new HashMap<uint64_t, wp<Binder>>()),
-        mBinderUris(new HashMap<sp<String>, wp<Binder>>()),
-        mServices(new HashMap<sp<String>, sp<Binder>>()),
-        mNameResolutionCache(new HashMap<sp<String>, sp<URI>>()),
+        mBinderIds(new ConcurrentHashMap<uint64_t, wp<Binder>>()),
+        mBinderUris(new ConcurrentHashMap<sp<String>, wp<Binder>>()),
+        mServices(new ConcurrentHashMap<sp<String>, sp<Binder>>()),
+        mNameResolutionCache(new ConcurrentHashMap<sp<String>, sp<URI>>()),
         mBinderIdGenerator(new AtomicInteger(1)),
         mProxyIdGenerator(new AtomicInteger(1)),
-        mIds(new HashSet<uint64_t>()) {
+        mServiceIds(new HashSet<uint64_t>()) {
     if (nodeId == 0) {
         throw IllegalArgumentException("Mindroid runtime system node id must not be 0");
     }
@@ -83,7 +83,7 @@ Runtime::Runtime(uint32_t nodeId, const sp<File>& configurationFile) :
                 }
             }
         }
-        mIds->addAll(ids);
+        mServiceIds->addAll(ids);
     }
 }
 
@@ -150,17 +150,10 @@ uint64_t Runtime::attachBinder(const sp<Binder>& binder) {
     if (binder == nullptr) {
         throw NullPointerException();
     }
-    AutoLock autoLock(mLock);
     uint64_t id;
     do {
         id = ((uint64_t) mNodeId << 32) | (mBinderIdGenerator->getAndIncrement() & 0xFFFFFFFFL);
-    } while (mIds->contains(id));
-    if (!mBinderIds->containsKey(id)) {
-        mBinderIds->put(id, binder);
-        mIds->add(id);
-    } else {
-        Log::wtf(TAG, "Invalid binder id: %" PRIu64, id);
-    }
+    } while (mServiceIds->contains(id) || mBinderIds->putIfAbsent(id, binder) != nullptr);
     return id;
 }
 
@@ -171,11 +164,8 @@ void Runtime::attachBinder(const sp<URI>& uri, const sp<Binder>& binder) {
     if (binder->getUri() == nullptr) {
         throw IllegalArgumentException("Binder URI must not be null");
     }
-    AutoLock autoLock(mLock);
-    if (!mBinderUris->containsKey(uri->toString())) {
-        mBinderUris->put(uri->toString(), binder);
-
-        sp<Plugin> plugin = mPlugins->get(binder->getUri()->getScheme());
+    if (mBinderUris->putIfAbsent(uri->toString(), binder) == nullptr) {
+        sp<Plugin> plugin = getPlugin(binder->getUri()->getScheme());
         if (plugin != nullptr) {
             plugin->attachBinder(binder);
         }
@@ -185,12 +175,10 @@ void Runtime::attachBinder(const sp<URI>& uri, const sp<Binder>& binder) {
 }
 
 void Runtime::detachBinder(uint64_t id, const sp<URI>& uri) {
-    AutoLock autoLock(mLock);
-    mIds->remove(id);
     mBinderIds->remove(id);
     if (uri != nullptr) {
         mBinderUris->remove(uri->toString());
-        sp<Plugin> plugin = mPlugins->get(uri->getScheme());
+        sp<Plugin> plugin = getPlugin(uri->getScheme());
         if (plugin != nullptr) {
             plugin->detachBinder(id);
         }
@@ -198,7 +186,6 @@ void Runtime::detachBinder(uint64_t id, const sp<URI>& uri) {
 }
 
 sp<Binder> Runtime::getBinder(uint64_t id) {
-    AutoLock autoLock(mLock);
     uint32_t nodeId = (uint32_t) ((id >> 32) & 0xFFFFFFFFL);
     if (nodeId == 0 || mNodeId == nodeId) {
         wp<Binder> binder = mBinderIds->get(((uint64_t) mNodeId << 32) | id);
@@ -212,54 +199,66 @@ sp<Binder> Runtime::getBinder(uint64_t id) {
     }
 }
 
+bool Runtime::parseNodeId(const sp<String>& authority, uint32_t& nodeId) {
+    // Binder authorities are "<node id>.<binder id>".
+    if (authority == nullptr) {
+        return false;
+    }
+    const char* s = authority->c_str();
+    const size_t length = authority->length();
+    size_t i = (length > 0 && s[0] == '-') ? 1 : 0;
+    const size_t start = i;
+    int64_t value = 0;
+    for (; i < length && s[i] >= '0' && s[i] <= '9'; i++) {
+        value = value * 10 + (s[i] - '0');
+        if (value > INT32_MAX + (int64_t) start) {
+            return false;
+        }
+    }
+    if (i == start || i >= length || s[i] != '.' || i + 1 == length || authority->indexOf('.', i + 1) != -1) {
+        return false;
+    }
+    nodeId = (uint32_t) (int32_t) ((start == 1) ? -value : value);
+    return true;
+}
+
 sp<IBinder> Runtime::getBinder(const sp<URI>& uri) {
-    AutoLock autoLock(mLock);
     if (uri != nullptr) {
         uint32_t nodeId;
-        sp<String> authority = uri->getAuthority();
-        sp<StringArray> parts = authority->split(".");
-        if (parts->size() == 2) {
-            try {
-                nodeId = Integer::valueOf(parts->get(0))->intValue();
-            } catch (const NumberFormatException& e) {
-                throw IllegalArgumentException(String::format("Invalid URI: %s", uri->toString()->c_str()));
-            }
-        } else {
+        if (!parseNodeId(uri->getAuthority(), nodeId)) {
             throw IllegalArgumentException(String::format("Invalid URI: %s", uri->toString()->c_str()));
         }
         if (mNodeId == nodeId) {
-            sp<String> key = String::format("%s://%s", uri->getScheme()->c_str(), uri->getAuthority()->c_str());
+            const sp<String>& key = uri->getSchemeAndAuthority();
             wp<Binder> b = mBinderUris->get(key);
             sp<IBinder> binder;
-            if (MINDROID_SCHEME->equals(uri->getScheme())) {
-                if (b != nullptr && (binder = b.get()) != nullptr) {
-                    return binder;
-                } else {
-                    mBinderUris->remove(key);
-                    return nullptr;
-                }
-            } else {
+            if (b != nullptr && (binder = b.get()) != nullptr) {
+                return binder;
+            }
+
+            AutoLock autoLock(mLock);
+            b = mBinderUris->get(key);
+            if (b != nullptr && (binder = b.get()) != nullptr) {
+                return binder;
+            }
+            if (b != nullptr) {
+                // Only drop the stale entry, attachBinder() may register a new Binder at any time.
+                mBinderUris->remove(key, b);
+            }
+            if (!MINDROID_SCHEME->equals(uri->getScheme())) {
+                b = mBinderUris->get(String::format("%s%s", MINDROID_SCHEME_WITH_SEPARATOR->c_str(), uri->getAuthority()->c_str()));
                 if (b != nullptr && (binder = b.get()) != nullptr) {
-                    return binder;
-                } else {
-                    mBinderUris->remove(key);
-                    b = mBinderUris->get(String::format("%s%s", MINDROID_SCHEME_WITH_SEPARATOR->c_str(), uri->getAuthority()->c_str()));
-                    if (b != nullptr && (binder = b.get()) != nullptr) {
-                        sp<Plugin> plugin = mPlugins->get(uri->getScheme());
-                        if (plugin != nullptr) {
-                            sp<Binder> stub = plugin->getStub(object_cast<Binder>(binder));
-                            if (stub != nullptr) {
-                                mBinderUris->put(key, stub);
-                            }
-                            return stub;
-                        } else {
-                            return nullptr;
+                    sp<Plugin> plugin = getPlugin(uri->getScheme());
+                    if (plugin != nullptr) {
+                        sp<Binder> stub = plugin->getStub(object_cast<Binder>(binder));
+                        if (stub != nullptr) {
+                            mBinderUris->put(key, stub);
                         }
-                    } else {
-                        return nullptr;
+                        return stub;
                     }
                 }
             }
+            return nullptr;
         } else {
             return Binder::Proxy::create(uri);
         }
@@ -268,6 +267,19 @@ sp<IBinder> Runtime::getBinder(const sp<URI>& uri) {
     }
 }
 
+sp<IBinder> Runtime::getBinder(const sp<String>& uri) {
+    if (uri == nullptr) {
+        return nullptr;
+    }
+    // Only local Binders are registered by URI.
+    wp<Binder> b = mBinderUris->get(uri);
+    sp<IBinder> binder;
+    if (b != nullptr && (binder = b.get()) != nullptr) {
+        return binder;
+    }
+    return getBinder(URI::create(uri));
+}
+
 void Runtime::addService(const sp<URI>& uri, const sp<IBinder>& service) {
     if (uri == nullptr || service == nullptr) {
         throw NullPointerException();
@@ -287,12 +299,10 @@ void Runtime::addService(const sp<URI>& uri, const sp<IBinder>& service) {
                     sp<ServiceDiscoveryConfigurationReader::Configuration::Service> s = node->services->get(uri->getAuthority());
                     if (s != nullptr) {
                         uint64_t oldId = ((uint64_t) mNodeId << 32) | (service->getId() & 0xFFFFFFFFL);
-                        mIds->remove(oldId);
                         mBinderIds->remove(oldId);
                         mBinderUris->remove(service->getUri()->toString());
                         uint64_t newId = ((uint64_t) mNodeId << 32) | (s->id & 0xFFFFFFFFL);
                         object_cast<Binder>(service)->setId(newId);
-                        mIds->add(newId);
                         mBinderIds->put(newId, object_cast<Binder>(service));
                         mBinderUris->put(service->getUri()->toString(), object_cast<Binder>(service));
                     }
@@ -307,14 +317,10 @@ void Runtime::addService(const sp<URI>& uri, const sp<IBinder>& service) {
 
 void Runtime::removeService(const sp<IBinder>& service) {
     if (service != nullptr) {
-        AutoLock autoLock(mLock);
-        auto itr = mServices->iterator();
-        while (itr.hasNext()) {
-            auto entry = itr.next();
-            if (entry.getValue()->getId() == service->getId()) {
-                itr.remove();
-            }
-        }
+        const uint64_t id = service->getId();
+        mServices->removeIf([=] (const sp<String>& uri, const sp<Binder>& binder) {
+            return binder->getId() == id;
+        });
     }
 }
 
@@ -322,7 +328,6 @@ sp<IBinder> Runtime::getService(const sp<URI>& uri) {
     if (uri == nullptr) {
         throw NullPointerException();
     }
-    AutoLock autoLock(mLock);
     sp<URI> serviceUri;
     if (uri->getScheme() != nullptr) {
         serviceUri = uri;
@@ -337,17 +342,21 @@ sp<IBinder> Runtime::getService(const sp<URI>& uri) {
     }
 
     // Services
-    sp<IBinder> binder = mServices->get(serviceUri->toString());
+    sp<Binder> binder = mServices->get(serviceUri->toString());
     if (binder != nullptr) {
         return binder;
     } else {
         binder = mServices->get(String::format("%s%s", MINDROID_SCHEME_WITH_SEPARATOR->c_str(), serviceUri->getAuthority()->c_str()));
         if (binder != nullptr) {
-            sp<Plugin> plugin = mPlugins->get(serviceUri->getScheme());
+            sp<Plugin> plugin = getPlugin(serviceUri->getScheme());
             if (plugin != nullptr) {
-                sp<Binder> stub = plugin->getStub(object_cast<Binder>(binder));
-                if (stub != nullptr) {
-                    mServices->put(serviceUri->toString(), stub);
+                AutoLock autoLock(mLock);
+                sp<Binder> stub = mServices->get(serviceUri->toString());
+                if (stub == nullptr) {
+                    stub = plugin->getStub(binder);
+                    if (stub != nullptr) {
+                        mServices->put(serviceUri->toString(), stub);
+                    }
                 }
                 return stub;
             } else {
@@ -365,11 +374,7 @@ uint64_t Runtime::attachProxy(const sp<Binder::Proxy>& proxy) {
         throw NullPointerException();
     }
     const uint64_t proxyId = mProxyIdGenerator->getAndIncrement();
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(proxy->getUri()->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(proxy->getUri()->getScheme());
     if (plugin != nullptr) {
         plugin->attachProxy(proxyId, proxy);
     }
@@ -380,11 +385,7 @@ void Runtime::detachProxy(uint64_t id, const sp<URI>& uri, uint64_t proxyId) {
     if (uri == nullptr) {
         throw NullPointerException();
     }
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(uri->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(uri->getScheme());
     if (plugin != nullptr) {
         plugin->detachProxy(proxyId, id);
     }
@@ -394,11 +395,7 @@ sp<IInterface> Runtime::getProxy(const sp<IBinder>& binder) {
     if (binder == nullptr) {
         throw NullPointerException();
     }
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(binder->getUri()->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(binder->getUri()->getScheme());
     if (plugin != nullptr) {
         return plugin->getProxy(binder);
     } else {
@@ -410,11 +407,7 @@ sp<Promise<sp<Parcel>>> Runtime::transact(const sp<IBinder>& binder, int32_t wha
     if (binder == nullptr) {
         throw NullPointerException();
     }
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(binder->getUri()->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(binder->getUri()->getScheme());
     if (plugin != nullptr) {
         sp<Promise<sp<Parcel>>> promise = plugin->transact(binder, what, data, flags);
         if (((flags & Binder::FLAG_ONEWAY) == 0) && promise == nullptr) {
@@ -430,11 +423,7 @@ void Runtime::link(const sp<IBinder>& binder, const sp<IBinder::Supervisor>& sup
     if (binder == nullptr || supervisor == nullptr) {
         throw NullPointerException();
     }
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(binder->getUri()->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(binder->getUri()->getScheme());
     if (plugin != nullptr) {
         plugin->link(binder, supervisor, extras);
     } else {
@@ -446,11 +435,7 @@ bool Runtime::unlink(const sp<IBinder>& binder, const sp<IBinder::Supervisor>& s
     if (binder == nullptr || supervisor == nullptr) {
         throw NullPointerException();
     }
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(binder->getUri()->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(binder->getUri()->getScheme());
     if (plugin != nullptr) {
         return plugin->unlink(binder, supervisor, extras);
     } else {
@@ -459,11 +444,7 @@ bool Runtime::unlink(const sp<IBinder>& binder, const sp<IBinder::Supervisor>& s
 }
 
 sp<Promise<sp<Void>>> Runtime::start(const sp<URI>& uri, const sp<Bundle>& extras) {
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(uri->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(uri->getScheme());
     if (plugin != nullptr) {
         return plugin->start(uri, extras);
     } else {
@@ -472,11 +453,7 @@ sp<Promise<sp<Void>>> Runtime::start(const sp<URI>& uri, const sp<Bundle>& extra
 }
 
 sp<Promise<sp<Void>>> Runtime::stop(const sp<URI>& uri, const sp<Bundle>& extras) {
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(uri->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(uri->getScheme());
     if (plugin != nullptr) {
         return plugin->start(uri, extras);
     } else {
@@ -485,11 +462,7 @@ sp<Promise<sp<Void>>> Runtime::stop(const sp<URI>& uri, const sp<Bundle>& extras
 }
 
 sp<Promise<sp<Void>>> Runtime::connect(const sp<URI>& node, const sp<Bundle>& extras) {
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(node->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(node->getScheme());
     if (plugin != nullptr) {
         return plugin->connect(node, extras);
     } else {
@@ -498,11 +471,7 @@ sp<Promise<sp<Void>>> Runtime::connect(const sp<URI>& node, const sp<Bundle>& ex
 }
 
 sp<Promise<sp<Void>>> Runtime::disconnect(const sp<URI>& node, const sp<Bundle>& extras) {
-    sp<Plugin> plugin;
-    {
-        AutoLock autoLock(mLock);
-        plugin = mPlugins->get(node->getScheme());
-    }
+    sp<Plugin> plugin = getPlugin(node->getScheme());
     if (plugin != nullptr) {
         return plugin->disconnect(node, extras);
     } else {
@@ -511,8 +480,6 @@ sp<Promise<sp<Void>>> Runtime::disconnect(const sp<URI>& node, const sp<Bundle>&
 }
 
 sp<Binder::Proxy> Runtime::getProxy(const sp<URI>& uri) {
-    AutoLock autoLock(mLock);
-
     sp<String> key = uri->toString();
     sp<URI> proxyUri = mNameResolutionCache->get(key);
     if (proxyUri != nullptr) {
@@ -539,4 +506,9 @@ sp<Binder::Proxy> Runtime::getProxy(const sp<URI>& uri) {
     }
 }
 
+sp<Plugin> Runtime::getPlugin(const sp<String>& scheme) const {
+    // HashMap::get() inserts missing keys, so check for the key first to keep the map immutable.
+    return mPlugins->containsKey(scheme) ? mPlugins->get(scheme) : nullptr;
+}
+
 } /* namespace mindroid */
@@ -27,6 +27,7 @@
 #include <mindroid/util/Log.h>
 #include <mindroid/util/HashMap.h>
 #include <mindroid/util/HashSet.h>
+#include <mindroid/util/concurrent/ConcurrentHashMap.h>
 #include <mindroid/util/concurrent/atomic/AtomicInteger.h>
 #include <mindroid/util/concurrent/locks/Lock.h>
 #include <mindroid/util/concurrent/Executor.h>
@@ -66,6 +67,14 @@ public:
 
     sp<IBinder> getBinder(const sp<URI>& uri);
 
+    /**
+     * Looks up a local Binder by the URI string of a remote transaction. Binder URIs arrive as
+     * "scheme://node.id", which is the registry key itself, so lookups of local Binders neither
+     * parse the URI nor take the runtime lock. Other URIs are parsed and resolved like
+     * getBinder(const sp<URI>&).
+     */
+    sp<IBinder> getBinder(const sp<String>& uri);
+
     void addService(const sp<URI>& uri, const sp<IBinder>& service);
 
     void removeService(const sp<IBinder>& service);
@@ -108,9 +117,15 @@ public:
      */
     sp<Promise<sp<Void>>> disconnect(const sp<URI>& node, const sp<Bundle>& extras);
 
+    /**
+     * Returns the plugin for {@code scheme} or null if there is none.
+     */
+    sp<Plugin> getPlugin(const sp<String>& scheme) const;
+
 private:
     Runtime(uint32_t nodeId, const sp<File>& configurationFile);
     sp<Binder::Proxy> getProxy(const sp<URI>& uri);
+    static bool parseNodeId(const sp<String>& authority, uint32_t& nodeId);
 
     static const char* const TAG;
     static std::mutex sLock;
@@ -119,15 +134,19 @@ private:
     static const sp<String> MINDROID_SCHEME_WITH_SEPARATOR;
 
     uint32_t mNodeId;
+    // The registries are concurrent maps that are read and updated without mLock. mLock only
+    // serializes compound updates, e.g. the creation of plugin stubs, and the plugin life cycle.
     sp<Lock> mLock;
+    // Populated by the constructor and never modified afterwards, so it is read without locking.
     sp<HashMap<sp<String>, sp<Plugin>>> mPlugins;
-    sp<HashMap<uint64_t, wp<Binder>>> mBinderIds;
-    sp<HashMap<sp<String>, wp<Binder>>> mBinderUris;
-    sp<HashMap<sp<String>, sp<Binder>>> mServices;
-    sp<HashMap<sp<String>, sp<URI>>> mNameResolutionCache;
+    sp<ConcurrentHashMap<uint64_t, wp<Binder>>> mBinderIds;
+    sp<ConcurrentHashMap<sp<String>, wp<Binder>>> mBinderUris;
+    sp<ConcurrentHashMap<sp<String>, sp<Binder>>> mServices;
+    sp<ConcurrentHashMap<sp<String>, sp<URI>>> mNameResolutionCache;
     sp<AtomicInteger> mBinderIdGenerator;
     sp<AtomicInteger> mProxyIdGenerator;
-    sp<HashSet<uint64_t>> mIds;
+    // Ids of the services of this node from the configuration, never used for other Binders.
+    sp<HashSet<uint64_t>> mServiceIds;
     sp<ServiceDiscoveryConfigurationReader::Configuration> mConfiguration;
 };
 
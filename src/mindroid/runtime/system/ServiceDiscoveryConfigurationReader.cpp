@@ -35,6 +35,11 @@ const char* const ServiceDiscoveryConfigurationReader::PLUGIN_SCHEME_ATTR = "sch
 const char* const ServiceDiscoveryConfigurationReader::PLUGIN_CLASS_ATTR = "class";
 const char* const ServiceDiscoveryConfigurationReader::SERVER_TAG = "server";
 const char* const ServiceDiscoveryConfigurationReader::SERVER_URI_ATTR = "uri";
+const char* const ServiceDiscoveryConfigurationReader::SERVER_IO_THREADS_ATTR = "ioThreads";
+const char* const ServiceDiscoveryConfigurationReader::SERVER_CONNECTIONS_ATTR = "connections";
+const char* const ServiceDiscoveryConfigurationReader::SERVER_ROUTING_ATTR = "routing";
+const char* const ServiceDiscoveryConfigurationReader::SERVER_ROUTING_BY_BINDER = "binder";
+const char* const ServiceDiscoveryConfigurationReader::SERVER_ROUTING_LEAST_LOADED = "leastLoaded";
 const char* const ServiceDiscoveryConfigurationReader::SERVICE_DISCOVERY_TAG = "serviceDiscovery";
 const char* const ServiceDiscoveryConfigurationReader::SERVICE_TAG = "service";
 const char* const ServiceDiscoveryConfigurationReader::SERVICE_ID_ATTR = "id";
@@ -137,6 +142,26 @@ sp<ServiceDiscoveryConfigurationReader::Configuration::Server> ServiceDiscoveryC
         Log::e(TAG, "Invalid server: %s", (server->uri) != nullptr ? server->uri->c_str() : "");
         return nullptr;
     }
+    attribute = curElement->FindAttribute(SERVER_IO_THREADS_ATTR);
+    if (attribute != nullptr) {
+        server->ioThreads = attribute->UnsignedValue();
+    }
+    attribute = curElement->FindAttribute(SERVER_CONNECTIONS_ATTR);
+    if (attribute != nullptr) {
+        server->connections = attribute->UnsignedValue();
+        if (server->connections == 0) {
+            Log::e(TAG, "Invalid server connections: %s", attribute->Value());
+            server->connections = 1;
+        }
+    }
+    attribute = curElement->FindAttribute(SERVER_ROUTING_ATTR);
+    if (attribute != nullptr) {
+        if (XMLUtil::StringEqual(SERVER_ROUTING_LEAST_LOADED, attribute->Value())) {
+            server->routing = Configuration::Server::ROUTING_LEAST_LOADED;
+        } else if (!XMLUtil::StringEqual(SERVER_ROUTING_BY_BINDER, attribute->Value())) {
+            Log::e(TAG, "Invalid server routing: %s", attribute->Value());
+        }
+    }
 
     return server;
 }
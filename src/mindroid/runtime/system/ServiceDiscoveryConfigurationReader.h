@@ -60,6 +60,19 @@ public:
         class Server : public Object {
         public:
             sp<String> uri;
+            // Number of I/O threads that serve all connections of the plugin. With 0, every
+            // connection has its own thread. I/O threads are only supported on Linux.
+            uint32_t ioThreads = 0;
+            // Number of connections that a client opens to the server.
+            uint32_t connections = 1;
+            // How a client spreads its transactions over its connections. By binder keeps all
+            // transactions to a binder on one connection and thus in order, least loaded uses the
+            // connection with the fewest transactions in flight.
+            enum Routing {
+                ROUTING_BY_BINDER,
+                ROUTING_LEAST_LOADED
+            };
+            Routing routing = ROUTING_BY_BINDER;
         };
 
         class Service : public Object {
@@ -96,6 +109,11 @@ private:
     static const char* const PLUGIN_CLASS_ATTR;
     static const char* const SERVER_TAG;
     static const char* const SERVER_URI_ATTR;
+    static const char* const SERVER_IO_THREADS_ATTR;
+    static const char* const SERVER_CONNECTIONS_ATTR;
+    static const char* const SERVER_ROUTING_ATTR;
+    static const char* const SERVER_ROUTING_BY_BINDER;
+    static const char* const SERVER_ROUTING_LEAST_LOADED;
     static const char* const SERVICE_DISCOVERY_TAG;
     static const char* const SERVICE_TAG;
     static const char* const SERVICE_ID_ATTR;
@@ -18,6 +18,8 @@
 #include <mindroid/lang/IllegalArgumentException.h>
 #include <mindroid/net/URI.h>
 #include <mindroid/net/URISyntaxException.h>
+#include <mindroid/io/BufferedInputStream.h>
+#include <mindroid/io/EOFException.h>
 #include <mindroid/io/IOException.h>
 #include <mindroid/util/Log.h>
 #include <mindroid/util/concurrent/Executors.h>
@@ -32,6 +34,12 @@ AbstractClient::AbstractClient(uint32_t nodeId) :
             mSocket(new Socket()) {
 }
 
+AbstractClient::AbstractClient(uint32_t nodeId, const sp<Reactor>& reactor) :
+            mNodeId(nodeId),
+            mReactor(reactor),
+            mSocket(new Socket()) {
+}
+
 void AbstractClient::start(const sp<String>& uri) {
     TAG = "Client";
     try {
@@ -45,6 +53,7 @@ void AbstractClient::start(const sp<String>& uri) {
         try {
             mSocket->connect(new InetSocketAddress(mHost, mPort));
             mConnection = new Connection(mSocket, this);
+            mConnection->open();
             onConnected();
         } catch (const IOException& e) {
             Log::e(TAG, "IOException");
@@ -74,8 +83,16 @@ AbstractClient::Connection::Connection(const sp<Socket>& socket, const sp<Abstra
     mContext->putObject("connection", this);
     mSocket = socket;
     mClient = client;
+    mReactor = client->mReactor;
     try {
-        mInputStream = mSocket->getInputStream();
+        // Buffered like the connections of AbstractServer.
+        mSocket->setTcpNoDelay(true);
+        if (mReactor != nullptr) {
+            mReceiveBuffer = new Reactor::ReceiveBuffer(INPUT_BUFFER_SIZE);
+            mInputStream = mReceiveBuffer;
+        } else {
+            mInputStream = new BufferedInputStream(mSocket->getInputStream(), INPUT_BUFFER_SIZE);
+        }
         mOutputStream = mSocket->getOutputStream();
         mRemoteSocketAddress = mSocket->getRemoteSocketAddress();
     } catch (const IOException& e) {
@@ -86,15 +103,36 @@ AbstractClient::Connection::Connection(const sp<Socket>& socket, const sp<Abstra
         }
         throw;
     }
-    Thread::start();
+}
+
+void AbstractClient::Connection::open() {
+    if (mReactor != nullptr) {
+        // The client keeps its connection alive.
+        wp<Connection> connection = this;
+        mChannel = new Reactor::Channel(mSocket->getFileDescriptor(), [connection] {
+            sp<Connection> c = connection.get();
+            return (c != nullptr) ? c->onReadable() : false;
+        });
+        mReactor->add(mChannel);
+    } else {
+        Thread::start();
+    }
 }
 
 void AbstractClient::Connection::close() {
+    // In reactor mode, an I/O thread may close the connection while the client shuts down.
+    if (mIsClosed.exchange(true)) {
+        return;
+    }
     mContext->clear();
     if (DEBUG) {
         Log::d(TAG, "Closing connection");
     }
     interrupt();
+    if (mChannel != nullptr) {
+        mReactor->remove(mChannel);
+        mChannel.clear();
+    }
     if (mInputStream != nullptr) {
         try {
             mInputStream->close();
@@ -147,4 +185,27 @@ void AbstractClient::Connection::run() {
     }
 }
 
+bool AbstractClient::Connection::onReadable() {
+    sp<AbstractClient> client = mClient;
+    if (client == nullptr) {
+        return false;
+    }
+    try {
+        ssize_t size = mReceiveBuffer->receive(mSocket->getFileDescriptor());
+        mReceiveBuffer->dispatch([&] {
+            client->onTransact(mContext, mInputStream, mOutputStream);
+        });
+        if (size < 0) {
+            throw EOFException();
+        }
+        return true;
+    } catch (const IOException& e) {
+        if (DEBUG) {
+            Log::e(TAG, "IOException");
+        }
+        client->shutdown(new IOException(e));
+        return false;
+    }
+}
+
 } /* namespace mindroid */
@@ -26,6 +26,7 @@
 #include <mindroid/io/InputStream.h>
 #include <mindroid/io/OutputStream.h>
 #include <mindroid/os/Binder.h>
+#include <mindroid/runtime/system/io/Reactor.h>
 #include <mindroid/util/HashMap.h>
 
 namespace mindroid {
@@ -37,6 +38,12 @@ public:
     static const char* TAG;
 
     AbstractClient(uint32_t nodeId);
+
+    /**
+     * Creates a client whose connection is served by {@code reactor} instead of a thread of its
+     * own, see {@link AbstractServer#AbstractServer(const sp<Reactor>&)}.
+     */
+    AbstractClient(uint32_t nodeId, const sp<Reactor>& reactor);
     void start(const sp<String>& uri);
     virtual void shutdown(const sp<Exception>& cause);
 
@@ -69,12 +76,19 @@ public:
         }
 
     private:
+        void open();
+        bool onReadable();
+
         sp<Bundle> mContext;
         sp<Socket> mSocket;
         sp<AbstractClient> mClient;
         sp<InputStream> mInputStream;
         sp<OutputStream> mOutputStream;
         sp<InetSocketAddress> mRemoteSocketAddress;
+        sp<Reactor> mReactor;
+        sp<Reactor::ReceiveBuffer> mReceiveBuffer;
+        sp<Reactor::Channel> mChannel;
+        std::atomic<bool> mIsClosed {false};
 
         friend class AbstractClient;
     };
@@ -105,6 +119,7 @@ public:
 
 protected:
     static const bool DEBUG = false;
+    static const size_t INPUT_BUFFER_SIZE = 16 * 1024;
 
     sp<Connection> getConnection() const {
         return mConnection;
@@ -112,6 +127,7 @@ protected:
 
 private:
     uint32_t mNodeId;
+    sp<Reactor> mReactor;
     sp<Socket> mSocket;
     sp<String> mHost;
     int32_t mPort = -1;
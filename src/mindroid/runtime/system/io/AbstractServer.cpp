@@ -21,6 +21,8 @@
 #include <mindroid/net/URISyntaxException.h>
 #include <mindroid/io/InputStream.h>
 #include <mindroid/io/OutputStream.h>
+#include <mindroid/io/BufferedInputStream.h>
+#include <mindroid/io/EOFException.h>
 #include <mindroid/io/IOException.h>
 #include <mindroid/util/Log.h>
 #include <mindroid/util/concurrent/Executors.h>
@@ -30,6 +32,10 @@ namespace mindroid {
 
 const char* AbstractServer::TAG = "Server";
 
+AbstractServer::AbstractServer(const sp<Reactor>& reactor) :
+        mReactor(reactor) {
+}
+
 void AbstractServer::start(const sp<String>& uri) {
     TAG = "Server";
     sp<URI> url;
@@ -52,7 +58,12 @@ void AbstractServer::start(const sp<String>& uri) {
                         if (DEBUG) {
                             Log::d(TAG, "New connection from %s", socket->getRemoteSocketAddress()->toString()->c_str());
                         }
-                        mConnections->add(new Connection(socket, this));
+                        sp<Connection> connection = new Connection(socket, this);
+                        {
+                            std::lock_guard<std::mutex> lock(mLock);
+                            mConnections->add(connection);
+                        }
+                        connection->open();
                     } catch (const IOException& e) {
                         Log::e(TAG, "IOException");
                     }
@@ -74,7 +85,13 @@ void AbstractServer::shutdown(const sp<Exception>& cause) {
         Log::e(TAG, "Cannot close server socket");
     }
 
-    auto itr = mConnections->iterator();
+    sp<HashSet<sp<Connection>>> connections;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        connections = mConnections;
+        mConnections = new HashSet<sp<Connection>>();
+    }
+    auto itr = connections->iterator();
     while (itr.hasNext()) {
         sp<Connection> connection = itr.next();
         itr.remove();
@@ -93,11 +110,20 @@ void AbstractServer::shutdown(const sp<Exception>& cause) {
 AbstractServer::Connection::Connection(const sp<Socket>& socket, const sp<AbstractServer>& server) :
         mContext(new Bundle()),
         mSocket(socket),
-        mServer(server) {
+        mServer(server),
+        mReactor(server->mReactor) {
 	setName(String::format("Server [%s <<>> %s]", socket->getLocalSocketAddress()->toString(), socket->getRemoteSocketAddress()->toString()));
     mContext->putObject("connection", this);
     try {
-        mInputStream = mSocket->getInputStream();
+        // Messages are read through a buffer, so that their small header fields do not cost a recv
+        // call each. Writes are not buffered since messages are sent with one gathering write.
+        mSocket->setTcpNoDelay(true);
+        if (mReactor != nullptr) {
+            mReceiveBuffer = new Reactor::ReceiveBuffer(INPUT_BUFFER_SIZE);
+            mInputStream = mReceiveBuffer;
+        } else {
+            mInputStream = new BufferedInputStream(mSocket->getInputStream(), INPUT_BUFFER_SIZE);
+        }
         mOutputStream = mSocket->getOutputStream();
         mRemoteSocketAddress = mSocket->getRemoteSocketAddress();
     } catch (const IOException& e) {
@@ -109,8 +135,26 @@ AbstractServer::Connection::Connection(const sp<Socket>& socket, const sp<Abstra
         throw;
     }
 
+}
+
+void AbstractServer::Connection::open() {
     mServer->onConnected(this);
-    Thread::start();
+    if (mReactor != nullptr) {
+        // The server keeps its connections alive.
+        wp<Connection> connection = this;
+        mChannel = new Reactor::Channel(mSocket->getFileDescriptor(), [connection] {
+            sp<Connection> c = connection.get();
+            return (c != nullptr) ? c->onReadable() : false;
+        });
+        try {
+            mReactor->add(mChannel);
+        } catch (const IOException& e) {
+            Log::e(TAG, "Failed to set up connection");
+            close(new IOException(e));
+        }
+    } else {
+        Thread::start();
+    }
 }
 
 void AbstractServer::Connection::close() {
@@ -118,12 +162,20 @@ void AbstractServer::Connection::close() {
 }
 
 void AbstractServer::Connection::close(const sp<Exception>& cause) {
+    // In reactor mode, an I/O thread may close the connection while the server shuts down.
+    if (mIsClosed.exchange(true)) {
+        return;
+    }
     mContext->clear();
     if (DEBUG) {
         Log::d(TAG, "Disconnecting from %s", mSocket->getRemoteSocketAddress()->toString()->c_str());
     }
 
     interrupt();
+    if (mChannel != nullptr) {
+        mReactor->remove(mChannel);
+        mChannel.clear();
+    }
     if (mInputStream != nullptr) {
         try {
             mInputStream->close();
@@ -153,7 +205,10 @@ void AbstractServer::Connection::close(const sp<Exception>& cause) {
     }
     join();
     sp<AbstractServer::Connection> connection = this;
-    mServer->mConnections->remove(this);
+    {
+        std::lock_guard<std::mutex> lock(mServer->mLock);
+        mServer->mConnections->remove(this);
+    }
     if (DEBUG) {
         Log::d(TAG, "Connection has been closed");
     }
@@ -183,4 +238,30 @@ void AbstractServer::Connection::run() {
     }
 }
 
+bool AbstractServer::Connection::onReadable() {
+    sp<AbstractServer> server = mServer;
+    if (server == nullptr) {
+        return false;
+    }
+    try {
+        ssize_t size = mReceiveBuffer->receive(mSocket->getFileDescriptor());
+        mReceiveBuffer->dispatch([&] {
+            server->onTransact(mContext, mInputStream, mOutputStream);
+        });
+        if (size < 0) {
+            throw EOFException();
+        }
+        return true;
+    } catch (const IOException& e) {
+        if (DEBUG) {
+            Log::e(TAG, "IOException");
+        }
+        try {
+            close(new IOException(e));
+        } catch (const IOException& ignore) {
+        }
+        return false;
+    }
+}
+
 } /* namespace mindroid */
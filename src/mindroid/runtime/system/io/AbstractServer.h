@@ -24,7 +24,9 @@
 #include <mindroid/net/Socket.h>
 #include <mindroid/net/InetSocketAddress.h>
 #include <mindroid/os/Binder.h>
+#include <mindroid/runtime/system/io/Reactor.h>
 #include <mindroid/util/HashMap.h>
+#include <mutex>
 
 namespace mindroid {
 
@@ -40,6 +42,15 @@ public:
     static const char* TAG;
 
     AbstractServer() = default;
+
+    /**
+     * Creates a server whose connections are served by {@code reactor} instead of a thread each.
+     * In this mode, onTransact is called on an I/O thread of the reactor whenever data has been
+     * received, with an input stream over the received data. onTransact must read a message
+     * completely before acting on it, see {@link Reactor::ReceiveBuffer}.
+     */
+    explicit AbstractServer(const sp<Reactor>& reactor);
+
     void start(const sp<String>& uri);
     void shutdown(const sp<Exception>& cause);
 
@@ -80,21 +91,33 @@ public:
         }
 
     private:
+        void open();
+        bool onReadable();
+
         sp<Bundle> mContext;
         sp<Socket> mSocket;
         sp<AbstractServer> mServer;
         sp<InputStream> mInputStream;
         sp<OutputStream> mOutputStream;
         sp<InetSocketAddress> mRemoteSocketAddress;
+        sp<Reactor> mReactor;
+        sp<Reactor::ReceiveBuffer> mReceiveBuffer;
+        sp<Reactor::Channel> mChannel;
+        std::atomic<bool> mIsClosed {false};
+
+        friend class AbstractServer;
     };
 
 protected:
    static const bool DEBUG = false;
+   static const size_t INPUT_BUFFER_SIZE = 16 * 1024;
 
 private:
+   sp<Reactor> mReactor;
    sp<ServerSocket> mServerSocket;
    sp<Thread> mThread;
-   // FIXME: Fix concurrent access to connection collection.
+   // Connections are added by the accept thread and removed by connection threads, I/O threads and shutdown.
+   std::mutex mLock;
    sp<HashSet<sp<Connection>>> mConnections = new HashSet<sp<Connection>>();
 };
 
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2018 E.S.R.Labs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mindroid/runtime/system/io/Reactor.h>
+#include <mindroid/lang/IllegalArgumentException.h>
+#include <mindroid/lang/IndexOutOfBoundsException.h>
+#include <mindroid/lang/NullPointerException.h>
+#include <mindroid/io/EOFException.h>
+#include <mindroid/io/IOException.h>
+#include <mindroid/util/Log.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#ifndef __APPLE__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace mindroid {
+
+const char* const Reactor::TAG = "Reactor";
+// Channel ids start at 1, the id 0 marks the event that stops the I/O threads.
+static const uint64_t SHUTDOWN_EVENT_ID = 0;
+static const int32_t MAX_EVENT_COUNT = 16;
+
+Reactor::ReceiveBuffer::ReceiveBuffer(size_t size) {
+    if (size == 0) {
+        throw IllegalArgumentException("size = 0");
+    }
+    mBuffer = new ByteArray(size);
+}
+
+int32_t Reactor::ReceiveBuffer::read() {
+    if (mPosition >= mCount) {
+        underflow(1);
+        return -1;
+    }
+    return mBuffer->c_arr()[mPosition++];
+}
+
+ssize_t Reactor::ReceiveBuffer::read(const sp<ByteArray>& buffer, size_t offset, size_t count) {
+    if (buffer == nullptr) {
+        throw NullPointerException();
+    }
+    if ((offset + count) > buffer->size()) {
+        throw IndexOutOfBoundsException();
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (mCount - mPosition < count) {
+        underflow(count);
+        return -1;
+    }
+    std::memcpy(buffer->c_arr() + offset, mBuffer->c_arr() + mPosition, count);
+    mPosition += count;
+    return count;
+}
+
+void Reactor::ReceiveBuffer::require(size_t count) {
+    if (mCount - mPosition < count) {
+        underflow(count);
+        throw EOFException();
+    }
+}
+
+void Reactor::ReceiveBuffer::underflow(size_t count) {
+    mUnderflow = true;
+    mRequiredCount = mPosition + count - mMessagePosition;
+}
+
+ssize_t Reactor::ReceiveBuffer::receive(int32_t fd) {
+    if (mPosition == mCount) {
+        mPosition = mCount = 0;
+    } else if (mCount == mBuffer->size() || mPosition + mRequiredCount > mBuffer->size()) {
+        const size_t count = mCount - mPosition;
+        // Grow the buffer at once to the size of a pending message whose size is known. Otherwise
+        // the message is larger than the buffer and the buffer is doubled.
+        const size_t size = std::max((count == mBuffer->size()) ? mBuffer->size() * 2 : mBuffer->size(), mRequiredCount);
+        if (size > mBuffer->size()) {
+            sp<ByteArray> buffer = new ByteArray(size);
+            std::memcpy(buffer->c_arr(), mBuffer->c_arr() + mPosition, count);
+            mBuffer = buffer;
+        } else {
+            std::memmove(mBuffer->c_arr(), mBuffer->c_arr() + mPosition, count);
+        }
+        mCount = count;
+        mPosition = 0;
+    }
+
+    size_t size = 0;
+    while (mCount < mBuffer->size()) {
+        const ssize_t rc = ::recv(fd, mBuffer->c_arr() + mCount, mBuffer->size() - mCount, MSG_DONTWAIT);
+        if (rc > 0) {
+            mCount += (size_t) rc;
+            size += (size_t) rc;
+        } else if (rc == 0) {
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            throw IOException(String::format("Failed to read from socket (errno=%d)", errno));
+        }
+    }
+    return size;
+}
+
+void Reactor::ReceiveBuffer::dispatch(const std::function<void()>& decoder) {
+    while (mPosition < mCount) {
+        // A message is only decoded again once the bytes that it ran short of have been received.
+        if (mCount - mPosition < mRequiredCount) {
+            return;
+        }
+        mMessagePosition = mPosition;
+        mRequiredCount = 0;
+        mUnderflow = false;
+        try {
+            decoder();
+        } catch (const IOException& e) {
+            if (!mUnderflow) {
+                throw;
+            }
+            // Wait for the rest of the message.
+            mPosition = mMessagePosition;
+            return;
+        }
+        if (mPosition == mMessagePosition) {
+            return;
+        }
+    }
+}
+
+Reactor::Reactor(size_t threadCount) :
+        mThreadCount(threadCount),
+        mChannelIdGenerator(SHUTDOWN_EVENT_ID + 1) {
+    if (threadCount == 0) {
+        throw IllegalArgumentException("threadCount = 0");
+    }
+}
+
+Reactor::~Reactor() {
+    shutdown();
+}
+
+bool Reactor::isSupported() {
+#ifndef __APPLE__
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Reactor::start() {
+#ifdef __APPLE__
+    throw IOException("Reactor is not supported on this platform");
+#else
+    mEpollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd == -1) {
+        throw IOException(String::format("Failed to create epoll instance: %s (errno=%d)", strerror(errno), errno));
+    }
+    mEventFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mEventFd == -1) {
+        throw IOException(String::format("Failed to create eventfd: %s (errno=%d)", strerror(errno), errno));
+    }
+    // Level-triggered, so that the event wakes up all I/O threads.
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = SHUTDOWN_EVENT_ID;
+    if (::epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mEventFd, &event) != 0) {
+        throw IOException(String::format("Failed to watch eventfd: %s (errno=%d)", strerror(errno), errno));
+    }
+
+    for (size_t i = 0; i < mThreadCount; i++) {
+        sp<Thread> thread = new Thread([=] { run(); }, String::format("Reactor [%zu]", i));
+        mThreads->add(thread);
+        thread->start();
+    }
+#endif
+}
+
+void Reactor::shutdown() {
+    if (mEventFd != -1) {
+        const uint64_t value = 1;
+        if (::write(mEventFd, &value, sizeof(value)) != sizeof(value)) {
+            Log::e(TAG, "Failed to stop the I/O threads (errno=%d)", errno);
+        }
+    }
+    auto itr = mThreads->iterator();
+    while (itr.hasNext()) {
+        sp<Thread> thread = itr.next();
+        itr.remove();
+        thread->join();
+    }
+    mChannels->clear();
+    if (mEventFd != -1) {
+        ::close(mEventFd);
+        mEventFd = -1;
+    }
+    if (mEpollFd != -1) {
+        ::close(mEpollFd);
+        mEpollFd = -1;
+    }
+}
+
+void Reactor::add(const sp<Channel>& channel) {
+#ifdef __APPLE__
+    throw IOException("Reactor is not supported on this platform");
+#else
+    std::lock_guard<std::mutex> lock(channel->mLock);
+    channel->mId = mChannelIdGenerator++;
+    channel->mIsRegistered = true;
+    mChannels->put(channel->mId, channel);
+    // One-shot, so that a channel is only run by one I/O thread at a time. It is rearmed after each run.
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u64 = channel->mId;
+    if (::epoll_ctl(mEpollFd, EPOLL_CTL_ADD, channel->mFd, &event) != 0) {
+        const int32_t errorCode = errno;
+        channel->mIsRegistered = false;
+        mChannels->remove(channel->mId);
+        throw IOException(String::format("Failed to watch socket: %s (errno=%d)", strerror(errorCode), errorCode));
+    }
+#endif
+}
+
+void Reactor::remove(const sp<Channel>& channel) {
+    {
+        std::unique_lock<std::mutex> lock(channel->mLock);
+        if (channel->mIsRegistered) {
+            channel->mIsRegistered = false;
+#ifndef __APPLE__
+            if (mEpollFd != -1) {
+                ::epoll_ctl(mEpollFd, EPOLL_CTL_DEL, channel->mFd, nullptr);
+            }
+#endif
+        }
+        // The socket must not be closed while an I/O thread may still read from it.
+        while (channel->mIsRunning && channel->mRunningThread != std::this_thread::get_id()) {
+            channel->mCondition.wait(lock);
+        }
+    }
+    mChannels->remove(channel->mId);
+}
+
+#ifndef __APPLE__
+bool Reactor::beginRun(const sp<Channel>& channel) {
+    std::lock_guard<std::mutex> lock(channel->mLock);
+    if (!channel->mIsRegistered) {
+        return false;
+    }
+    channel->mIsRunning = true;
+    channel->mRunningThread = std::this_thread::get_id();
+    return true;
+}
+
+void Reactor::endRun(const sp<Channel>& channel, bool rearm) {
+    std::lock_guard<std::mutex> lock(channel->mLock);
+    channel->mIsRunning = false;
+    channel->mRunningThread = std::thread::id();
+    channel->mCondition.notify_all();
+    if (rearm && channel->mIsRegistered) {
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.u64 = channel->mId;
+        if (::epoll_ctl(mEpollFd, EPOLL_CTL_MOD, channel->mFd, &event) != 0) {
+            Log::e(TAG, "Failed to watch socket: %s (errno=%d)", strerror(errno), errno);
+        }
+    }
+}
+
+void Reactor::run() {
+    struct epoll_event events[MAX_EVENT_COUNT];
+    while (true) {
+        const int32_t count = ::epoll_wait(mEpollFd, events, MAX_EVENT_COUNT, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log::e(TAG, "Failed to wait for sockets: %s (errno=%d)", strerror(errno), errno);
+            return;
+        }
+        for (int32_t i = 0; i < count; i++) {
+            if (events[i].data.u64 == SHUTDOWN_EVENT_ID) {
+                return;
+            }
+            sp<Channel> channel = mChannels->get(events[i].data.u64);
+            if (channel == nullptr || !beginRun(channel)) {
+                continue;
+            }
+            // The callback is never changed, so it is run without the lock of the channel.
+            endRun(channel, channel->mOnReadable());
+        }
+    }
+}
+#endif
+
+} /* namespace mindroid */
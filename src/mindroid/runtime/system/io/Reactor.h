@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018 E.S.R.Labs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_RUNTIME_SYSTEM_IO_REACTOR_H_
+#define MINDROID_RUNTIME_SYSTEM_IO_REACTOR_H_
+
+#include <mindroid/lang/Object.h>
+#include <mindroid/lang/ByteArray.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/io/InputStream.h>
+#include <mindroid/util/ArrayList.h>
+#include <mindroid/util/concurrent/ConcurrentHashMap.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace mindroid {
+
+/**
+ * Event loop that serves many connections with a fixed number of I/O threads instead of a thread
+ * per connection. The I/O threads wait on an epoll set for sockets with data and run the channel
+ * of each readable socket. A channel is only ever run by one I/O thread at a time.
+ */
+class Reactor : public Object {
+public:
+    static const char* const TAG;
+
+    /**
+     * Registration of a socket with a reactor.
+     */
+    class Channel final : public Object {
+    public:
+        /**
+         * @param fd The socket.
+         * @param onReadable Called on an I/O thread when the socket has data or has been closed
+         * by the peer. Returns false once the channel should not be run anymore.
+         */
+        Channel(int32_t fd, const std::function<bool()>& onReadable) :
+                mFd(fd),
+                mOnReadable(onReadable) {
+        }
+
+    private:
+        const int32_t mFd;
+        std::function<bool()> mOnReadable;
+        uint64_t mId = 0;
+        std::mutex mLock;
+        bool mIsRegistered = false;
+        // Set while an I/O thread runs the channel, so that remove() can wait for it.
+        bool mIsRunning = false;
+        std::thread::id mRunningThread;
+        std::condition_variable mCondition;
+
+        friend class Reactor;
+    };
+
+    /**
+     * Input stream over the bytes that a reactor channel has received so far. It lets protocols
+     * that read their messages from a blocking input stream run on a reactor unchanged: A message
+     * is decoded by reading it from this stream. If the message is not complete yet, reading runs
+     * out of data, the read position is restored and decoding is retried when more data arrives.
+     * Therefore decoders must read a message completely before they act on it.
+     */
+    class ReceiveBuffer final : public InputStream {
+    public:
+        ReceiveBuffer(size_t size = 16 * 1024);
+
+        size_t available() override {
+            return mCount - mPosition;
+        }
+
+        using InputStream::read;
+        /**
+         * Returns -1 if no byte has been received yet.
+         */
+        int32_t read() override;
+        /**
+         * Reads exactly {@code count} bytes or returns -1 if fewer have been received yet.
+         */
+        ssize_t read(const sp<ByteArray>& buffer, size_t offset, size_t count) override;
+
+        /**
+         * Throws an EOFException if fewer than {@code count} bytes have been received yet. Decoders
+         * call it before they allocate a large payload, so that an incomplete message does not
+         * cost an allocation each time it is decoded again.
+         */
+        void require(size_t count);
+
+        /**
+         * Receives what the socket has without blocking.
+         *
+         * @return The number of received bytes, or -1 if the peer has closed the connection.
+         * @throws IOException if receiving fails.
+         */
+        ssize_t receive(int32_t fd);
+
+        /**
+         * Calls {@code decoder} for every complete message in the buffer. {@code decoder} reads
+         * a message from this stream and throws an IOException if it runs out of data.
+         *
+         * @throws IOException if {@code decoder} fails for other reasons than missing data.
+         */
+        void dispatch(const std::function<void()>& decoder);
+
+    private:
+        // Records that the message being decoded needs {@code count} more bytes from the read position.
+        void underflow(size_t count);
+
+        sp<ByteArray> mBuffer;
+        size_t mPosition = 0;
+        size_t mCount = 0;
+        bool mUnderflow = false;
+        // Start of the message being decoded and the number of bytes that it needs at least.
+        size_t mMessagePosition = 0;
+        size_t mRequiredCount = 0;
+    };
+
+    /**
+     * Creates a reactor with {@code threadCount} I/O threads.
+     */
+    Reactor(size_t threadCount);
+    virtual ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /**
+     * Returns whether the reactor has an event backend on this platform. Only Linux is supported
+     * (epoll).
+     */
+    static bool isSupported();
+
+    /**
+     * Starts the I/O threads.
+     *
+     * @throws IOException if the reactor is not supported on this platform or cannot be set up.
+     */
+    void start();
+
+    /**
+     * Stops the I/O threads and drops all channels.
+     */
+    void shutdown();
+
+    /**
+     * Runs {@code channel} whenever its socket becomes readable.
+     *
+     * @throws IOException if the socket cannot be watched.
+     */
+    void add(const sp<Channel>& channel);
+
+    /**
+     * Stops watching the socket of {@code channel} and waits until no I/O thread runs the channel
+     * anymore, unless it is called by the channel itself. Must be called before the socket is
+     * closed since file descriptors are reused.
+     */
+    void remove(const sp<Channel>& channel);
+
+private:
+    void run();
+    // Marks the channel as running unless it has been removed.
+    bool beginRun(const sp<Channel>& channel);
+    void endRun(const sp<Channel>& channel, bool rearm);
+
+    const size_t mThreadCount;
+    int32_t mEpollFd = -1;
+    int32_t mEventFd = -1;
+    sp<ArrayList<sp<Thread>>> mThreads = new ArrayList<sp<Thread>>();
+    sp<ConcurrentHashMap<uint64_t, sp<Channel>>> mChannels = new ConcurrentHashMap<uint64_t, sp<Channel>>();
+    std::atomic<uint64_t> mChannelIdGenerator;
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_RUNTIME_SYSTEM_IO_REACTOR_H_ */
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_UTIL_CONCURRENT_CONCURRENTHASHMAP_H_
+#define MINDROID_UTIL_CONCURRENT_CONCURRENTHASHMAP_H_
+
+#include <mindroid/lang/Object.h>
+#include <mindroid/util/ArrayList.h>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mindroid {
+
+/**
+ * Hash map that may be used by many threads at once. The map is split into SEGMENT_COUNT
+ * segments with a lock each, so operations on keys in different segments do not contend and
+ * lookups never allocate. Keys of type sp<T> are hashed with {@link Object#hashCode} and
+ * compared with {@link Object#equals}, like in {@link HashMap}.
+ *
+ * <p>
+ * Unlike HashMap, values are returned by value since an entry may be removed by another thread
+ * at any time. A missing entry yields a default-constructed value (nullptr for sp<> and wp<>).
+ */
+template<typename K, typename V>
+class ConcurrentHashMap final :
+        public Object {
+public:
+    static const size_t SEGMENT_COUNT = 16;
+
+    ConcurrentHashMap() = default;
+    virtual ~ConcurrentHashMap() = default;
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    void clear() {
+        for (Segment& segment : mSegments) {
+            // Destroy the entries outside of the lock since destructors may call back into the map.
+            Map entries;
+            std::lock_guard<std::mutex> lock(segment.lock);
+            segment.map.swap(entries);
+        }
+    }
+
+    bool containsKey(const K& key) {
+        Segment& segment = getSegment(key);
+        std::lock_guard<std::mutex> lock(segment.lock);
+        return segment.map.find(key) != segment.map.end();
+    }
+
+    V get(const K& key) {
+        Segment& segment = getSegment(key);
+        std::lock_guard<std::mutex> lock(segment.lock);
+        auto itr = segment.map.find(key);
+        return (itr != segment.map.end()) ? itr->second : V();
+    }
+
+    bool isEmpty() {
+        return size() == 0;
+    }
+
+    /**
+     * Associates the value with the key and returns the previous value.
+     */
+    V put(const K& key, const V& value) {
+        Segment& segment = getSegment(key);
+        std::lock_guard<std::mutex> lock(segment.lock);
+        V& entry = segment.map[key];
+        V oldValue = entry;
+        entry = value;
+        return oldValue;
+    }
+
+    /**
+     * Associates the value with the key unless the key is already mapped. Returns the previous
+     * value, so a default-constructed value means that the value was put.
+     */
+    V putIfAbsent(const K& key, const V& value) {
+        Segment& segment = getSegment(key);
+        std::lock_guard<std::mutex> lock(segment.lock);
+        auto result = segment.map.emplace(key, value);
+        return result.second ? V() : result.first->second;
+    }
+
+    V remove(const K& key) {
+        Segment& segment = getSegment(key);
+        std::lock_guard<std::mutex> lock(segment.lock);
+        auto itr = segment.map.find(key);
+        if (itr == segment.map.end()) {
+            return V();
+        }
+        V oldValue = itr->second;
+        segment.map.erase(itr);
+        return oldValue;
+    }
+
+    /**
+     * Removes the entry for the key only if it is still mapped to the given value, so an entry
+     * that another thread has put in the meantime is kept. Returns true if the entry was removed.
+     */
+    bool remove(const K& key, const V& value) {
+        Segment& segment = getSegment(key);
+        // Destroy the entry outside of the lock since destructors may call back into the map.
+        V oldValue;
+        std::lock_guard<std::mutex> lock(segment.lock);
+        auto itr = segment.map.find(key);
+        if (itr == segment.map.end() || !(itr->second == value)) {
+            return false;
+        }
+        oldValue = std::move(itr->second);
+        segment.map.erase(itr);
+        return true;
+    }
+
+    /**
+     * Removes all entries for which predicate(key, value) returns true and returns their number.
+     * The predicate is called with the lock of a segment held, so it must not access the map.
+     */
+    template<typename P>
+    size_t removeIf(P predicate) {
+        std::vector<V> values;
+        for (Segment& segment : mSegments) {
+            std::lock_guard<std::mutex> lock(segment.lock);
+            for (auto itr = segment.map.begin(); itr != segment.map.end();) {
+                if (predicate(itr->first, itr->second)) {
+                    values.push_back(std::move(itr->second));
+                    itr = segment.map.erase(itr);
+                } else {
+                    ++itr;
+                }
+            }
+        }
+        return values.size();
+    }
+
+    size_t size() {
+        size_t size = 0;
+        for (Segment& segment : mSegments) {
+            std::lock_guard<std::mutex> lock(segment.lock);
+            size += segment.map.size();
+        }
+        return size;
+    }
+
+    /**
+     * Returns a snapshot of the values. Concurrent modifications may or may not be reflected.
+     */
+    sp<ArrayList<V>> values() {
+        sp<ArrayList<V>> values = new ArrayList<V>();
+        for (Segment& segment : mSegments) {
+            std::lock_guard<std::mutex> lock(segment.lock);
+            for (const auto& entry : segment.map) {
+                values->add(entry.second);
+            }
+        }
+        return values;
+    }
+
+private:
+    template<typename T>
+    struct KeyHasher : std::hash<T> {
+    };
+
+    template<typename T>
+    struct KeyHasher<sp<T>> : Hasher<sp<T>> {
+    };
+
+    template<typename T>
+    struct KeyEqualityComparator : std::equal_to<T> {
+    };
+
+    template<typename T>
+    struct KeyEqualityComparator<sp<T>> : EqualityComparator<sp<T>> {
+    };
+
+    typedef std::unordered_map<K, V, KeyHasher<K>, KeyEqualityComparator<K>> Map;
+
+    struct Segment {
+        std::mutex lock;
+        Map map;
+    };
+
+    Segment& getSegment(const K& key) {
+        size_t hash = KeyHasher<K>()(key);
+        hash ^= (hash >> 16) ^ (hash >> 8);
+        return mSegments[hash % SEGMENT_COUNT];
+    }
+
+    Segment mSegments[SEGMENT_COUNT];
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_UTIL_CONCURRENT_CONCURRENTHASHMAP_H_ */
@@ -1845,7 +1845,8 @@ private:
         static std::function<void (T, const sp<mindroid::Exception>&)> add(const sp<Runnable>& command, uint64_t delay) {
             sLock.lock();
             if (sThread == nullptr) {
-                sThread = new HandlerThread("TimeoutExecutorDaemon");
+                // Every promise with a timeout schedules and cancels a timer on this thread.
+                sThread = new HandlerThread("TimeoutExecutorDaemon", MessageQueue::FLAG_TIMER_HEAP | MessageQueue::FLAG_MESSAGE_INDEX);
                 sThread->start();
                 sHandler = new Handler(sThread->getLooper());
             }
@@ -31,6 +31,7 @@ public:
     Condition& operator=(const Condition&) = delete;
     virtual void await() = 0;
     virtual bool await(uint64_t timeoutMillis) = 0;
+    virtual bool awaitNanos(uint64_t timeoutNanos) = 0;
     virtual void signal() = 0;
     virtual void signalAll() = 0;
 };
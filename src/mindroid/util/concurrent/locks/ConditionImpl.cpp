@@ -31,6 +31,10 @@ bool ConditionImpl::await(uint64_t timeoutMillis) {
     return mCondition.wait_for(mLock, std::chrono::milliseconds(timeoutMillis)) == std::cv_status::no_timeout;
 }
 
+bool ConditionImpl::awaitNanos(uint64_t timeoutNanos) {
+    return mCondition.wait_for(mLock, std::chrono::nanoseconds(timeoutNanos)) == std::cv_status::no_timeout;
+}
+
 void ConditionImpl::signal() {
     mCondition.notify_one();
 }
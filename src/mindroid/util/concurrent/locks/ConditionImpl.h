@@ -32,6 +32,7 @@ public:
     ConditionImpl& operator=(const ConditionImpl&) = delete;
     virtual void await();
     virtual bool await(uint64_t timeoutMillis);
+    virtual bool awaitNanos(uint64_t timeoutNanos);
     virtual void signal();
     virtual void signalAll();
 
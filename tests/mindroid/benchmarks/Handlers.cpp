@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/os/Handler.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/MessageQueue.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/Runnable.h>
+#include <mindroid/util/concurrent/Promise.h>
+#include <mindroid/lang/Object.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+using namespace mindroid;
+
+/*
+ * Periodic tick that measures the gap between its scheduled and its actual dispatch time.
+ */
+class Ticker : public Runnable {
+public:
+    Ticker(const sp<Handler>& handler, uint64_t periodNanos, size_t ticks) :
+            mHandler(handler),
+            mPeriod(periodNanos),
+            mTicks(ticks),
+            mWhen(0),
+            mPromise(new Promise<bool>()) {
+        mLatencies.reserve(ticks);
+    }
+
+    sp<Promise<bool>> start() {
+        mWhen = SystemClock::uptimeNanos() + mPeriod;
+        mHandler->postAtTimeNanos(this, mWhen);
+        return mPromise;
+    }
+
+    void run() override {
+        mLatencies.push_back(SystemClock::uptimeNanos() - mWhen);
+        if (mLatencies.size() == mTicks) {
+            mPromise->complete(true);
+            return;
+        }
+        mWhen += mPeriod;
+        mHandler->postAtTimeNanos(this, mWhen);
+    }
+
+    std::vector<uint64_t> getLatencies() {
+        return mLatencies;
+    }
+
+private:
+    sp<Handler> mHandler;
+    const uint64_t mPeriod;
+    const size_t mTicks;
+    uint64_t mWhen;
+    std::vector<uint64_t> mLatencies;
+    sp<Promise<bool>> mPromise;
+};
+
+TEST(Benchmarks, HandlerJitter) {
+    const size_t TICKS = 1000;
+
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    const uint64_t periods[] = { 100000, 500000 };
+    for (uint64_t period : periods) {
+        sp<Ticker> ticker = new Ticker(handler, period, TICKS);
+        ASSERT_TRUE(ticker->start()->get(60000));
+
+        std::vector<uint64_t> latencies = ticker->getLatencies();
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t sum = 0;
+        for (uint64_t latency : latencies) {
+            sum += latency;
+        }
+        printf("[ BENCHMARK] %4" PRIu64 " us period: dispatch latency mean %7.1f us, median %7.1f us, p99 %7.1f us, max %7.1f us\n",
+                period / 1000,
+                sum / 1000.0 / latencies.size(),
+                latencies[latencies.size() / 2] / 1000.0,
+                latencies[(latencies.size() * 99) / 100] / 1000.0,
+                latencies.back() / 1000.0);
+    }
+
+    thread->quit();
+}
+
+/*
+ * Measures the per-message cost of draining a burst of messages that arrived while the Looper was busy.
+ */
+static void benchmarkBurst(const char* name, uint32_t flags, int32_t messages, int32_t bursts) {
+    sp<HandlerThread> thread = new HandlerThread(name, flags);
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    uint64_t duration = 0;
+    for (int32_t i = 0; i < bursts; i++) {
+        sp<Promise<bool>> blocker = new Promise<bool>();
+        handler->post([=] { blocker->get(); });
+        for (int32_t j = 0; j < messages; j++) {
+            handler->sendEmptyMessage(j);
+        }
+        sp<Promise<uint64_t>> promise = new Promise<uint64_t>();
+        handler->post([=] { promise->complete(SystemClock::uptimeNanos()); });
+
+        const uint64_t start = SystemClock::uptimeNanos();
+        blocker->complete(true);
+        duration += promise->get(60000) - start;
+    }
+
+    printf("[ BENCHMARK] %-12s burst of %5d messages: %6.3f us per message\n",
+            name, messages, duration / 1000.0 / bursts / (messages + 1));
+
+    thread->quit();
+}
+
+TEST(Benchmarks, LooperBurstDispatch) {
+    const int32_t BURSTS = 20;
+
+    const int32_t messages[] = { 100, 10000 };
+    for (int32_t size : messages) {
+        benchmarkBurst("single", 0, size, BURSTS);
+        benchmarkBurst("batched", MessageQueue::FLAG_BATCHED_DISPATCH, size, BURSTS);
+        benchmarkBurst("instrumented", MessageQueue::FLAG_INSTRUMENTATION, size, BURSTS);
+    }
+}
+
+class Referenceable : public Object {
+public:
+    using Object::setThreadConfined;
+};
+
+TEST(Benchmarks, ThreadConfinedReferenceCounting) {
+    const int32_t COPIES = 10000000;
+
+    for (bool threadConfined : { false, true }) {
+        sp<Referenceable> object = new Referenceable();
+        object->setThreadConfined(threadConfined);
+        const uint64_t start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < COPIES; i++) {
+            sp<Referenceable> copy = object;
+        }
+        const uint64_t duration = SystemClock::uptimeNanos() - start;
+        printf("[ BENCHMARK] %-14s sp<> copy: %6.2f ns\n",
+                threadConfined ? "thread-confined" : "atomic", (double) duration / COPIES);
+    }
+}
+
+/*
+ * Chain of messages that a Looper sends to itself: obtain, send, dispatch and recycle.
+ */
+class ChainHandler : public Handler {
+public:
+    ChainHandler(const sp<Looper>& looper, int32_t messages) :
+            Handler(looper),
+            mPromise(new Promise<uint64_t>()),
+            mMessages(messages) {
+    }
+
+    void handleMessage(const sp<Message>& msg) override {
+        if (msg->what < mMessages) {
+            obtainMessage(msg->what + 1)->sendToTarget();
+        } else {
+            mPromise->complete(SystemClock::uptimeNanos());
+        }
+    }
+
+    sp<Promise<uint64_t>> mPromise;
+
+private:
+    const int32_t mMessages;
+};
+
+static void benchmarkChain(const char* name, uint32_t flags, int32_t messages) {
+    sp<HandlerThread> thread = new HandlerThread(name, flags);
+    thread->start();
+    // Warm up the message pool cache of the Looper thread.
+    sp<ChainHandler> handler = new ChainHandler(thread->getLooper(), 1000);
+    handler->sendEmptyMessage(0);
+    handler->mPromise->get(60000);
+
+    handler = new ChainHandler(thread->getLooper(), messages);
+    const uint64_t start = SystemClock::uptimeNanos();
+    handler->sendEmptyMessage(0);
+    const uint64_t duration = handler->mPromise->get(60000) - start;
+    printf("[ BENCHMARK] %-14s obtain/dispatch chain of %6d messages: %6.3f us per message\n",
+            name, messages, duration / 1000.0 / (messages + 1));
+
+    thread->quit();
+}
+
+TEST(Benchmarks, ThreadConfinedMessages) {
+    const int32_t MESSAGES = 100000;
+
+    benchmarkChain("atomic", 0, MESSAGES);
+    benchmarkChain("thread-confined", MessageQueue::FLAG_THREAD_CONFINED_MESSAGES, MESSAGES);
+    benchmarkChain("atomic", 0, MESSAGES);
+    benchmarkChain("thread-confined", MessageQueue::FLAG_THREAD_CONFINED_MESSAGES, MESSAGES);
+}
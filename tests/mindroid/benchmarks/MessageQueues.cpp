@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/os/Handler.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Message.h>
+#include <mindroid/os/MessageQueue.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/Runnable.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace mindroid;
+
+static uint64_t nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Measures the per-operation cost of scheduling, cancelling and expiring timers on a MessageQueue
+ * that already holds a given number of pending timers.
+ */
+static void benchmarkTimers(const sp<Handler>& handler, const char* name, uint32_t flags, size_t pendingTimers, size_t operations) {
+    const uint64_t HOUR = 60 * 60 * 1000;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<uint64_t> delay(0, HOUR);
+
+    sp<MessageQueue> queue = new MessageQueue(true, flags);
+    const uint64_t now = SystemClock::uptimeMillis();
+    for (size_t i = 0; i < pendingTimers; i++) {
+        queue->enqueueMessage(Message::obtain(handler, 1), now + HOUR + (i * HOUR) / pendingTimers);
+    }
+
+    std::vector<sp<Runnable>> runnables;
+    for (size_t i = 0; i < operations; i++) {
+        runnables.push_back(new Runnable([] { }));
+    }
+
+    uint64_t start = nanos();
+    for (size_t i = 0; i < operations; i++) {
+        queue->enqueueMessage(Message::obtain(handler, runnables[i]), now + HOUR + delay(random));
+    }
+    const uint64_t enqueueDuration = nanos() - start;
+
+    start = nanos();
+    for (size_t i = 0; i < operations; i++) {
+        ASSERT_TRUE(queue->removeCallbacks(handler, runnables[i], nullptr));
+    }
+    const uint64_t cancelDuration = nanos() - start;
+
+    for (size_t i = 0; i < operations; i++) {
+        queue->enqueueMessage(Message::obtain(handler, 2), now - delay(random) % now);
+    }
+    uint64_t when = 0;
+    start = nanos();
+    for (size_t i = 0; i < operations; i++) {
+        sp<Message> message = queue->dequeueMessage();
+        ASSERT_EQ(message->what, 2);
+        ASSERT_GE(message->getWhen(), when);
+        when = message->getWhen();
+    }
+    const uint64_t expireDuration = nanos() - start;
+
+    printf("[ BENCHMARK] %-6s %7zu pending timers: enqueue %8.2f us, cancel %8.2f us, expire %8.2f us\n",
+            name, pendingTimers,
+            enqueueDuration / 1000.0 / operations,
+            cancelDuration / 1000.0 / operations,
+            expireDuration / 1000.0 / operations);
+
+    queue->quit();
+}
+
+TEST(Benchmarks, MessageQueueTimers) {
+    const size_t OPERATIONS = 100;
+
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    const size_t pendingTimers[] = { 10, 1000, 100000 };
+    for (size_t size : pendingTimers) {
+        benchmarkTimers(handler, "list", 0, size, OPERATIONS);
+        benchmarkTimers(handler, "heap", MessageQueue::FLAG_TIMER_HEAP, size, OPERATIONS);
+        benchmarkTimers(handler, "index", MessageQueue::FLAG_TIMER_HEAP | MessageQueue::FLAG_MESSAGE_INDEX, size, OPERATIONS);
+    }
+
+    thread->quit();
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/ByteArrayInputStream.h>
+#include <mindroid/io/ByteArrayOutputStream.h>
+#include <mindroid/io/DataInputStream.h>
+#include <mindroid/io/DataOutputStream.h>
+#include <mindroid/os/Bundle.h>
+#include <mindroid/os/Handler.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Message.h>
+#include <mindroid/os/Parcel.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/lang/String.h>
+#include <mindroid/util/concurrent/Promise.h>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+using namespace mindroid;
+
+// Counts the heap allocations of the current thread. Objects come from the Allocator pools and
+// only show up here when the pools need a new chunk.
+static thread_local uint64_t sAllocationCount = 0;
+
+void* operator new(size_t size) {
+    sAllocationCount++;
+    void* pointer = std::malloc(size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+template<typename F>
+static void benchmarkAllocations(const char* name, int32_t iterations, F workload) {
+    const uint64_t allocationCount = sAllocationCount;
+    const uint64_t start = SystemClock::uptimeNanos();
+    for (int32_t i = 0; i < iterations; i++) {
+        workload(i);
+    }
+    const uint64_t duration = SystemClock::uptimeNanos() - start;
+    printf("[ BENCHMARK] %-20s %6.1f allocations, %7.3f us per iteration\n",
+            name, (double) (sAllocationCount - allocationCount) / iterations, duration / 1000.0 / iterations);
+}
+
+TEST(Benchmarks, ObjectAllocations) {
+    const int32_t ITERATIONS = 100000;
+
+    benchmarkAllocations("String", ITERATIONS, [] (int32_t i) {
+        sp<String> string = String::valueOf(i);
+        ASSERT_GT(string->length(), 0u);
+    });
+
+    benchmarkAllocations("Bundle", ITERATIONS, [] (int32_t i) {
+        sp<Bundle> bundle = new Bundle();
+        bundle->putInt("id", i);
+        bundle->putBoolean("enabled", true);
+        bundle->putString("name", "Mindroid");
+        bundle->putDouble("value", 3.14);
+        ASSERT_EQ(bundle->getInt("id"), i);
+        ASSERT_NE(bundle->getString("name"), nullptr);
+    });
+
+    benchmarkAllocations("Parcel", ITERATIONS, [] (int32_t i) {
+        sp<Parcel> parcel = Parcel::obtain();
+        parcel->putInt(i);
+        parcel->putLong(i);
+        parcel->putString(String::valueOf("Mindroid"));
+        parcel->putDouble(3.14);
+        parcel->asInput();
+        ASSERT_EQ(parcel->getInt(), i);
+        ASSERT_EQ(parcel->getLong(), (uint64_t) i);
+        ASSERT_NE(parcel->getString(), nullptr);
+        parcel->recycle();
+    });
+
+    benchmarkAllocations("Message with Bundle", ITERATIONS, [] (int32_t i) {
+        sp<Message> message = Message::obtain();
+        message->what = i;
+        message->getData()->putInt("id", i);
+        message->getData()->putString("name", "Mindroid");
+        ASSERT_EQ(message->peekData()->getInt("id"), i);
+    });
+}
+
+TEST(Benchmarks, BundleKeys) {
+    const int32_t ITERATIONS = 100000;
+
+    sp<Bundle> bundle = new Bundle();
+    sp<String> internedKey = String::intern("dataInputStream");
+    bundle->putInt(internedKey, 42);
+    for (int32_t i = 0; i < 16; i++) {
+        bundle->putInt(String::format("key%d", i), i);
+    }
+
+    benchmarkAllocations("const char* key", ITERATIONS, [&] (int32_t) {
+        ASSERT_EQ(bundle->getInt("dataInputStream"), 42);
+    });
+    sp<String> key = String::valueOf("dataInputStream");
+    benchmarkAllocations("String key", ITERATIONS, [&] (int32_t) {
+        ASSERT_EQ(bundle->getInt(key), 42);
+    });
+    benchmarkAllocations("interned key", ITERATIONS, [&] (int32_t) {
+        ASSERT_EQ(bundle->getInt(internedKey), 42);
+    });
+}
+
+TEST(Benchmarks, HandlerPostAllocations) {
+    const int32_t ITERATIONS = 1000;
+    const int32_t POSTS = 10;
+
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+    int32_t counter = 0;
+
+    benchmarkAllocations("10 x Handler::post", ITERATIONS, [&] (int32_t) {
+        // Only the last post of each iteration allocates a Promise.
+        for (int32_t j = 0; j < POSTS - 1; j++) {
+            handler->post([&counter, handler, j] { counter += j; });
+        }
+        sp<Promise<bool>> done = new Promise<bool>();
+        handler->post([done] { done->complete(true); });
+        done->get(60000);
+    });
+
+    thread->quit();
+    thread->join();
+}
+
+/*
+ * Allocates and frees batches of blocks through malloc and through the pool allocators.
+ */
+template<typename Allocate, typename Free>
+static void benchmarkAllocator(const char* name, size_t size, Allocate allocate, Free free) {
+    const int32_t ITERATIONS = 10000;
+    const int32_t BATCH_SIZE = 100;
+
+    void* blocks[BATCH_SIZE];
+    const uint64_t start = SystemClock::uptimeNanos();
+    for (int32_t i = 0; i < ITERATIONS; i++) {
+        for (int32_t j = 0; j < BATCH_SIZE; j++) {
+            blocks[j] = allocate(size);
+        }
+        for (int32_t j = 0; j < BATCH_SIZE; j++) {
+            free(blocks[j], size);
+        }
+    }
+    const uint64_t duration = SystemClock::uptimeNanos() - start;
+    printf("[ BENCHMARK] %-14s %4zu bytes: %6.2f ns per allocation and free\n",
+            name, size, (double) duration / ITERATIONS / BATCH_SIZE);
+}
+
+TEST(Benchmarks, PoolAllocator) {
+    PoolAllocator* arena = new PoolAllocator();
+    for (size_t size : { 32, 192, 1024 }) {
+        benchmarkAllocator("malloc", size, [] (size_t size) { return std::malloc(size); },
+                [] (void* pointer, size_t) { std::free(pointer); });
+        benchmarkAllocator("thread-caching", size, [] (size_t size) { return Allocator::getDefault()->allocate(size); },
+                [] (void* pointer, size_t size) { Allocator::getDefault()->free(pointer, size); });
+        benchmarkAllocator("arena", size, [arena] (size_t size) { return arena->allocate(size); },
+                [arena] (void* pointer, size_t size) { arena->free(pointer, size); });
+    }
+    printf("%s\n", Allocator::getDefault()->dump()->c_str());
+    arena->close();
+}
+
+TEST(Benchmarks, ParcelPool) {
+    const int32_t ITERATIONS = 100000;
+
+    // A request and a reply Parcel per transaction. The objects are allocated from an arena,
+    // whose statistics are exact.
+    for (int32_t recycle = 0; recycle <= 1; recycle++) {
+        PoolAllocator* arena = new PoolAllocator();
+        Allocator::setThreadAllocator(arena);
+        const uint64_t hitCount = Parcel::getPoolHitCount();
+        const uint64_t missCount = Parcel::getPoolMissCount();
+        const uint64_t start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < ITERATIONS; i++) {
+            sp<Parcel> data = Parcel::obtain();
+            data->putInt(i);
+            data->putString(String::valueOf("Mindroid"));
+            sp<Parcel> reply = Parcel::obtain(512);
+            reply->putBytes(data->getByteArray(), 0, data->size());
+            ASSERT_EQ(reply->size(), data->size());
+            if (recycle) {
+                reply->recycle();
+                data->recycle();
+            }
+        }
+        const uint64_t duration = SystemClock::uptimeNanos() - start;
+        Allocator::setThreadAllocator(nullptr);
+        const uint64_t hits = Parcel::getPoolHitCount() - hitCount;
+        const uint64_t misses = Parcel::getPoolMissCount() - missCount;
+        printf("[ BENCHMARK] Parcels %-12s %5.1f allocations, %7.3f us per transaction, %5.1f%% pool hits\n",
+                recycle ? "recycled" : "not recycled", (double) arena->getAllocationCount() / ITERATIONS,
+                duration / 1000.0 / ITERATIONS, 100.0 * hits / (hits + misses));
+        arena->close();
+    }
+}
+
+TEST(Benchmarks, ParcelMarshalling) {
+    const int32_t ITERATIONS = 1000;
+    const int32_t FIELD_COUNT = 1000;
+    sp<String> string = String::valueOf("Mindroid");
+    int32_t ints[FIELD_COUNT];
+    for (int32_t i = 0; i < FIELD_COUNT; i++) {
+        ints[i] = i * 7919;
+    }
+
+    auto benchmark = [&] (const char* name, const std::function<size_t ()>& marshal) {
+        size_t size = 0;
+        const uint64_t start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < ITERATIONS; i++) {
+            size = marshal();
+        }
+        const uint64_t duration = SystemClock::uptimeNanos() - start;
+        printf("[ BENCHMARK] %-32s %6zu bytes, %8.3f us per %d fields\n", name, size, duration / 1000.0 / ITERATIONS, FIELD_COUNT);
+    };
+
+    // The mixed fields are ints, longs, doubles and strings in turn.
+    benchmark("DataOutputStream mixed fields", [&] {
+        sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+        sp<DataOutputStream> dataOutputStream = new DataOutputStream(outputStream);
+        for (int32_t i = 0; i < FIELD_COUNT; i += 4) {
+            dataOutputStream->writeInt(i);
+            dataOutputStream->writeLong(i);
+            dataOutputStream->writeDouble(i * 0.5);
+            dataOutputStream->writeUTF(string);
+        }
+        return outputStream->size();
+    });
+    benchmark("Parcel mixed fields", [&] {
+        sp<Parcel> parcel = Parcel::obtain();
+        for (int32_t i = 0; i < FIELD_COUNT; i += 4) {
+            parcel->putInt(i);
+            parcel->putLong(i);
+            parcel->putDouble(i * 0.5);
+            parcel->putString(string);
+        }
+        const size_t size = parcel->size();
+        parcel->recycle();
+        return size;
+    });
+    benchmark("Parcel putInt() x 1000", [&] {
+        sp<Parcel> parcel = Parcel::obtain();
+        for (int32_t i = 0; i < FIELD_COUNT; i++) {
+            parcel->putInt(ints[i]);
+        }
+        const size_t size = parcel->size();
+        parcel->recycle();
+        return size;
+    });
+    benchmark("Parcel putInts()", [&] {
+        sp<Parcel> parcel = Parcel::obtain();
+        parcel->putInts(ints, FIELD_COUNT);
+        const size_t size = parcel->size();
+        parcel->recycle();
+        return size;
+    });
+
+    sp<Parcel> message = Parcel::obtain();
+    for (int32_t i = 0; i < FIELD_COUNT; i += 4) {
+        message->putInt(i);
+        message->putLong(i);
+        message->putDouble(i * 0.5);
+        message->putString(string);
+    }
+    sp<ByteArray> buffer = message->getByteArray();
+    const size_t size = message->size();
+    benchmark("DataInputStream unmarshalling", [&] {
+        sp<DataInputStream> dataInputStream = new DataInputStream(new ByteArrayInputStream(buffer, 0, size));
+        for (int32_t i = 0; i < FIELD_COUNT; i += 4) {
+            dataInputStream->readInt();
+            dataInputStream->readLong();
+            dataInputStream->readDouble();
+            dataInputStream->readUTF();
+        }
+        return size;
+    });
+    benchmark("Parcel view unmarshalling", [&] {
+        sp<Parcel> parcel = Parcel::obtain(buffer, 0, size);
+        for (int32_t i = 0; i < FIELD_COUNT; i += 4) {
+            parcel->getInt();
+            parcel->getLong();
+            parcel->getDouble();
+            parcel->getString();
+        }
+        return size;
+    });
+}
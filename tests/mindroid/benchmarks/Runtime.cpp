@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/File.h>
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/net/URI.h>
+#include <mindroid/os/Binder.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/runtime/system/Runtime.h>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+using namespace mindroid;
+
+/*
+ * Measures a workload and counts the objects that it allocates. The objects are allocated from a
+ * private arena whose statistics are exact.
+ */
+template<typename F>
+static void benchmarkLookups(const char* name, int32_t iterations, F workload) {
+    PoolAllocator* arena = new PoolAllocator();
+    Allocator::setThreadAllocator(arena);
+    const uint64_t start = SystemClock::uptimeNanos();
+    for (int32_t i = 0; i < iterations; i++) {
+        workload();
+    }
+    const uint64_t duration = SystemClock::uptimeNanos() - start;
+    Allocator::setThreadAllocator(nullptr);
+    printf("[ BENCHMARK] %-30s %5.1f allocations, %7.3f us per lookup\n",
+            name, (double) arena->getAllocationCount() / iterations, duration / 1000.0 / iterations);
+    arena->close();
+}
+
+TEST(Benchmarks, RuntimeBinderLookup) {
+    const int32_t ITERATIONS = 100000;
+
+    Runtime::start(1, nullptr);
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    {
+        sp<Binder> binder = new Binder(thread->getLooper());
+        binder->attachInterface(nullptr, String::valueOf("mindroid://interfaces/Benchmark"));
+        sp<Runtime> runtime = Runtime::getRuntime();
+        sp<URI> uri = binder->getUri();
+        sp<String> uriString = String::valueOf(uri->toString()->c_str());
+
+        benchmarkLookups("getBinder(URI)", ITERATIONS, [&] {
+            ASSERT_TRUE(runtime->getBinder(uri) == binder);
+        });
+        benchmarkLookups("getBinder(String)", ITERATIONS, [&] {
+            ASSERT_TRUE(runtime->getBinder(uriString) == binder);
+        });
+        benchmarkLookups("getBinder(URI::create(String))", ITERATIONS, [&] {
+            ASSERT_TRUE(runtime->getBinder(URI::create(uriString)) == binder);
+        });
+    }
+    thread->quit();
+    thread->join();
+    Runtime::shutdown();
+}
+
+TEST(Benchmarks, RuntimeRegistryContention) {
+    const int32_t THREAD_COUNT = 2;
+    const int32_t BINDER_COUNT = 20000;
+
+    Runtime::start(1, nullptr);
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    {
+        sp<Runtime> runtime = Runtime::getRuntime();
+        sp<Binder> binder = new Binder(thread->getLooper());
+        binder->attachInterface(nullptr, String::valueOf("mindroid://interfaces/Benchmark"));
+        sp<String> uri = String::valueOf(binder->getUri()->toString()->c_str());
+        const uint64_t id = binder->getId();
+
+        // Dispatchers resolve the target Binder of incoming transactions like
+        // Mindroid::Server::onTransact while other threads create and destroy callback Binders.
+        std::atomic<int32_t> creators(THREAD_COUNT);
+        std::atomic<uint64_t> lookupCount(0);
+        std::vector<sp<Thread>> threads;
+        const uint64_t start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < THREAD_COUNT; i++) {
+            threads.push_back(new Thread([&] {
+                for (int32_t j = 0; j < BINDER_COUNT; j++) {
+                    sp<Binder> callback = new Binder(thread->getLooper());
+                    callback->attachInterface(nullptr, String::valueOf("mindroid://interfaces/Callback"));
+                }
+                creators--;
+            }));
+            threads.push_back(new Thread([&] {
+                uint64_t count = 0;
+                while (creators > 0) {
+                    ASSERT_TRUE(runtime->getBinder(uri) == binder);
+                    ASSERT_TRUE(runtime->getBinder(id) == binder);
+                    count++;
+                }
+                lookupCount += count;
+            }));
+        }
+        for (const sp<Thread>& t : threads) {
+            t->start();
+        }
+        for (const sp<Thread>& t : threads) {
+            t->join();
+        }
+        const uint64_t duration = SystemClock::uptimeNanos() - start;
+        printf("[ BENCHMARK] %d threads created %d Binders in %.1f ms, %d threads did %.0f lookups per ms meanwhile\n",
+                THREAD_COUNT, THREAD_COUNT * BINDER_COUNT, duration / 1000000.0, THREAD_COUNT,
+                lookupCount * 1000000.0 / duration);
+    }
+    thread->quit();
+    thread->join();
+    Runtime::shutdown();
+}
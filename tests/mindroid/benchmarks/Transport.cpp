@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/BufferedInputStream.h>
+#include <mindroid/io/ByteArrayInputStream.h>
+#include <mindroid/io/ByteArrayOutputStream.h>
+#include <mindroid/io/DataInputStream.h>
+#include <mindroid/io/DataOutputStream.h>
+#include <mindroid/io/File.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/net/InetAddress.h>
+#include <mindroid/net/InetSocketAddress.h>
+#include <mindroid/net/ServerSocket.h>
+#include <mindroid/net/Socket.h>
+#include <mindroid/os/Binder.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Parcel.h>
+#include <mindroid/os/SystemClock.h>
+#include <mindroid/runtime/system/Mindroid.h>
+#include <mindroid/runtime/system/Runtime.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+using namespace mindroid;
+
+/*
+ * Socket stream decorators that count the calls into the socket streams. Every call is one
+ * recv, send or sendmsg system call unless the kernel accepts a write only partially.
+ */
+class CountingInputStream : public InputStream {
+public:
+    CountingInputStream(const sp<InputStream>& inputStream) : mInputStream(inputStream) {
+    }
+
+    using InputStream::read;
+
+    int32_t read() override {
+        mCount++;
+        return mInputStream->read();
+    }
+
+    ssize_t read(const sp<ByteArray>& buffer, size_t offset, size_t count) override {
+        mCount++;
+        return mInputStream->read(buffer, offset, count);
+    }
+
+    uint64_t getCount() const {
+        return mCount;
+    }
+
+private:
+    sp<InputStream> mInputStream;
+    uint64_t mCount = 0;
+};
+
+class CountingOutputStream : public OutputStream {
+public:
+    CountingOutputStream(const sp<OutputStream>& outputStream) : mOutputStream(outputStream) {
+    }
+
+    using OutputStream::write;
+
+    void write(int32_t b) override {
+        mCount++;
+        mOutputStream->write(b);
+    }
+
+    void write(const sp<ByteArray>& buffer, size_t offset, size_t count) override {
+        mCount++;
+        mOutputStream->write(buffer, offset, count);
+    }
+
+    void write(const sp<ByteArray>& buffer, size_t offset, size_t count,
+            const sp<ByteArray>& nextBuffer, size_t nextOffset, size_t nextCount) override {
+        mCount++;
+        mOutputStream->write(buffer, offset, count, nextBuffer, nextOffset, nextCount);
+    }
+
+    uint64_t getCount() const {
+        return mCount;
+    }
+
+private:
+    sp<OutputStream> mOutputStream;
+    uint64_t mCount = 0;
+};
+
+/*
+ * The message encoding that wrote each field directly to the socket stream.
+ */
+static void writeUnbuffered(const sp<Mindroid::Message>& message, const sp<DataOutputStream>& outputStream) {
+    outputStream->writeInt(message->type);
+    outputStream->writeUTF(message->uri);
+    outputStream->writeInt(message->transactionId);
+    outputStream->writeInt(message->what);
+    outputStream->writeInt(message->size);
+    outputStream->write(message->data, 0, message->size);
+    outputStream->flush();
+}
+
+/*
+ * Streams messages from one socket to another over loopback like a Mindroid client and server.
+ */
+static void benchmarkTransport(const char* name, int32_t messageCount, size_t payloadSize, bool buffered) {
+    sp<InetAddress> inetAddress = InetAddress::getByName("127.0.0.1");
+    sp<ServerSocket> serverSocket = new ServerSocket();
+    serverSocket->setReuseAddress(true);
+    serverSocket->bind(new InetSocketAddress(inetAddress, 1234));
+    sp<Socket> client = new Socket();
+    client->connect(new InetSocketAddress(inetAddress, 1234));
+    sp<Socket> server = serverSocket->accept();
+    if (buffered) {
+        client->setTcpNoDelay(true);
+        server->setTcpNoDelay(true);
+    }
+
+    sp<CountingOutputStream> outputStream = new CountingOutputStream(client->getOutputStream());
+    sp<CountingInputStream> inputStream = new CountingInputStream(server->getInputStream());
+    sp<DataInputStream> dataInputStream = buffered ?
+            new DataInputStream(new BufferedInputStream(inputStream, 16 * 1024)) : new DataInputStream(inputStream);
+    sp<Mindroid::Message> message = Mindroid::Message::newMessage(String::valueOf("mindroid://1.42"), 1, 2, new ByteArray(payloadSize));
+
+    const uint64_t start = SystemClock::uptimeNanos();
+    sp<Thread> writer = new Thread([=] {
+        sp<DataOutputStream> dataOutputStream = new DataOutputStream(outputStream);
+        for (int32_t i = 0; i < messageCount; i++) {
+            if (buffered) {
+                message->write(outputStream);
+            } else {
+                writeUnbuffered(message, dataOutputStream);
+            }
+        }
+    });
+    writer->start();
+    for (int32_t i = 0; i < messageCount; i++) {
+        sp<Mindroid::Message> m = Mindroid::Message::newMessage(dataInputStream);
+        ASSERT_EQ(m->size, payloadSize);
+    }
+    const uint64_t duration = SystemClock::uptimeNanos() - start;
+    writer->join();
+
+    printf("[ BENCHMARK] %-32s %8.0f messages/s, %5.2f sends and %5.2f recvs per message\n",
+            name, messageCount * 1000000000.0 / duration,
+            (double) outputStream->getCount() / messageCount, (double) inputStream->getCount() / messageCount);
+    client->close();
+    server->close();
+    serverSocket->close();
+}
+
+TEST(Benchmarks, MindroidTransport) {
+    benchmarkTransport("64 byte payload, unbuffered", 20000, 64, false);
+    benchmarkTransport("64 byte payload, buffered", 20000, 64, true);
+    benchmarkTransport("64 KB payload, unbuffered", 2000, 64 * 1024, false);
+    benchmarkTransport("64 KB payload, buffered", 2000, 64 * 1024, true);
+}
+
+/*
+ * Replies after {@code delay} milliseconds of work on its own looper, or right away.
+ */
+class DelayingService : public Binder {
+public:
+    DelayingService(const sp<Looper>& looper, uint32_t delay) : Binder(looper), mDelay(delay) {
+        attachInterface(nullptr, String::valueOf("mindroid://interfaces/DelayingService"));
+    }
+
+    void onTransact(int32_t what, const sp<Parcel>& data, const sp<Promise<sp<Parcel>>>& result) override {
+        if (mDelay > 0) {
+            Thread::sleep(mDelay);
+        }
+        result->complete(Parcel::obtain());
+    }
+
+private:
+    const uint32_t mDelay;
+};
+
+static void printLatencies(const char* name, std::vector<uint64_t>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    printf("[ BENCHMARK] %-40s p50 %7.1f us, p99 %7.1f us, max %8.1f us\n", name,
+            latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0,
+            latencies.back() / 1000.0);
+}
+
+/*
+ * Measures the round trips of transactions to a fast service while transactions to a slow service
+ * are in flight on the same client connection.
+ */
+TEST(Benchmarks, MindroidTransactionLatency) {
+    const int32_t TRANSACTION_COUNT = 2000;
+    const int32_t SLOW_TRANSACTION_COUNT = 100;
+
+    Runtime::start(1, nullptr);
+    sp<Mindroid> plugin = new Mindroid();
+    plugin->setUp(Runtime::getRuntime());
+    plugin->start(nullptr, nullptr)->get();
+    sp<HandlerThread> fastThread = new HandlerThread();
+    fastThread->start();
+    sp<HandlerThread> slowThread = new HandlerThread();
+    slowThread->start();
+
+    {
+        sp<DelayingService> fastService = new DelayingService(fastThread->getLooper(), 0);
+        sp<DelayingService> slowService = new DelayingService(slowThread->getLooper(), 2);
+        sp<Mindroid::Server> server = new Mindroid::Server(Runtime::getRuntime(), nullptr);
+        server->start(String::valueOf("tcp://127.0.0.1:1234"));
+        sp<Mindroid::Client> client = new Mindroid::Client(plugin, 1);
+        client->start(String::valueOf("tcp://127.0.0.1:1234"));
+
+        std::vector<uint64_t> latencies;
+        for (int32_t i = 0; i < TRANSACTION_COUNT; i++) {
+            const uint64_t start = SystemClock::uptimeNanos();
+            client->transact(fastService, 1, Parcel::obtain(), 0)->get(10000);
+            latencies.push_back(SystemClock::uptimeNanos() - start);
+        }
+        printLatencies("fast service", latencies);
+
+        // The slow transactions pile up on the service but stay below the in-flight window.
+        std::atomic<bool> isDone(false);
+        sp<Thread> slowClient = new Thread([&] {
+            sp<ArrayList<sp<Promise<sp<Parcel>>>>> results = new ArrayList<sp<Promise<sp<Parcel>>>>();
+            for (int32_t i = 0; i < SLOW_TRANSACTION_COUNT && !isDone; i++) {
+                results->add(client->transact(slowService, 2, Parcel::obtain(), 0));
+            }
+            auto itr = results->iterator();
+            while (itr.hasNext()) {
+                itr.next()->get(10000);
+            }
+        });
+        slowClient->start();
+        latencies.clear();
+        for (int32_t i = 0; i < TRANSACTION_COUNT; i++) {
+            const uint64_t start = SystemClock::uptimeNanos();
+            client->transact(fastService, 1, Parcel::obtain(), 0)->get(10000);
+            latencies.push_back(SystemClock::uptimeNanos() - start);
+        }
+        isDone = true;
+        printLatencies("fast service, slow service in flight", latencies);
+        slowClient->join();
+
+        // Pipelined transactions only wait for the in-flight window.
+        sp<ArrayList<sp<Promise<sp<Parcel>>>>> results = new ArrayList<sp<Promise<sp<Parcel>>>>();
+        uint64_t start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < TRANSACTION_COUNT; i++) {
+            client->transact(fastService, 1, Parcel::obtain(), 0)->get(10000);
+        }
+        uint64_t duration = SystemClock::uptimeNanos() - start;
+        printf("[ BENCHMARK] %-40s %8.0f transactions/s\n", "fast service, one at a time", TRANSACTION_COUNT * 1000000000.0 / duration);
+        start = SystemClock::uptimeNanos();
+        for (int32_t i = 0; i < TRANSACTION_COUNT; i++) {
+            results->add(client->transact(fastService, 1, Parcel::obtain(), 0));
+        }
+        auto itr = results->iterator();
+        while (itr.hasNext()) {
+            itr.next()->get(10000);
+        }
+        duration = SystemClock::uptimeNanos() - start;
+        printf("[ BENCHMARK] %-40s %8.0f transactions/s\n", "fast service, pipelined", TRANSACTION_COUNT * 1000000000.0 / duration);
+
+        client->shutdown(nullptr);
+        server->shutdown(nullptr);
+    }
+
+    fastThread->quit();
+    slowThread->quit();
+    plugin->stop(nullptr, nullptr);
+    plugin->tearDown();
+    Runtime::shutdown();
+}
+
+/*
+ * Decodes messages and resolves their target binder like Mindroid::Server::onTransact.
+ */
+TEST(Benchmarks, MindroidMessageDispatch) {
+    const int32_t MESSAGE_COUNT = 100000;
+
+    Runtime::start(1, nullptr);
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    {
+        sp<DelayingService> service = new DelayingService(thread->getLooper(), 0);
+        sp<Runtime> runtime = Runtime::getRuntime();
+        sp<ByteArray> payload = new ByteArray(16);
+        for (int32_t format = Mindroid::Message::FORMAT_V1; format <= Mindroid::Message::FORMAT_V2; format++) {
+            sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+            sp<Mindroid::Message> message = (format == Mindroid::Message::FORMAT_V2) ?
+                    Mindroid::Message::newMessage(service->getId(), 1, 2, payload, payload->size()) :
+                    Mindroid::Message::newMessage(service->getUri()->toString(), 1, 2, payload);
+            for (int32_t i = 0; i < MESSAGE_COUNT; i++) {
+                message->write(outputStream);
+            }
+            const size_t size = outputStream->size();
+            sp<DataInputStream> inputStream = new DataInputStream(new ByteArrayInputStream(outputStream->toByteArray()));
+
+            const uint64_t start = SystemClock::uptimeNanos();
+            for (int32_t i = 0; i < MESSAGE_COUNT; i++) {
+                sp<Mindroid::Message> m = Mindroid::Message::newMessage(inputStream);
+                sp<IBinder> binder = (m->format == Mindroid::Message::FORMAT_V2) ?
+                        sp<IBinder>(runtime->getBinder(m->binderId)) : runtime->getBinder(m->uri);
+                ASSERT_TRUE(binder == service);
+            }
+            const uint64_t duration = SystemClock::uptimeNanos() - start;
+            printf("[ BENCHMARK] format %d, %zu byte payload: %3zu bytes per message, %6.3f us per decode and lookup\n",
+                    format, payload->size(), size / MESSAGE_COUNT, duration / 1000.0 / MESSAGE_COUNT);
+        }
+    }
+    thread->quit();
+    thread->join();
+    Runtime::shutdown();
+}
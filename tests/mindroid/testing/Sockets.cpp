@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 E.S.R.Labs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mindroid/testing/Sockets.h>
+#include <mindroid/net/InetAddress.h>
+#include <mindroid/net/ServerSocket.h>
+
+namespace mindroid {
+
+uint16_t Sockets::getFreePort() {
+    // The OS assigns a free port.
+    sp<ServerSocket> serverSocket = new ServerSocket(0, ServerSocket::DEFAULT_BACKLOG, InetAddress::getByName("127.0.0.1"));
+    const uint16_t port = serverSocket->getLocalPort();
+    serverSocket->close();
+    return port;
+}
+
+sp<String> Sockets::getUri(uint16_t port) {
+    return String::format("tcp://127.0.0.1:%u", port);
+}
+
+} /* namespace mindroid */
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 E.S.R.Labs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINDROID_TESTING_SOCKETS_H_
+#define MINDROID_TESTING_SOCKETS_H_
+
+#include <mindroid/lang/Object.h>
+#include <mindroid/lang/String.h>
+
+namespace mindroid {
+
+class Sockets {
+public:
+    Sockets() = delete;
+
+    /**
+     * Returns a TCP port of the loopback interface that is not in use, so that tests that run
+     * servers do not depend on a fixed port.
+     */
+    static uint16_t getFreePort();
+
+    /**
+     * Returns the URI tcp://127.0.0.1:{@code port}.
+     */
+    static sp<String> getUri(uint16_t port);
+};
+
+} /* namespace mindroid */
+
+#endif /* MINDROID_TESTING_SOCKETS_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/lang/PoolAllocator.h>
+#include <mindroid/lang/String.h>
+#include <mindroid/os/Handler.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Looper.h>
+#include <mindroid/util/concurrent/Promise.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace mindroid;
+
+TEST(Mindroid, PoolAllocator) {
+    PoolAllocator* allocator = new PoolAllocator();
+
+    std::vector<std::pair<uint8_t*, size_t>> blocks;
+    for (size_t size = 1; size <= 2 * PoolAllocator::MAX_BLOCK_SIZE; size += 7) {
+        uint8_t* block = static_cast<uint8_t*>(allocator->allocate(size));
+        ASSERT_NE(block, nullptr);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(std::max_align_t), 0u);
+        std::memset(block, (int) (size & 0xFF), size);
+        blocks.push_back(std::make_pair(block, size));
+    }
+    ASSERT_EQ(allocator->getAllocationCount(), blocks.size());
+    ASSERT_GT(allocator->getBytesInUse(), 0u);
+    for (const auto& block : blocks) {
+        for (size_t i = 0; i < block.second; i++) {
+            ASSERT_EQ(block.first[i], (uint8_t) (block.second & 0xFF));
+        }
+        allocator->free(block.first, block.second);
+    }
+    ASSERT_EQ(allocator->getBytesInUse(), 0u);
+    ASSERT_GT(allocator->getBytesReserved(), 0u);
+    ASSERT_TRUE(allocator->dump()->contains("Arena"));
+
+    // Objects keep the arena alive after close() and are freed through it on any thread.
+    Allocator::setThreadAllocator(allocator);
+    ASSERT_EQ(Allocator::getThreadAllocator(), allocator);
+    sp<String> string = String::format("%s %d", "PoolAllocator", 42);
+    Allocator::setThreadAllocator(nullptr);
+    ASSERT_GT(allocator->getBytesInUse(), 0u);
+    allocator->close();
+
+    sp<Promise<bool>> promise = new Promise<bool>();
+    sp<Thread> thread = new Thread([&] {
+        ASSERT_TRUE(string->equals("PoolAllocator 42"));
+        string = nullptr;
+        promise->complete(true);
+    });
+    thread->start();
+    ASSERT_TRUE(promise->get(10000));
+    thread->join();
+}
+
+TEST(Mindroid, LooperAllocatorArena) {
+    sp<HandlerThread> thread = new HandlerThread("Arena", MessageQueue::FLAG_ALLOCATOR_ARENA);
+    thread->start();
+    sp<Looper> looper = thread->getLooper();
+    ASSERT_NE(looper->getAllocator(), nullptr);
+    sp<Handler> handler = new Handler(looper);
+
+    const uint64_t allocationCount = looper->getAllocator()->getAllocationCount();
+    sp<Promise<sp<String>>> promise = new Promise<sp<String>>();
+    handler->post([=] {
+        promise->complete(String::valueOf(12345));
+    });
+    ASSERT_TRUE(promise->get(10000)->equals("12345"));
+    ASSERT_GT(looper->getAllocator()->getAllocationCount(), allocationCount);
+    ASSERT_TRUE(looper->getAllocator()->dump()->contains("Arena"));
+
+    // Other threads keep using the default allocator.
+    ASSERT_EQ(Allocator::getThreadAllocator(), nullptr);
+    ASSERT_TRUE(Allocator::getDefault()->dump()->contains("Thread-caching"));
+
+    thread->quit();
+    thread->join();
+}
+
+TEST(Mindroid, LooperAllocatorArenaQuit) {
+    sp<Looper> looper;
+    Allocator* loopAllocator = nullptr;
+    Allocator* quitAllocator = nullptr;
+    sp<Thread> thread = new Thread([&] {
+        Looper::prepare(true, MessageQueue::FLAG_ALLOCATOR_ARENA);
+        looper = Looper::myLooper();
+        loopAllocator = Allocator::getThreadAllocator();
+        looper->quit();
+        Looper::loop();
+        quitAllocator = Allocator::getThreadAllocator();
+    });
+    thread->start();
+    thread->join();
+
+    // The thread stops allocating from the arena once the Looper has quit, so the Looper can be
+    // destroyed by another thread.
+    ASSERT_NE(loopAllocator, nullptr);
+    ASSERT_EQ(loopAllocator, looper->getAllocator());
+    ASSERT_EQ(quitAllocator, nullptr);
+    looper = nullptr;
+}
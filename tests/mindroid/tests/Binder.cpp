@@ -20,6 +20,8 @@
 #include <mindroid/os/Looper.h>
 #include <mindroid/runtime/system/Runtime.h>
 #include <mindroid/io/File.h>
+#include <mindroid/lang/IllegalArgumentException.h>
+#include <mindroid/net/URI.h>
 
 using namespace mindroid;
 
@@ -55,3 +57,35 @@ TEST(Mindroid, Binder) {
 
     Runtime::shutdown();
 }
+
+TEST(Mindroid, BinderUris) {
+    Runtime::start(1, nullptr);
+
+    sp<HandlerThread> handlerThread = new HandlerThread();
+    handlerThread->start();
+
+    {
+        sp<Stub> stub = new Stub(handlerThread->getLooper());
+        stub->attachInterface(nullptr, String::valueOf("mindroid://interfaces/Stub"));
+        sp<URI> uri = stub->getUri();
+        ASSERT_NE(uri, nullptr);
+        EXPECT_EQ(uri->getSchemeAndAuthority(), uri->toString());
+
+        sp<Runtime> runtime = Runtime::getRuntime();
+        EXPECT_TRUE(runtime->getBinder(uri) == stub);
+        sp<URI> uriWithPath = URI::create(String::format("%s/path?query", uri->toString()->c_str()));
+        EXPECT_TRUE(uriWithPath->getSchemeAndAuthority()->equals(uri->toString()));
+        EXPECT_TRUE(runtime->getBinder(uriWithPath) == stub);
+        EXPECT_TRUE(runtime->getBinder(URI::create("mindroid://1.999999")) == nullptr);
+        EXPECT_TRUE(runtime->getBinder(String::valueOf(uri->toString()->c_str())) == stub);
+        EXPECT_TRUE(runtime->getBinder(uriWithPath->toString()) == stub);
+        EXPECT_TRUE(runtime->getBinder(String::valueOf("mindroid://1.999999")) == nullptr);
+        EXPECT_THROW(runtime->getBinder(URI::create("mindroid://1")), IllegalArgumentException);
+        EXPECT_THROW(runtime->getBinder(URI::create("mindroid://x.1")), IllegalArgumentException);
+        EXPECT_THROW(runtime->getBinder(URI::create("mindroid://1.2.3")), IllegalArgumentException);
+    }
+
+    handlerThread->quit();
+
+    Runtime::shutdown();
+}
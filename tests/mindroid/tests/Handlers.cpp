@@ -17,8 +17,15 @@
 #include <gtest/gtest.h>
 #include <mindroid/os/Looper.h>
 #include <mindroid/os/Handler.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/MessageQueue.h>
+#include <mindroid/os/LooperStats.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/lang/IllegalStateException.h>
 #include <mindroid/util/function/Function.h>
 #include <mindroid/util/concurrent/Promise.h>
+#include <atomic>
+#include <vector>
 
 using namespace mindroid;
 
@@ -71,3 +78,582 @@ TEST(Mindroid, Handler4) {
 
     thread->quit();
 }
+
+class OrderingHandler : public Handler {
+public:
+    OrderingHandler(const sp<Looper>& looper, int32_t producers, int32_t messages) :
+            Handler(looper),
+            mPromise(new Promise<bool>()),
+            mNextSequenceNumbers(producers, 0),
+            mRemainingMessages(producers * messages) {
+    }
+
+    void handleMessage(const sp<Message>& msg) override {
+        if (mNextSequenceNumbers[msg->what]++ != msg->arg1) {
+            mPromise->complete(false);
+        }
+        if (--mRemainingMessages == 0) {
+            mPromise->complete(true);
+        }
+    }
+
+    sp<Promise<bool>> mPromise;
+
+private:
+    std::vector<int32_t> mNextSequenceNumbers;
+    int32_t mRemainingMessages;
+};
+
+TEST(Mindroid, LockFreeMessageQueue1) {
+    const int32_t PRODUCERS = 8;
+    const int32_t MESSAGES = 1000;
+
+    sp<HandlerThread> thread = new HandlerThread("LockFreeMessageQueue", MessageQueue::FLAG_LOCK_FREE_ENQUEUE);
+    thread->start();
+    sp<OrderingHandler> handler = new OrderingHandler(thread->getLooper(), PRODUCERS, MESSAGES);
+
+    std::vector<sp<Thread>> producers;
+    for (int32_t i = 0; i < PRODUCERS; i++) {
+        sp<Thread> producer = new Thread([=] {
+            for (int32_t j = 0; j < MESSAGES; j++) {
+                handler->obtainMessage(i, j, 0)->sendToTarget();
+            }
+        });
+        producer->start();
+        producers.push_back(producer);
+    }
+    for (auto producer : producers) {
+        producer->join();
+    }
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+
+    thread->quit();
+}
+
+TEST(Mindroid, LockFreeMessageQueue2) {
+    sp<HandlerThread> thread = new HandlerThread("LockFreeMessageQueue", MessageQueue::FLAG_LOCK_FREE_ENQUEUE);
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    sp<Promise<bool>> blocker = new Promise<bool>();
+    handler->post([=] { blocker->get(); });
+    handler->sendEmptyMessage(42);
+    handler->sendEmptyMessageDelayed(43, 10000);
+    ASSERT_EQ(handler->hasMessages(42), true);
+    ASSERT_EQ(handler->hasMessages(43), true);
+    ASSERT_EQ(handler->removeMessages(42), true);
+    ASSERT_EQ(handler->hasMessages(42), false);
+    ASSERT_EQ(handler->removeMessages(43), true);
+    ASSERT_EQ(handler->hasMessages(43), false);
+    blocker->complete(true);
+
+    sp<Promise<int32_t>> promise = new Promise<int32_t>();
+    handler->post([promise] { promise->complete(123); });
+    ASSERT_EQ(promise->get(), 123);
+
+    thread->quit();
+}
+
+TEST(Mindroid, TimerHeapMessageQueue) {
+    sp<HandlerThread> thread = new HandlerThread("TimerHeapMessageQueue", MessageQueue::FLAG_TIMER_HEAP);
+    thread->start();
+    sp<OrderingHandler> handler = new OrderingHandler(thread->getLooper(), 1, 5);
+
+    sp<Object> token = new Object();
+    const uint64_t now = SystemClock::uptimeMillis();
+    handler->sendMessageAtTime(handler->obtainMessage(0, 4, 0), now + 300);
+    handler->sendMessageAtTime(handler->obtainMessage(0, 1, 0), now + 100);
+    handler->sendMessageAtTime(handler->obtainMessage(0, 42, 0, token), now + 150);
+    handler->sendMessageAtTime(handler->obtainMessage(0, 3, 0), now + 200);
+    handler->sendMessageAtTime(handler->obtainMessage(0, 2, 0), now + 100);
+    handler->sendMessageAtTime(handler->obtainMessage(0, 0, 0), now + 50);
+
+    sp<Runnable> runnable = new Runnable([] { });
+    handler->postDelayed(runnable, 100);
+    ASSERT_EQ(handler->hasCallbacks(runnable), true);
+    ASSERT_EQ(handler->removeCallbacks(runnable), true);
+    ASSERT_EQ(handler->hasCallbacks(runnable), false);
+
+    ASSERT_EQ(handler->hasMessages(0, token), true);
+    ASSERT_EQ(handler->removeMessages(0, token), true);
+    ASSERT_EQ(handler->hasMessages(0, token), false);
+
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+    thread->quit();
+}
+
+TEST(Mindroid, IndexedMessageQueue) {
+    sp<HandlerThread> thread = new HandlerThread("IndexedMessageQueue", MessageQueue::FLAG_MESSAGE_INDEX);
+    thread->start();
+    sp<Looper> looper = thread->getLooper();
+    sp<Handler> handler1 = new Handler(looper);
+    sp<Handler> handler2 = new Handler(looper);
+    sp<MessageQueue> queue = looper->getQueue();
+
+    sp<Object> token = new Object();
+    sp<Runnable> runnable = new Runnable([] { });
+    handler1->sendEmptyMessageDelayed(1, 10000);
+    handler1->sendMessageDelayed(handler1->obtainMessage(1, token), 10000);
+    handler1->sendEmptyMessageDelayed(2, 10000);
+    handler2->sendEmptyMessageDelayed(1, 10000);
+    handler1->postDelayed(runnable, 10000);
+    handler2->postAtTime(runnable, token, SystemClock::uptimeMillis() + 10000);
+    ASSERT_EQ(queue->getMessageCount(), 6u);
+
+    ASSERT_EQ(handler1->hasMessages(3), false);
+    ASSERT_EQ(handler1->hasMessages(1, token), true);
+    ASSERT_EQ(handler1->removeMessages(1, token), true);
+    ASSERT_EQ(handler1->hasMessages(1, token), false);
+    ASSERT_EQ(handler1->hasMessages(1), true);
+    ASSERT_EQ(handler1->removeMessages(1), true);
+    ASSERT_EQ(handler1->hasMessages(1), false);
+    ASSERT_EQ(handler2->hasMessages(1), true);
+    ASSERT_EQ(queue->getMessageCount(), 4u);
+
+    ASSERT_EQ(handler1->removeCallbacks(runnable), true);
+    ASSERT_EQ(handler1->hasCallbacks(runnable), false);
+    ASSERT_EQ(handler2->hasCallbacks(runnable), true);
+    ASSERT_EQ(handler2->removeCallbacksAndMessages(token), true);
+    ASSERT_EQ(handler2->hasCallbacks(runnable), false);
+    ASSERT_EQ(handler2->removeCallbacksAndMessages(nullptr), true);
+    ASSERT_EQ(handler1->removeCallbacksAndMessages(nullptr), true);
+    ASSERT_EQ(queue->getMessageCount(), 0u);
+
+    ASSERT_GT(queue->getIndexLookupCount(), queue->getIndexHitCount());
+    ASSERT_GT(queue->getIndexHitCount(), 0u);
+    thread->quit();
+}
+
+TEST(Mindroid, HandlerNanos) {
+    const uint64_t uptimeNanos = SystemClock::uptimeNanos();
+    const uint64_t uptimeMillis = SystemClock::uptimeMillis();
+    ASSERT_LE(uptimeNanos / 1000000, uptimeMillis);
+    ASSERT_LE(uptimeMillis - uptimeNanos / 1000000, 1000u);
+
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<OrderingHandler> handler = new OrderingHandler(thread->getLooper(), 1, 4);
+
+    const uint64_t now = SystemClock::uptimeNanos();
+    handler->sendMessageAtTimeNanos(handler->obtainMessage(0, 3, 0), now + 1500000);
+    handler->sendMessageAtTimeNanos(handler->obtainMessage(0, 1, 0), now + 300000);
+    handler->sendMessageAtTimeNanos(handler->obtainMessage(0, 2, 0), now + 600000);
+    handler->sendMessageDelayedNanos(handler->obtainMessage(0, 0, 0), 100000);
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+
+    sp<Promise<uint64_t>> promise = new Promise<uint64_t>();
+    const uint64_t start = SystemClock::uptimeNanos();
+    handler->postDelayedNanos([=] { promise->complete(SystemClock::uptimeNanos() - start); }, 250000);
+    ASSERT_GE(promise->get(10000), 250000u);
+
+    thread->quit();
+}
+
+TEST(Mindroid, HandlerMillis) {
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<OrderingHandler> handler = new OrderingHandler(thread->getLooper(), 1, 4);
+
+    // Queue all messages before the first one is dispatched.
+    sp<Promise<bool>> barrier = new Promise<bool>();
+    handler->post([=] { barrier->get(); });
+    handler->sendMessage(handler->obtainMessage(0, 0, 0));
+    handler->sendMessage(handler->obtainMessage(0, 1, 0));
+    // The current millisecond does not overtake messages that have been sent before.
+    handler->sendMessageAtTime(handler->obtainMessage(0, 2, 0), SystemClock::uptimeMillis());
+    handler->sendMessage(handler->obtainMessage(0, 3, 0));
+    barrier->complete(true);
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+
+    thread->quit();
+}
+
+TEST(Mindroid, BatchedMessageQueue1) {
+    const int32_t PRODUCERS = 4;
+    const int32_t MESSAGES = 1000;
+
+    sp<HandlerThread> thread = new HandlerThread("BatchedMessageQueue", MessageQueue::FLAG_LOCK_FREE_ENQUEUE | MessageQueue::FLAG_BATCHED_DISPATCH);
+    thread->start();
+    sp<OrderingHandler> handler = new OrderingHandler(thread->getLooper(), PRODUCERS, MESSAGES);
+
+    std::vector<sp<Thread>> producers;
+    for (int32_t i = 0; i < PRODUCERS; i++) {
+        sp<Thread> producer = new Thread([=] {
+            for (int32_t j = 0; j < MESSAGES; j++) {
+                handler->obtainMessage(i, j, 0)->sendToTarget();
+            }
+        });
+        producer->start();
+        producers.push_back(producer);
+    }
+    for (auto producer : producers) {
+        producer->join();
+    }
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+
+    thread->quit();
+}
+
+TEST(Mindroid, BatchedMessageQueue2) {
+    sp<HandlerThread> thread = new HandlerThread("BatchedMessageQueue", MessageQueue::FLAG_BATCHED_DISPATCH);
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    // The runnables are dequeued as one batch after the blocker has been dispatched.
+    sp<Promise<bool>> blocker = new Promise<bool>();
+    handler->post([=] { blocker->get(); });
+    std::atomic<bool> dispatched(false);
+    sp<Runnable> runnable = new Runnable([&] { dispatched = true; });
+    sp<Promise<bool>> promise = new Promise<bool>();
+    handler->post([=] {
+        promise->complete(handler->hasMessages(42) && handler->removeCallbacks(runnable) && handler->removeMessages(42) && !handler->hasMessages(42));
+    });
+    handler->post(runnable);
+    handler->sendEmptyMessage(42);
+    blocker->complete(true);
+    ASSERT_EQ(promise->get(10000), true);
+
+    sp<Promise<int32_t>> result = new Promise<int32_t>();
+    handler->post([result] { result->complete(123); });
+    ASSERT_EQ(result->get(10000), 123);
+    ASSERT_EQ(dispatched, false);
+
+    thread->quit();
+}
+
+class CountingIdleHandler : public MessageQueue::IdleHandler {
+public:
+    CountingIdleHandler(bool keep) :
+            mKeep(keep),
+            mCount(0) {
+    }
+
+    bool queueIdle() override {
+        mCount++;
+        return mKeep;
+    }
+
+    const bool mKeep;
+    std::atomic<int32_t> mCount;
+};
+
+TEST(Mindroid, IdleHandler) {
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+    sp<MessageQueue> queue = thread->getLooper()->getQueue();
+
+    sp<CountingIdleHandler> oneShotIdleHandler = new CountingIdleHandler(false);
+    sp<CountingIdleHandler> idleHandler = new CountingIdleHandler(true);
+    queue->addIdleHandler(oneShotIdleHandler);
+    queue->addIdleHandler(idleHandler);
+
+    for (int32_t i = 0; i < 3; i++) {
+        sp<Promise<int32_t>> promise = new Promise<int32_t>();
+        handler->post([promise] { promise->complete(1); });
+        ASSERT_EQ(promise->get(10000), 1);
+        Thread::sleep(10);
+    }
+    ASSERT_EQ(oneShotIdleHandler->mCount, 1);
+    ASSERT_GE(idleHandler->mCount, 3);
+    ASSERT_LE(idleHandler->mCount, 4);
+
+    queue->removeIdleHandler(idleHandler);
+    const int32_t count = idleHandler->mCount;
+    sp<Promise<int32_t>> promise = new Promise<int32_t>();
+    handler->post([promise] { promise->complete(1); });
+    ASSERT_EQ(promise->get(10000), 1);
+    Thread::sleep(10);
+    ASSERT_EQ(idleHandler->mCount, count);
+
+    thread->quit();
+}
+
+class RecyclingHandler : public Handler {
+public:
+    RecyclingHandler(const sp<Looper>& looper, int32_t messages) :
+            Handler(looper),
+            mPromise(new Promise<bool>()),
+            mMessages(messages) {
+    }
+
+    void handleMessage(const sp<Message>& msg) override {
+        if (msg->what < mMessages) {
+            // Messages recycled by this Looper are obtained again from its thread-local cache.
+            obtainMessage(msg->what + 1)->sendToTarget();
+        } else {
+            mPromise->complete(true);
+        }
+    }
+
+    sp<Promise<bool>> mPromise;
+
+private:
+    const int32_t mMessages;
+};
+
+TEST(Mindroid, MessagePoolCache) {
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<RecyclingHandler> handler = new RecyclingHandler(thread->getLooper(), 1000);
+    const uint64_t hitCount = Message::getPoolHitCount();
+    const uint64_t missCount = Message::getPoolMissCount();
+    handler->sendEmptyMessage(0);
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+    // The counts of the Looper thread are visible to other threads although its cache never ran empty or full.
+    ASSERT_GE(Message::getPoolHitCount() - hitCount, 999u);
+    ASSERT_LE(Message::getPoolMissCount() - missCount, 2u);
+
+    thread->quit();
+}
+
+class SlowHandler : public Handler {
+public:
+    SlowHandler(const sp<Looper>& looper) :
+            Handler(looper) {
+    }
+
+    void handleMessage(const sp<Message>& msg) override {
+        if (msg->what == 1) {
+            Thread::sleep(20);
+        }
+    }
+};
+
+TEST(Mindroid, LooperStats) {
+    sp<HandlerThread> thread = new HandlerThread("LooperStats", MessageQueue::FLAG_INSTRUMENTATION);
+    thread->start();
+    sp<Handler> handler = new SlowHandler(thread->getLooper());
+    sp<MessageQueue> queue = thread->getLooper()->getQueue();
+    sp<LooperStats> stats = queue->getStats();
+    stats->setSlowDispatchThreshold(10000000);
+
+    bool registered = false;
+    sp<ArrayList<sp<Looper>>> loopers = Looper::getLoopers();
+    for (size_t i = 0; i < loopers->size(); i++) {
+        registered |= (loopers->get(i) == thread->getLooper());
+    }
+    ASSERT_EQ(registered, true);
+
+    for (int32_t i = 0; i < 10; i++) {
+        handler->sendEmptyMessage(0);
+    }
+    handler->sendEmptyMessage(1);
+    // Read the statistics on the Looper thread once the previous messages have been recorded.
+    uint64_t messageCount = 0;
+    LooperStats::Histogram handlingTime;
+    sp<Promise<bool>> promise = new Promise<bool>();
+    handler->post([&] {
+        messageCount = stats->getMessageCount();
+        handlingTime = stats->getHandlingTime("SlowHandler");
+        promise->complete(true);
+    });
+    ASSERT_EQ(promise->get(10000), true);
+
+    ASSERT_EQ(messageCount, 11);
+    ASSERT_EQ(handlingTime.getCount(), 11);
+    ASSERT_GE(handlingTime.getMax(), 20000000);
+    ASSERT_EQ(stats->getSlowDispatchCount(), 1);
+    ASSERT_GE(stats->getDispatchLatency().getCount(), 11);
+    ASSERT_GE(stats->getQueueDepth().getCount(), 12);
+    ASSERT_GE(stats->getQueueDepth().getMax(), 1);
+    ASSERT_NE(stats->toString()->indexOf("SlowHandler"), -1);
+
+    queue->setInstrumentationEnabled(false);
+    Thread::sleep(10);
+    stats->reset();
+    promise = new Promise<bool>();
+    handler->post([=] { promise->complete(true); });
+    ASSERT_EQ(promise->get(10000), true);
+    Thread::sleep(10);
+    ASSERT_EQ(stats->getMessageCount(), 0);
+
+    thread->quit();
+}
+
+TEST(Mindroid, PriorityLanes1) {
+    const uint32_t flags[] = { 0, MessageQueue::FLAG_TIMER_HEAP | MessageQueue::FLAG_MESSAGE_INDEX };
+    for (uint32_t flag : flags) {
+        sp<HandlerThread> thread = new HandlerThread("PriorityLanes", flag);
+        thread->start();
+        sp<Handler> highHandler = new Handler(thread->getLooper(), Handler::PRIORITY_HIGH);
+        sp<Handler> normalHandler = new Handler(thread->getLooper());
+        sp<Handler> lowHandler = new Handler(thread->getLooper(), Handler::PRIORITY_LOW);
+        ASSERT_EQ(normalHandler->getPriority(), Handler::PRIORITY_NORMAL);
+
+        std::vector<int32_t> order;
+        sp<Promise<bool>> blocker = new Promise<bool>();
+        normalHandler->post([=] { blocker->get(); });
+        for (int32_t i = 0; i < 3; i++) {
+            lowHandler->post([&order] { order.push_back(Handler::PRIORITY_LOW); });
+            normalHandler->post([&order] { order.push_back(Handler::PRIORITY_NORMAL); });
+            highHandler->post([&order] { order.push_back(Handler::PRIORITY_HIGH); });
+        }
+        // The message priority overrides the priority of the target Handler.
+        sp<Message> message = Message::obtain(lowHandler, new Runnable([&order] { order.push_back(Handler::PRIORITY_HIGH); }));
+        message->setPriority(Handler::PRIORITY_HIGH);
+        lowHandler->sendMessage(message);
+        sp<Promise<bool>> promise = new Promise<bool>();
+        lowHandler->post([=] { promise->complete(true); });
+        blocker->complete(true);
+        ASSERT_EQ(promise->get(10000), true);
+
+        const std::vector<int32_t> expectedOrder = {
+                Handler::PRIORITY_HIGH, Handler::PRIORITY_HIGH, Handler::PRIORITY_HIGH, Handler::PRIORITY_HIGH,
+                Handler::PRIORITY_NORMAL, Handler::PRIORITY_NORMAL, Handler::PRIORITY_NORMAL,
+                Handler::PRIORITY_LOW, Handler::PRIORITY_LOW, Handler::PRIORITY_LOW };
+        ASSERT_EQ(order, expectedOrder);
+
+        thread->quit();
+    }
+}
+
+TEST(Mindroid, PriorityLanes2) {
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    thread->getLooper()->getQueue()->setAgingThreshold(10000000);
+    sp<Handler> highHandler = new Handler(thread->getLooper(), Handler::PRIORITY_HIGH);
+    sp<Handler> lowHandler = new Handler(thread->getLooper(), Handler::PRIORITY_LOW);
+
+    // A flood of high priority messages must not starve the low priority lane.
+    std::atomic<bool> flooding(true);
+    sp<Runnable> flood = new Runnable([&] {
+        if (flooding) {
+            Thread::sleep(1);
+            highHandler->post(flood);
+            highHandler->post(flood);
+        }
+    });
+    highHandler->post(flood);
+    sp<Promise<bool>> promise = new Promise<bool>();
+    lowHandler->post([=] { promise->complete(true); });
+    const bool result = promise->get(5000);
+    flooding = false;
+    thread->quit();
+    thread->join();
+    ASSERT_EQ(result, true);
+}
+
+TEST(Mindroid, SyncBarrier) {
+    const uint32_t flags[] = { 0, MessageQueue::FLAG_TIMER_HEAP | MessageQueue::FLAG_LOCK_FREE_ENQUEUE };
+    for (uint32_t flag : flags) {
+        sp<HandlerThread> thread = new HandlerThread("SyncBarrier", flag);
+        thread->start();
+        sp<Handler> handler = new Handler(thread->getLooper());
+        sp<MessageQueue> queue = thread->getLooper()->getQueue();
+
+        std::vector<int32_t> order;
+        handler->post([&order] { order.push_back(1); });
+        const int32_t token = queue->postSyncBarrier();
+        handler->post([&order] { order.push_back(2); });
+        sp<Promise<bool>> promise = new Promise<bool>();
+        sp<Message> message = Message::obtain(handler, new Runnable([&order, promise] {
+            order.push_back(3);
+            promise->complete(true);
+        }));
+        message->setAsynchronous(true);
+        ASSERT_EQ(message->isAsynchronous(), true);
+        handler->sendMessage(message);
+
+        // The synchronous message behind the barrier is stalled until the barrier is removed.
+        ASSERT_EQ(promise->get(10000), true);
+        Thread::sleep(10);
+        ASSERT_EQ(order, std::vector<int32_t>({ 1, 3 }));
+
+        queue->removeSyncBarrier(token);
+        promise = new Promise<bool>();
+        handler->post([promise] { promise->complete(true); });
+        ASSERT_EQ(promise->get(10000), true);
+        ASSERT_EQ(order, std::vector<int32_t>({ 1, 3, 2 }));
+
+        ASSERT_THROW(queue->removeSyncBarrier(token), IllegalStateException);
+
+        thread->quit();
+    }
+}
+
+class PingPongHandler : public Handler {
+public:
+    PingPongHandler(const sp<Looper>& looper, const sp<Promise<bool>>& promise, int32_t messages) :
+            Handler(looper),
+            mPromise(promise),
+            mMessages(messages) {
+    }
+
+    void handleMessage(const sp<Message>& msg) override {
+        if (msg->what < mMessages) {
+            // Messages obtained on a thread-confined Looper are handed over to the other Looper.
+            mPeer->obtainMessage(msg->what + 1)->sendToTarget();
+        } else {
+            mPromise->complete(true);
+        }
+    }
+
+    sp<Handler> mPeer;
+
+private:
+    sp<Promise<bool>> mPromise;
+    const int32_t mMessages;
+};
+
+TEST(Mindroid, ThreadConfinedMessages) {
+    sp<HandlerThread> thread1 = new HandlerThread("Ping", MessageQueue::FLAG_THREAD_CONFINED_MESSAGES);
+    thread1->start();
+    sp<HandlerThread> thread2 = new HandlerThread("Pong",
+            MessageQueue::FLAG_THREAD_CONFINED_MESSAGES | MessageQueue::FLAG_BATCHED_DISPATCH);
+    thread2->start();
+
+    sp<RecyclingHandler> handler = new RecyclingHandler(thread1->getLooper(), 1000);
+    handler->sendEmptyMessage(0);
+    ASSERT_EQ(handler->mPromise->get(10000), true);
+
+    sp<Promise<bool>> promise = new Promise<bool>();
+    sp<PingPongHandler> ping = new PingPongHandler(thread1->getLooper(), promise, 1000);
+    sp<PingPongHandler> pong = new PingPongHandler(thread2->getLooper(), promise, 1000);
+    ping->mPeer = pong;
+    pong->mPeer = ping;
+    ping->sendEmptyMessage(0);
+    ASSERT_EQ(promise->get(10000), true);
+    ping->mPeer = nullptr;
+    pong->mPeer = nullptr;
+
+    thread1->quit();
+    thread2->quit();
+}
+
+TEST(Mindroid, PostFunction) {
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Handler> handler = new Handler(thread->getLooper());
+
+    // Small functions are stored inline, larger ones on the heap.
+    sp<Promise<int32_t>> promise = new Promise<int32_t>();
+    int64_t values[16] = { 1, 2, 3 };
+    handler->post([promise] { promise->complete(1); });
+    ASSERT_EQ(promise->get(10000), 1);
+    promise = new Promise<int32_t>();
+    handler->post([promise, values] { promise->complete((int32_t) (values[0] + values[1] + values[2])); });
+    ASSERT_EQ(promise->get(10000), 6);
+
+    // The captured state is released once the function has run.
+    sp<Promise<bool>> capture = new Promise<bool>();
+    promise = new Promise<int32_t>();
+    std::function<void (void)> func = [capture, promise] { promise->complete(2); };
+    handler->post(func);
+    func = nullptr;
+    ASSERT_EQ(promise->get(10000), 2);
+    promise = new Promise<int32_t>();
+    handler->post([promise] { promise->complete(3); });
+    ASSERT_EQ(promise->get(10000), 3);
+    ASSERT_EQ(capture->getStrongReferenceCount(), 1);
+
+    // Posted functions can still be removed.
+    promise = new Promise<int32_t>();
+    sp<Runnable> runnable = handler->postDelayed([promise] { promise->complete(4); }, 10000);
+    ASSERT_NE(runnable, nullptr);
+    ASSERT_EQ(handler->removeCallbacks(runnable), true);
+    handler->post([promise] { promise->complete(5); });
+    ASSERT_EQ(promise->get(10000), 5);
+
+    thread->quit();
+}
@@ -16,6 +16,8 @@
 
 #include <gtest/gtest.h>
 #include <mindroid/util/HashMap.h>
+#include <mindroid/util/concurrent/ConcurrentHashMap.h>
+#include <mindroid/lang/Thread.h>
 #include <mindroid/lang/String.h>
 
 using namespace mindroid;
@@ -349,3 +351,54 @@ TEST(Mindroid, HashMapOfStringStringCppStyleIterators) {
     }
     ASSERT_EQ(entryCount, 4);
 }
+
+TEST(Mindroid, ConcurrentHashMap) {
+    sp<ConcurrentHashMap<sp<String>, sp<String>>> map = new ConcurrentHashMap<sp<String>, sp<String>>();
+    ASSERT_TRUE(map->isEmpty());
+    ASSERT_EQ(map->put(String::valueOf("a"), String::valueOf("1")), nullptr);
+    ASSERT_TRUE(map->put(String::valueOf("a"), String::valueOf("2"))->equals("1"));
+    ASSERT_TRUE(map->putIfAbsent(String::valueOf("a"), String::valueOf("3"))->equals("2"));
+    ASSERT_EQ(map->putIfAbsent(String::valueOf("b"), String::valueOf("4")), nullptr);
+    ASSERT_TRUE(map->get(String::valueOf("a"))->equals("2"));
+    ASSERT_TRUE(map->containsKey(String::valueOf("b")));
+    ASSERT_EQ(map->get(String::valueOf("c")), nullptr);
+    ASSERT_EQ(map->size(), 2u);
+    ASSERT_EQ(map->values()->size(), 2u);
+    ASSERT_TRUE(map->remove(String::valueOf("b"))->equals("4"));
+    ASSERT_EQ(map->remove(String::valueOf("b")), nullptr);
+    // A conditional remove keeps an entry that has been replaced in the meantime.
+    sp<String> value = map->get(String::valueOf("a"));
+    map->put(String::valueOf("a"), String::valueOf("5"));
+    ASSERT_FALSE(map->remove(String::valueOf("a"), value));
+    ASSERT_TRUE(map->get(String::valueOf("a"))->equals("5"));
+    ASSERT_TRUE(map->remove(String::valueOf("a"), map->get(String::valueOf("a"))));
+    ASSERT_FALSE(map->containsKey(String::valueOf("a")));
+    map->put(String::valueOf("a"), String::valueOf("6"));
+    map->clear();
+    ASSERT_TRUE(map->isEmpty());
+
+    const int32_t THREADS = 4;
+    const int32_t KEYS = 1000;
+    sp<ConcurrentHashMap<uint64_t, int32_t>> counters = new ConcurrentHashMap<uint64_t, int32_t>();
+    sp<ArrayList<sp<Thread>>> threads = new ArrayList<sp<Thread>>();
+    for (int32_t i = 0; i < THREADS; i++) {
+        sp<Thread> thread = new Thread([=] {
+            for (int32_t key = 0; key < KEYS; key++) {
+                counters->putIfAbsent((uint64_t) key * THREADS + i, key);
+                counters->get((uint64_t) key);
+            }
+        });
+        thread->start();
+        threads->add(thread);
+    }
+    for (int32_t i = 0; i < THREADS; i++) {
+        threads->get(i)->join();
+    }
+    ASSERT_EQ(counters->size(), (size_t) (THREADS * KEYS));
+    ASSERT_EQ(counters->get(7 * THREADS + 3), 7);
+    const size_t removedCount = counters->removeIf([] (uint64_t key, int32_t value) {
+        return key % THREADS != 0;
+    });
+    ASSERT_EQ(removedCount, (size_t) ((THREADS - 1) * KEYS));
+    ASSERT_EQ(counters->size(), (size_t) KEYS);
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/ByteArrayOutputStream.h>
+#include <mindroid/io/DataOutputStream.h>
+#include <mindroid/os/Parcel.h>
+#include <mindroid/os/RemoteException.h>
+#include <mindroid/lang/IndexOutOfBoundsException.h>
+#include <cstring>
+
+using namespace mindroid;
+
+TEST(Mindroid, ParcelPool) {
+    sp<Parcel> parcel = Parcel::obtain();
+    parcel->putInt(42);
+    parcel->putString(String::valueOf("Mindroid"));
+    parcel->putExtra(String::valueOf("key"), 1);
+    parcel->asInput();
+    ASSERT_EQ(parcel->getInt(), 42);
+    Parcel* pointer = parcel.getPointer();
+    parcel->recycle();
+    parcel->recycle();
+    parcel = nullptr;
+
+    // Recycled Parcels are reset to an empty output Parcel.
+    const uint64_t hitCount = Parcel::getPoolHitCount();
+    parcel = Parcel::obtain();
+    ASSERT_EQ(parcel.getPointer(), pointer);
+    ASSERT_EQ(Parcel::getPoolHitCount(), hitCount + 1);
+    ASSERT_EQ(parcel->size(), 0u);
+    ASSERT_FALSE(parcel->hasExtra("key"));
+    parcel->putLong(7);
+    parcel->asInput();
+    ASSERT_EQ(parcel->getLong(), 7u);
+
+    // A recycled Parcel is not handed out twice.
+    sp<Parcel> other = Parcel::obtain();
+    ASSERT_NE(other.getPointer(), pointer);
+
+    // The buffer must fit.
+    parcel->recycle();
+    parcel = Parcel::obtain(2000);
+    ASSERT_GE(parcel->getByteArray()->size(), 2000u);
+    parcel->recycle();
+    parcel = nullptr;
+
+    // Parcels that wrap buffers which are still referenced elsewhere are not pooled.
+    sp<ByteArray> buffer = new ByteArray(256);
+    parcel = Parcel::obtain(buffer);
+    parcel->recycle();
+    parcel = nullptr;
+    for (int32_t i = 0; i < 8; i++) {
+        ASSERT_NE(Parcel::obtain(256)->getByteArray(), buffer);
+    }
+}
+
+TEST(Mindroid, ParcelEncoding) {
+    const int32_t ints[] = { 0, 1, -1, INT32_MIN, INT32_MAX, 0x12345678 };
+    const int64_t longs[] = { 0, -1, INT64_MIN, INT64_MAX, 0x123456789ABCDEF0LL };
+    const double doubles[] = { 0.0, -1.5, 3.14, 1e300 };
+
+    // Parcels must encode exactly like DataOutputStream for compatibility with Mindroid.java.
+    sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+    sp<DataOutputStream> dataOutputStream = new DataOutputStream(outputStream);
+    sp<Parcel> parcel = Parcel::obtain(8);
+    for (int32_t i = 0; i < 100; i++) {
+        dataOutputStream->writeBoolean(i % 2 == 0);
+        parcel->putBoolean(i % 2 == 0);
+        dataOutputStream->writeByte((uint8_t) i);
+        parcel->putByte((uint8_t) i);
+        dataOutputStream->writeChar('a' + i % 26);
+        parcel->putChar('a' + i % 26);
+        dataOutputStream->writeShort((int16_t) (i * -300));
+        parcel->putShort((int16_t) (i * -300));
+        dataOutputStream->writeInt(i * -100000);
+        parcel->putInt(i * -100000);
+        dataOutputStream->writeLong((int64_t) i * -10000000000LL);
+        parcel->putLong((int64_t) i * -10000000000LL);
+        dataOutputStream->writeFloat(i * 0.25f);
+        parcel->putFloat(i * 0.25f);
+        dataOutputStream->writeDouble(i * -0.125);
+        parcel->putDouble(i * -0.125);
+        sp<String> string = String::format("Mindroid %d", i);
+        dataOutputStream->writeUTF(string);
+        parcel->putString(string);
+    }
+    for (int32_t value : ints) {
+        dataOutputStream->writeInt(value);
+    }
+    parcel->putInts(ints, sizeof(ints) / sizeof(ints[0]));
+    for (int64_t value : longs) {
+        dataOutputStream->writeLong(value);
+    }
+    parcel->putLongs(longs, sizeof(longs) / sizeof(longs[0]));
+    for (double value : doubles) {
+        dataOutputStream->writeDouble(value);
+    }
+    parcel->putDoubles(doubles, sizeof(doubles) / sizeof(doubles[0]));
+
+    ASSERT_EQ(parcel->size(), outputStream->size());
+    ASSERT_EQ(std::memcmp(parcel->getByteArray()->c_arr(), outputStream->getByteArray()->c_arr(), parcel->size()), 0);
+
+    parcel->asInput();
+    ASSERT_TRUE(parcel->getBoolean());
+    ASSERT_EQ(parcel->getByte(), 0);
+    ASSERT_EQ(parcel->getChar(), 'a');
+    ASSERT_EQ(parcel->getShort(), 0);
+    ASSERT_EQ(parcel->getInt(), 0);
+    ASSERT_EQ(parcel->getLong(), 0u);
+    ASSERT_EQ(parcel->getFloat(), 0.0f);
+    ASSERT_EQ(parcel->getDouble(), 0.0);
+    ASSERT_TRUE(parcel->getString()->equals("Mindroid 0"));
+    ASSERT_FALSE(parcel->getBoolean());
+    ASSERT_EQ(parcel->getByte(), 1);
+    ASSERT_EQ(parcel->getChar(), 'b');
+    ASSERT_EQ((int16_t) parcel->getShort(), -300);
+    ASSERT_EQ(parcel->getInt(), -100000);
+    ASSERT_EQ((int64_t) parcel->getLong(), -10000000000LL);
+    ASSERT_EQ(parcel->getFloat(), 0.25f);
+    ASSERT_EQ(parcel->getDouble(), -0.125);
+    ASSERT_TRUE(parcel->getString()->equals("Mindroid 1"));
+}
+
+TEST(Mindroid, ParcelViews) {
+    sp<Parcel> source = Parcel::obtain();
+    source->putInt(1);
+    source->putString(String::valueOf("Mindroid"));
+    source->putLong(2);
+    sp<ByteArray> buffer = source->getByteArray();
+    const size_t size = source->size();
+
+    // Parcels borrow received buffers without copying them.
+    sp<Parcel> parcel = Parcel::obtain(buffer, 0, size);
+    ASSERT_EQ(parcel->getByteArray(), buffer);
+    ASSERT_EQ(parcel->getInt(), 1);
+    ASSERT_TRUE(parcel->getString()->equals("Mindroid"));
+    ASSERT_EQ(parcel->getLong(), 2u);
+    ASSERT_THROW(parcel->getInt(), RemoteException);
+
+    // A slice starts at its offset.
+    parcel = Parcel::obtain(buffer, 4, size - 4);
+    ASSERT_EQ(parcel->size(), size - 4);
+    ASSERT_TRUE(parcel->getString()->equals("Mindroid"));
+    sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+    parcel->writeTo(outputStream);
+    ASSERT_EQ(outputStream->size(), size - 4);
+    ASSERT_EQ(std::memcmp(outputStream->getByteArray()->c_arr(), buffer->c_arr() + 4, size - 4), 0);
+    ASSERT_THROW(Parcel::obtain(buffer, 4, buffer->size()), IndexOutOfBoundsException);
+
+    // Only getByteArray() of a slice at a non-zero offset copies, and the read position is kept.
+    sp<ByteArray> copy = parcel->getByteArray();
+    ASSERT_NE(copy, buffer);
+    ASSERT_EQ(std::memcmp(copy->c_arr(), buffer->c_arr() + 4, size - 4), 0);
+    ASSERT_EQ(parcel->getLong(), 2u);
+
+    // Writing to a borrowed buffer copies it first.
+    parcel = Parcel::obtain(buffer, 0, size);
+    parcel->asOutput();
+    parcel->putInt(3);
+    ASSERT_NE(parcel->getByteArray(), buffer);
+    ASSERT_EQ(parcel->size(), size + 4);
+    parcel->asInput();
+    ASSERT_EQ(parcel->getInt(), 1);
+    source->asInput();
+    ASSERT_EQ(source->getInt(), 1);
+    ASSERT_TRUE(source->getString()->equals("Mindroid"));
+    ASSERT_EQ(source->getLong(), 2u);
+}
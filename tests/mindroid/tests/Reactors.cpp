@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/ByteArrayOutputStream.h>
+#include <mindroid/io/DataInputStream.h>
+#include <mindroid/io/DataOutputStream.h>
+#include <mindroid/io/File.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/net/ServerSocket.h>
+#include <mindroid/os/Binder.h>
+#include <mindroid/os/Bundle.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Parcel.h>
+#include <mindroid/runtime/system/Mindroid.h>
+#include <mindroid/runtime/system/Runtime.h>
+#include <mindroid/runtime/system/io/AbstractClient.h>
+#include <mindroid/runtime/system/io/AbstractServer.h>
+#include <mindroid/runtime/system/io/Reactor.h>
+#include <mindroid/util/concurrent/Promise.h>
+#include <mindroid/testing/Sockets.h>
+#include <algorithm>
+
+using namespace mindroid;
+
+/*
+ * Replies to each message of an int and a payload with the int.
+ */
+class EchoServer : public AbstractServer {
+public:
+    EchoServer(const sp<Reactor>& reactor) : AbstractServer(reactor) {
+    }
+
+    void onConnected(const sp<Connection>& connection) override {
+    }
+
+    void onDisconnected(const sp<Connection>& connection, const sp<Exception>& cause) override {
+    }
+
+    void onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) override {
+        sp<DataInputStream> dataInputStream = new DataInputStream(inputStream);
+        int32_t value = dataInputStream->readInt();
+        int32_t size = dataInputStream->readInt();
+        sp<ByteArray> payload = new ByteArray(size);
+        dataInputStream->readFully(payload, 0, size);
+        for (int32_t i = 0; i < size; i++) {
+            ASSERT_EQ(payload->get(i), (uint8_t) (value + i));
+        }
+        sp<DataOutputStream> dataOutputStream = new DataOutputStream(outputStream);
+        dataOutputStream->writeInt(value);
+    }
+};
+
+class EchoClient : public AbstractClient {
+public:
+    EchoClient(uint32_t nodeId, const sp<Reactor>& reactor, int32_t messageCount) :
+            AbstractClient(nodeId, reactor),
+            mMessageCount(messageCount),
+            mResult(new Promise<int32_t>()) {
+    }
+
+    void onConnected() override {
+    }
+
+    void onDisconnected(const sp<Exception>& cause) override {
+    }
+
+    void onTransact(const sp<Bundle>& context, const sp<InputStream>& inputStream, const sp<OutputStream>& outputStream) override {
+        sp<DataInputStream> dataInputStream = new DataInputStream(inputStream);
+        int32_t value = dataInputStream->readInt();
+        mSum += value;
+        if (++mReplyCount == mMessageCount) {
+            mResult->complete(mSum);
+        }
+    }
+
+    sp<Promise<int32_t>> getResult() {
+        return mResult;
+    }
+
+private:
+    const int32_t mMessageCount;
+    int32_t mReplyCount = 0;
+    int32_t mSum = 0;
+    sp<Promise<int32_t>> mResult;
+};
+
+TEST(Mindroid, Reactor) {
+    const int32_t CLIENT_COUNT = 20;
+    const int32_t MESSAGE_COUNT = 10;
+
+    sp<Reactor> reactor = new Reactor(2);
+    reactor->start();
+    sp<String> uri = Sockets::getUri(Sockets::getFreePort());
+    sp<EchoServer> server = new EchoServer(reactor);
+    server->start(uri);
+
+    sp<ArrayList<sp<EchoClient>>> clients = new ArrayList<sp<EchoClient>>();
+    for (int32_t i = 0; i < CLIENT_COUNT; i++) {
+        sp<EchoClient> client = new EchoClient(i + 1, reactor, MESSAGE_COUNT);
+        client->start(uri);
+        clients->add(client);
+    }
+
+    for (int32_t i = 0; i < MESSAGE_COUNT; i++) {
+        for (int32_t j = 0; j < CLIENT_COUNT; j++) {
+            sp<DataOutputStream> outputStream = new DataOutputStream(clients->get(j)->getOutputStream());
+            // Some payloads are larger than the receive buffers.
+            const int32_t size = (i % 3 == 0) ? 64 * 1024 : i * 100;
+            sp<ByteArray> payload = new ByteArray(size);
+            for (int32_t k = 0; k < size; k++) {
+                payload->set(k, (uint8_t) (i + k));
+            }
+            outputStream->writeShort(0);
+            if (j == 0) {
+                // Let the server see partial messages.
+                Thread::sleep(1);
+            }
+            outputStream->writeShort(i);
+            outputStream->writeInt(size);
+            outputStream->write(payload, 0, size);
+        }
+    }
+
+    for (int32_t i = 0; i < CLIENT_COUNT; i++) {
+        ASSERT_EQ(clients->get(i)->getResult()->get(10000), MESSAGE_COUNT * (MESSAGE_COUNT - 1) / 2);
+        clients->get(i)->shutdown(nullptr);
+    }
+    server->shutdown(nullptr);
+    reactor->shutdown();
+}
+
+TEST(Mindroid, ReactorClose) {
+    const int32_t CLIENT_COUNT = 10;
+
+    sp<Reactor> reactor = new Reactor(4);
+    reactor->start();
+    for (int32_t i = 0; i < 10; i++) {
+        sp<String> uri = Sockets::getUri(Sockets::getFreePort());
+        sp<EchoServer> server = new EchoServer(reactor);
+        server->start(uri);
+        sp<ArrayList<sp<EchoClient>>> clients = new ArrayList<sp<EchoClient>>();
+        for (int32_t j = 0; j < CLIENT_COUNT; j++) {
+            sp<EchoClient> client = new EchoClient(j + 1, reactor, 1);
+            client->start(uri);
+            sp<DataOutputStream> outputStream = new DataOutputStream(client->getOutputStream());
+            outputStream->writeShort(0);
+            outputStream->writeShort(j);
+            outputStream->writeInt(0);
+            clients->add(client);
+        }
+
+        // The clients are shut down while the I/O threads see the server close their connections.
+        sp<Thread> thread = new Thread([=] {
+            for (int32_t j = 0; j < CLIENT_COUNT; j++) {
+                clients->get(j)->shutdown(nullptr);
+            }
+        });
+        thread->start();
+        server->shutdown(nullptr);
+        thread->join();
+    }
+    reactor->shutdown();
+}
+
+/*
+ * Replies to each transaction with the number of payload bytes that have the value (what + index).
+ */
+class PayloadService : public Binder {
+public:
+    PayloadService(const sp<Looper>& looper) : Binder(looper) {
+        attachInterface(nullptr, String::valueOf("mindroid://interfaces/PayloadService"));
+    }
+
+    void onTransact(int32_t what, const sp<Parcel>& data, const sp<Promise<sp<Parcel>>>& result) override {
+        const size_t size = data->size();
+        int32_t count = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (data->getByte() == (uint8_t) (what + i)) {
+                count++;
+            }
+        }
+        sp<Parcel> parcel = Parcel::obtain();
+        parcel->putInt(count);
+        result->complete(parcel);
+    }
+};
+
+TEST(Mindroid, ReactorLargeMessage) {
+    // The message is larger than the receive buffer of a connection and arrives in several chunks.
+    const int32_t SIZE = 256 * 1024;
+    const size_t CHUNK_SIZE = 8 * 1024;
+
+    Runtime::start(1, nullptr);
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+    sp<Reactor> reactor = new Reactor(1);
+    reactor->start();
+
+    {
+        sp<PayloadService> service = new PayloadService(thread->getLooper());
+        const uint16_t port = Sockets::getFreePort();
+        sp<Mindroid::Server> server = new Mindroid::Server(Runtime::getRuntime(), reactor);
+        server->start(Sockets::getUri(port));
+
+        sp<ByteArray> payload = new ByteArray(SIZE);
+        for (int32_t i = 0; i < SIZE; i++) {
+            payload->set(i, (uint8_t) (7 + i));
+        }
+        sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+        Mindroid::Message::newMessage(service->getUri()->toString(), 1, 7, payload)->write(outputStream);
+        sp<ByteArray> message = outputStream->toByteArray();
+
+        sp<Socket> socket = new Socket("127.0.0.1", port);
+        for (size_t offset = 0; offset < message->size(); offset += CHUNK_SIZE) {
+            socket->getOutputStream()->write(message, offset, std::min(CHUNK_SIZE, message->size() - offset));
+            Thread::sleep(1);
+        }
+        sp<Mindroid::Message> reply = Mindroid::Message::newMessage(new DataInputStream(socket->getInputStream()));
+        ASSERT_TRUE(reply->type == Mindroid::Message::MESSAGE_TYPE_TRANSACTION);
+        ASSERT_EQ(reply->transactionId, 1);
+        ASSERT_EQ(Parcel::obtain(reply->data)->getInt(), SIZE);
+
+        socket->close();
+        server->shutdown(nullptr);
+    }
+
+    reactor->shutdown();
+    thread->quit();
+    Runtime::shutdown();
+}
@@ -95,3 +95,63 @@ TEST(Mindroid, BuggyMultiThreadedReferenceCounting) {
     thread.clear();
     ASSERT_EQ(test->getStrongReferenceCount(), 1);
 }
+
+class ThreadConfinedTest : public ::Test {
+public:
+    ThreadConfinedTest(int32_t id) : ::Test(id) {
+    }
+
+    using Object::setThreadConfined;
+    using Object::isThreadConfined;
+};
+
+TEST(Mindroid, ThreadConfinedReferenceCounting) {
+    sp<ThreadConfinedTest> ref1 = new ThreadConfinedTest(1);
+    ref1->setThreadConfined(true);
+    ASSERT_TRUE(ref1->isThreadConfined());
+
+    {
+        sp<ThreadConfinedTest> ref2 = ref1;
+        sp<Object> ref3 = ref2;
+        ASSERT_EQ(ref1->getStrongReferenceCount(), 3);
+    }
+    ASSERT_EQ(ref1->getStrongReferenceCount(), 1);
+
+    wp<ThreadConfinedTest> ref4 = ref1;
+    ASSERT_NE(ref4.get(), nullptr);
+
+    // Hand the object over to another thread.
+    ref1->setThreadConfined(false);
+    sp<Promise<bool>> promise = new Promise<bool>();
+    sp<Thread> thread = new Thread([=] {
+        ASSERT_EQ(ref1->getStrongReferenceCount(), 2);
+        ASSERT_FALSE(ref1->isThreadConfined());
+        promise->complete(true);
+    });
+    thread->start();
+    ASSERT_TRUE(promise->get());
+    thread->join();
+    thread.clear();
+    ASSERT_EQ(ref1->getStrongReferenceCount(), 1);
+
+    ref1->setThreadConfined(true);
+    ref1 = nullptr;
+    ASSERT_EQ(ref4.get(), nullptr);
+}
+
+TEST(Mindroid, LazyWeakReference) {
+    sp<::Test> ref1 = new ::Test(1);
+    sp<::Test> ref2 = ref1;
+    sp<Object> ref3 = ref1;
+    ASSERT_EQ(ref1->getStrongReferenceCount(), 3);
+
+    // The first weak reference moves the inline strong reference count into the weak reference control block.
+    wp<::Test> ref4 = ref1;
+    ASSERT_EQ(ref1->getStrongReferenceCount(), 3);
+    ASSERT_EQ(ref4.get(), ref1);
+    ref2 = nullptr;
+    ref3 = nullptr;
+    ASSERT_EQ(ref1->getStrongReferenceCount(), 1);
+    ref1 = nullptr;
+    ASSERT_EQ(ref4.get(), nullptr);
+}
@@ -15,6 +15,8 @@
  */
 
 #include <gtest/gtest.h>
+#include <mindroid/io/BufferedOutputStream.h>
+#include <mindroid/io/DataInputStream.h>
 #include <mindroid/io/IOException.h>
 #include <mindroid/net/Socket.h>
 #include <mindroid/net/ServerSocket.h>
@@ -234,6 +236,50 @@ TEST(Mindroid, TcpIpV4AnyHost) {
     socket->close();
 }
 
+TEST(Mindroid, TcpIpGatheringWrite) {
+    const size_t PAYLOAD_SIZE = 4 * 1024 * 1024;
+    sp<Promise<bool>> promise = new Promise<bool>();
+    sp<InetAddress> inetAddress = InetAddress::getByName(IPV4_LOCALHOST);
+    sp<Thread> thread = new Thread([=] {
+        sp<ServerSocket> serverSocket = new ServerSocket();
+        serverSocket->setReuseAddress(true);
+        serverSocket->bind(new InetSocketAddress((sp<InetAddress>) inetAddress, 1234));
+        promise->complete(true);
+        sp<Socket> socket = serverSocket->accept();
+        sp<DataInputStream> inputStream = new DataInputStream(socket->getInputStream());
+        sp<ByteArray> buffer = new ByteArray(PAYLOAD_SIZE);
+        for (int32_t i = 0; i < 2; i++) {
+            ASSERT_EQ(inputStream->readInt(), 0x12345678);
+            inputStream->readFully(buffer, 0, PAYLOAD_SIZE);
+            for (size_t j = 0; j < PAYLOAD_SIZE; j += 4096) {
+                ASSERT_EQ(buffer->get(j), (uint8_t) (j / 4096));
+            }
+        }
+        ASSERT_EQ(inputStream->readInt(), 42);
+        socket->close();
+        serverSocket->close();
+    });
+    thread->start();
+    promise->get();
+    sp<Socket> socket = new Socket();
+    socket->connect(new InetSocketAddress(inetAddress, 1234));
+    sp<ByteArray> header = new ByteArray({0x00, 0x12, 0x34, 0x56, 0x78, 0x00});
+    sp<ByteArray> payload = new ByteArray(PAYLOAD_SIZE + 2);
+    for (size_t j = 0; j < PAYLOAD_SIZE; j += 4096) {
+        payload->set(j + 2, (uint8_t) (j / 4096));
+    }
+    // The payload exceeds the socket buffers, so the kernel accepts it in parts.
+    sp<OutputStream> outputStream = socket->getOutputStream();
+    outputStream->write(header, 1, 4, payload, 2, PAYLOAD_SIZE);
+    sp<BufferedOutputStream> bufferedOutputStream = new BufferedOutputStream(outputStream);
+    bufferedOutputStream->write(header, 1, 4);
+    bufferedOutputStream->write(payload, 2, PAYLOAD_SIZE);
+    sp<ByteArray> trailer = new ByteArray({0, 0, 0, 42});
+    outputStream->write(trailer, 0, 0, trailer, 0, 4);
+    thread->join();
+    socket->close();
+}
+
 TEST(Mindroid, UdpIpV6Localhost) {
     sp<Promise<bool>> promise = new Promise<bool>();
     sp<InetAddress> inetAddress = InetAddress::getByName("ip6-localhost");
@@ -141,3 +141,52 @@ TEST(Mindroid, Strings) {
     sp<String> s22 = String::format("%s, %s", nullptr, s21);
     ASSERT_EQ(s22->equals("(null), nullptr"), true);
 }
+
+TEST(Mindroid, ShortAndLongStrings) {
+    // Strings up to 22 characters are stored inline, longer ones in a separate buffer.
+    const char* text = "0123456789012345678901234567890123456789";
+    for (size_t size = 0; size <= 40; size++) {
+        sp<String> s = String::valueOf(text, size);
+        ASSERT_EQ(s->length(), size);
+        ASSERT_EQ(strncmp(s->c_str(), text, size), 0);
+        ASSERT_EQ(s->c_str()[size], '\0');
+        sp<String> s2 = s->append("x")->toUpperCase()->substring(0, size);
+        ASSERT_TRUE(s2->equals(s));
+        ASSERT_EQ(s2->hashCode(), s->hashCode());
+    }
+    ASSERT_TRUE(String::valueOf(1234567890)->equals("1234567890"));
+    ASSERT_TRUE(String::format("%s/%s", text, text)->endsWith("/0123456789012345678901234567890123456789"));
+
+    sp<String> nullString = new String((const char*) nullptr);
+    ASSERT_EQ(nullString->c_str(), nullptr);
+    ASSERT_EQ(nullString->length(), 0u);
+}
+
+TEST(Mindroid, InternedStrings) {
+    sp<String> s1 = String::intern("dataInputStream");
+    sp<String> s2 = String::valueOf("dataInputStream");
+    ASSERT_TRUE(s1->isInterned());
+    ASSERT_FALSE(s2->isInterned());
+    ASSERT_EQ(s2->intern(), s1);
+    ASSERT_EQ(s1->intern(), s1);
+    ASSERT_EQ(String::intern("dataInputStream"), s1);
+    ASSERT_TRUE(s1->equals(s2));
+    ASSERT_TRUE(s2->equals(s1));
+    ASSERT_EQ(s1->hashCode(), s2->hashCode());
+
+    sp<String> s3 = String::intern("dataOutputStream");
+    ASSERT_NE(s3, s1);
+    ASSERT_FALSE(s1->equals(s3));
+    ASSERT_TRUE(s3->equals("dataOutputStream"));
+    ASSERT_EQ(String::intern(nullptr), nullptr);
+}
+
+TEST(Mindroid, StringHashCodes) {
+    sp<String> s1 = String::valueOf("mindroid://1.42");
+    sp<String> s2 = String::format("mindroid://%d.%d", 1, 42);
+    ASSERT_EQ(s1->hashCode(), s2->hashCode());
+    // The hash code is cached after the first computation.
+    ASSERT_EQ(s1->hashCode(), s2->hashCode());
+    ASSERT_EQ(String::EMPTY_STRING->hashCode(), 0u);
+    ASSERT_NE(String::valueOf("a")->hashCode(), String::valueOf("b")->hashCode());
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 Daniel Himmelein
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <mindroid/io/ByteArrayInputStream.h>
+#include <mindroid/io/ByteArrayOutputStream.h>
+#include <mindroid/io/DataInputStream.h>
+#include <mindroid/io/File.h>
+#include <mindroid/io/FileOutputStream.h>
+#include <mindroid/lang/Thread.h>
+#include <mindroid/net/ServerSocket.h>
+#include <mindroid/net/URI.h>
+#include <mindroid/os/Binder.h>
+#include <mindroid/os/HandlerThread.h>
+#include <mindroid/os/Parcel.h>
+#include <mindroid/runtime/system/Mindroid.h>
+#include <mindroid/runtime/system/Runtime.h>
+#include <mindroid/util/concurrent/Promise.h>
+#include <mindroid/testing/Sockets.h>
+#include <atomic>
+#include <unistd.h>
+
+using namespace mindroid;
+
+/*
+ * Replies to each transaction with its what value once the test releases it.
+ */
+class DeferredService : public Binder {
+public:
+    DeferredService(const sp<Looper>& looper) : Binder(looper) {
+        attachInterface(nullptr, String::valueOf("mindroid://interfaces/DeferredService"));
+    }
+
+    void onTransact(int32_t what, const sp<Parcel>& data, const sp<Promise<sp<Parcel>>>& result) override {
+        sp<Parcel> parcel = Parcel::obtain();
+        parcel->putInt(what);
+        AutoLock autoLock(mLock);
+        mResults->add(result);
+        mReplies->add(parcel);
+    }
+
+    size_t getPendingCount() {
+        AutoLock autoLock(mLock);
+        return mResults->size();
+    }
+
+    void release() {
+        AutoLock autoLock(mLock);
+        mResults->remove(0)->complete(mReplies->remove(0));
+    }
+
+private:
+    sp<ReentrantLock> mLock = new ReentrantLock();
+    sp<ArrayList<sp<Promise<sp<Parcel>>>>> mResults = new ArrayList<sp<Promise<sp<Parcel>>>>();
+    sp<ArrayList<sp<Parcel>>> mReplies = new ArrayList<sp<Parcel>>();
+};
+
+/*
+ * Replies to each transaction with its what value right away.
+ */
+class ImmediateService : public Binder {
+public:
+    ImmediateService(const sp<Looper>& looper) : Binder(looper) {
+        attachInterface(nullptr, String::valueOf("mindroid://interfaces/ImmediateService"));
+    }
+
+    void onTransact(int32_t what, const sp<Parcel>& data, const sp<Promise<sp<Parcel>>>& result) override {
+        sp<Parcel> parcel = Parcel::obtain();
+        parcel->putInt(what);
+        result->complete(parcel);
+    }
+};
+
+TEST(Mindroid, PipelinedTransactions) {
+    Runtime::start(1, nullptr);
+    sp<Mindroid> plugin = new Mindroid();
+    plugin->setUp(Runtime::getRuntime());
+    plugin->start(nullptr, nullptr)->get();
+    sp<HandlerThread> deferredThread = new HandlerThread();
+    deferredThread->start();
+    sp<HandlerThread> immediateThread = new HandlerThread();
+    immediateThread->start();
+
+    {
+        sp<DeferredService> deferredService = new DeferredService(deferredThread->getLooper());
+        sp<ImmediateService> immediateService = new ImmediateService(immediateThread->getLooper());
+        sp<String> uri = Sockets::getUri(Sockets::getFreePort());
+        sp<Mindroid::Server> server = new Mindroid::Server(Runtime::getRuntime(), nullptr);
+        server->start(uri);
+        sp<Mindroid::Client> client = new Mindroid::Client(plugin, 1);
+        client->start(uri);
+
+        // Replies complete their transactions out of order.
+        sp<Promise<sp<Parcel>>> deferredResult = client->transact(deferredService, 1, Parcel::obtain(), 0);
+        sp<Promise<sp<Parcel>>> immediateResult = client->transact(immediateService, 2, Parcel::obtain(), 0);
+        ASSERT_EQ(immediateResult->get(10000)->getInt(), 2);
+        ASSERT_FALSE(deferredResult->isDone());
+        // The services run on different threads, so the deferred transaction may arrive after the immediate one.
+        while (deferredService->getPendingCount() < 1) {
+            Thread::sleep(1);
+        }
+        deferredService->release();
+        ASSERT_EQ(deferredResult->get(10000)->getInt(), 1);
+
+        // Transactions beyond the in-flight window wait for a slot.
+        sp<ArrayList<sp<Promise<sp<Parcel>>>>> results = new ArrayList<sp<Promise<sp<Parcel>>>>();
+        for (int32_t i = 0; i < Mindroid::MAX_IN_FLIGHT_TRANSACTIONS; i++) {
+            results->add(client->transact(deferredService, i, Parcel::obtain(), 0));
+        }
+        std::atomic<bool> isSent(false);
+        sp<Thread> thread = new Thread([&] {
+            results->add(client->transact(immediateService, -1, Parcel::obtain(), 0));
+            isSent = true;
+        });
+        thread->start();
+        Thread::sleep(100);
+        ASSERT_FALSE(isSent);
+        while (deferredService->getPendingCount() < (size_t) Mindroid::MAX_IN_FLIGHT_TRANSACTIONS) {
+            Thread::sleep(10);
+        }
+        deferredService->release();
+        thread->join();
+        ASSERT_TRUE(isSent);
+        ASSERT_EQ(results->get(0)->get(10000)->getInt(), 0);
+        ASSERT_EQ(results->get(Mindroid::MAX_IN_FLIGHT_TRANSACTIONS)->get(10000)->getInt(), -1);
+        for (int32_t i = 1; i < Mindroid::MAX_IN_FLIGHT_TRANSACTIONS; i++) {
+            deferredService->release();
+            ASSERT_EQ(results->get(i)->get(10000)->getInt(), i);
+        }
+
+        client->shutdown(nullptr);
+        server->shutdown(nullptr);
+    }
+
+    deferredThread->quit();
+    immediateThread->quit();
+    plugin->stop(nullptr, nullptr);
+    plugin->tearDown();
+    Runtime::shutdown();
+}
+
+TEST(Mindroid, MessageFormats) {
+    sp<ByteArray> payload = new ByteArray(4);
+    payload->set(0, 42);
+    sp<ByteArrayOutputStream> outputStream = new ByteArrayOutputStream();
+    Mindroid::Message::newMessage(String::valueOf("mindroid://1.42"), 7, 3, payload)->write(outputStream);
+    const size_t v1Size = outputStream->size();
+    ASSERT_EQ(v1Size, Mindroid::Message::HEADER_SIZE + 15 + payload->size());
+    Mindroid::Message::newMessage(((uint64_t) 1 << 32) | 42, 8, 3, payload, payload->size())->write(outputStream);
+    ASSERT_EQ(outputStream->size() - v1Size, Mindroid::Message::FORMAT_V2_HEADER_SIZE + payload->size());
+    sp<Mindroid::Message> request = Mindroid::Message::newMessage(((uint64_t) 1 << 32) | 42, 9, 3, payload, payload->size());
+    request->newReply(Mindroid::Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION, payload, payload->size())->write(outputStream);
+    Mindroid::Message::newFormatNegotiationMessage(Mindroid::Message::FORMAT_V2)->write(outputStream);
+
+    sp<ByteArray> buffer = outputStream->toByteArray();
+    // FORMAT_V1 messages start with a 0 byte, FORMAT_V2 messages with FORMAT_V2_FLAG.
+    ASSERT_EQ(buffer->get(0), 0);
+    ASSERT_EQ(buffer->get(v1Size), Mindroid::Message::FORMAT_V2_FLAG | Mindroid::Message::MESSAGE_TYPE_TRANSACTION);
+    sp<DataInputStream> inputStream = new DataInputStream(new ByteArrayInputStream(buffer));
+
+    sp<Mindroid::Message> message = Mindroid::Message::newMessage(inputStream);
+    ASSERT_TRUE(message->format == Mindroid::Message::FORMAT_V1);
+    ASSERT_TRUE(message->type == Mindroid::Message::MESSAGE_TYPE_TRANSACTION);
+    ASSERT_STREQ(message->uri->c_str(), "mindroid://1.42");
+    ASSERT_EQ(message->transactionId, 7);
+    ASSERT_EQ(message->what, 3);
+    ASSERT_EQ(message->size, payload->size());
+    ASSERT_EQ(message->data->get(0), 42);
+
+    message = Mindroid::Message::newMessage(inputStream);
+    ASSERT_TRUE(message->format == Mindroid::Message::FORMAT_V2);
+    ASSERT_TRUE(message->type == Mindroid::Message::MESSAGE_TYPE_TRANSACTION);
+    ASSERT_EQ(message->binderId, ((uint64_t) 1 << 32) | 42);
+    ASSERT_EQ(message->transactionId, 8);
+    ASSERT_EQ(message->what, 3);
+    ASSERT_EQ(message->size, payload->size());
+    ASSERT_EQ(message->data->get(0), 42);
+
+    message = Mindroid::Message::newMessage(inputStream);
+    ASSERT_TRUE(message->format == Mindroid::Message::FORMAT_V2);
+    ASSERT_TRUE(message->type == Mindroid::Message::MESSAGE_TYPE_EXCEPTION_TRANSACTION);
+    ASSERT_EQ(message->transactionId, 9);
+
+    message = Mindroid::Message::newMessage(inputStream);
+    ASSERT_TRUE(message->format == Mindroid::Message::FORMAT_V1);
+    ASSERT_TRUE(message->type == Mindroid::Message::MESSAGE_TYPE_FORMAT_NEGOTIATION);
+    ASSERT_TRUE(message->what == Mindroid::Message::FORMAT_V2);
+    ASSERT_EQ(inputStream->available(), 0);
+}
+
+/*
+ * Transacts twice with each of three binders of the local node through proxies and the Mindroid plugin and
+ * returns the number of connections that the plugin has opened to the server of the node.
+ */
+static size_t countConnections(const char* routing) {
+    sp<File> file = new File(String::format("/tmp/MindroidConnectionPool-%d.xml", ::getpid()));
+    sp<FileOutputStream> outputStream = new FileOutputStream(file);
+    outputStream->write(String::format("<runtime><nodes><node id=\"1\"><plugin scheme=\"mindroid\" class=\"mindroid::Mindroid\">"
+            "<server uri=\"tcp://127.0.0.1:%u\" connections=\"3\" routing=\"%s\" /></plugin></node></nodes></runtime>",
+            Sockets::getFreePort(), routing)->getBytes());
+    outputStream->close();
+    Runtime::start(1, file);
+    file->remove();
+    sp<HandlerThread> thread = new HandlerThread();
+    thread->start();
+
+    size_t connectionCount;
+    {
+        sp<ArrayList<sp<ImmediateService>>> services = new ArrayList<sp<ImmediateService>>();
+        sp<ArrayList<sp<Binder::Proxy>>> proxies = new ArrayList<sp<Binder::Proxy>>();
+        for (int32_t i = 0; i < 3; i++) {
+            sp<ImmediateService> service = new ImmediateService(thread->getLooper());
+            services->add(service);
+            proxies->add(Binder::Proxy::create(URI::create(String::format("%s/if=ImmediateService", service->getUri()->toString()->c_str()))));
+        }
+        for (int32_t i = 0; i < 6; i++) {
+            sp<Promise<sp<Parcel>>> result = proxies->get(i % 3)->transact(i, Parcel::obtain(), 0);
+            EXPECT_EQ(result->get(10000)->getInt(), i);
+        }
+        sp<Mindroid> plugin = object_cast<Mindroid>(Runtime::getRuntime()->getPlugin(String::valueOf("mindroid")));
+        connectionCount = plugin->getConnectionCount(1);
+    }
+
+    thread->quit();
+    Runtime::shutdown();
+    return connectionCount;
+}
+
+TEST(Mindroid, ConnectionPool) {
+    // Each binder has its own connection.
+    ASSERT_EQ(countConnections("binder"), 3u);
+    // Transactions one at a time are all least loaded on the first connection.
+    ASSERT_EQ(countConnections("leastLoaded"), 1u);
+}